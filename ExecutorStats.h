@@ -0,0 +1,258 @@
+//author: Ugo Varetto
+//executor instrumentation: per-worker counters, enqueue to start latency and
+//run time histograms, snapshot API and Chrome trace-event export.
+//
+//Each worker owns one WorkerCounters instance, padded to avoid false sharing,
+//and is its only writer: counters are updated with relaxed load + store, no
+//atomic read-modify-write on the hot path; any thread can take a Snapshot at
+//any time, values read while the workers are running are approximate.
+//
+//Tracing is disabled by default; when enabled each task and idle period is
+//recorded into a bounded per-worker buffer, WriteChromeTrace writes the
+//buffers in the JSON format read by chrome://tracing and Perfetto.
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+typedef std::chrono::steady_clock StatsClock;
+
+//------------------------------------------------------------------------------
+//single writer counter
+class StatCounter {
+public:
+    void Add(std::uint64_t v) {
+        value_.store(value_.load(std::memory_order_relaxed) + v,
+                     std::memory_order_relaxed);
+    }
+    std::uint64_t Get() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+private:
+    std::atomic< std::uint64_t > value_{0};
+};
+
+//histogram data copied out of a DurationHistogram
+struct HistogramSnapshot {
+    enum : int { NUM_BUCKETS = 40 };
+    HistogramSnapshot() : buckets(NUM_BUCKETS, 0), count(0), sumNs(0) {}
+    void Merge(const HistogramSnapshot& h) {
+        for(int b = 0; b != NUM_BUCKETS; ++b) buckets[b] += h.buckets[b];
+        count += h.count;
+        sumNs += h.sumNs;
+    }
+    double MeanUs() const { return count ? sumNs / 1000. / count : 0; }
+    //upper bound (us) of the bucket containing the p-th percentile
+    double PercentileUs(double p) const {
+        if(count == 0) return 0;
+        const std::uint64_t target = std::uint64_t(p / 100. * count);
+        std::uint64_t c = 0;
+        for(int b = 0; b != NUM_BUCKETS; ++b) {
+            c += buckets[b];
+            if(c > target) return double(std::uint64_t(1) << b) / 1000.;
+        }
+        return double(std::uint64_t(1) << (NUM_BUCKETS - 1)) / 1000.;
+    }
+    std::vector< std::uint64_t > buckets; //bucket b: [2^(b-1), 2^b) ns
+    std::uint64_t count;
+    std::uint64_t sumNs;
+};
+
+//log2 histogram of durations, single writer
+class DurationHistogram {
+public:
+    enum : int { NUM_BUCKETS = HistogramSnapshot::NUM_BUCKETS };
+    void Add(StatsClock::duration d) {
+        const std::int64_t n = std::chrono::duration_cast<
+                                 std::chrono::nanoseconds >(d).count();
+        const std::uint64_t ns = n > 0 ? std::uint64_t(n) : 0;
+        int b = 0;
+        while(b < NUM_BUCKETS - 1 && (std::uint64_t(1) << b) <= ns) ++b;
+        buckets_[b].Add(1);
+        sumNs_.Add(ns);
+    }
+    HistogramSnapshot Snapshot() const {
+        HistogramSnapshot h;
+        for(int b = 0; b != NUM_BUCKETS; ++b) {
+            h.buckets[b] = buckets_[b].Get();
+            h.count += h.buckets[b];
+        }
+        h.sumNs = sumNs_.Get();
+        return h;
+    }
+private:
+    StatCounter buckets_[NUM_BUCKETS];
+    StatCounter sumNs_;
+};
+
+//------------------------------------------------------------------------------
+struct WorkerSnapshot {
+    WorkerSnapshot() : tasks(0), steals(0), idleMs(0), busyMs(0) {}
+    void Merge(const WorkerSnapshot& w) {
+        tasks += w.tasks;
+        steals += w.steals;
+        idleMs += w.idleMs;
+        busyMs += w.busyMs;
+        latency.Merge(w.latency);
+        runTime.Merge(w.runTime);
+    }
+    std::uint64_t tasks;  //tasks executed
+    std::uint64_t steals; //tasks taken from other workers' queues
+    double idleMs;        //time spent waiting for work
+    double busyMs;        //time spent executing tasks
+    HistogramSnapshot latency; //enqueue to start
+    HistogramSnapshot runTime; //start to end
+};
+
+struct ExecutorSnapshot {
+    WorkerSnapshot Total() const {
+        WorkerSnapshot t;
+        for(auto& w: workers) t.Merge(w);
+        return t;
+    }
+    void Print(std::ostream& os) const {
+        auto print = [&os](const char* label, int id,
+                           const WorkerSnapshot& w) {
+            os << label;
+            if(id >= 0) os << ' ' << std::setw(2) << id;
+            os << ": " << w.tasks << " tasks, " << w.steals << " steals, "
+               << "busy " << w.busyMs << " ms, idle " << w.idleMs << " ms\n"
+               << "    latency (us) mean/p50/p99 " << w.latency.MeanUs()
+               << '/' << w.latency.PercentileUs(50) << '/'
+               << w.latency.PercentileUs(99) << ", "
+               << "run time (us) mean/p99 " << w.runTime.MeanUs() << '/'
+               << w.runTime.PercentileUs(99) << '\n';
+        };
+        for(std::size_t i = 0; i != workers.size(); ++i)
+            print("Worker", int(i), workers[i]);
+        print("Total", -1, Total());
+    }
+    std::vector< WorkerSnapshot > workers;
+};
+
+//------------------------------------------------------------------------------
+class ExecutorStats {
+    struct TraceEvent {
+        const char* name;
+        StatsClock::time_point start;
+        StatsClock::time_point end;
+    };
+    //written only by the owning worker thread
+    struct WorkerCounters {
+        StatCounter tasks;
+        StatCounter steals;
+        StatCounter idleNs;
+        StatCounter busyNs;
+        DurationHistogram latency;
+        DurationHistogram runTime;
+        std::mutex traceMutex; //uncontended unless dumping while running
+        std::vector< TraceEvent > trace;
+        char pad[64];
+    };
+public:
+    ExecutorStats() : origin_(StatsClock::now()) {}
+    //allocate the counters for numworkers workers, discarding all data;
+    //must not be called while the workers are running, can be called while
+    //other threads take snapshots
+    void Reset(int numworkers) {
+        std::lock_guard< std::mutex > guard(workersMutex_);
+        workers_.clear();
+        for(int w = 0; w != numworkers; ++w)
+            workers_.push_back(std::unique_ptr< WorkerCounters >(
+                                 new WorkerCounters));
+        origin_ = StatsClock::now();
+    }
+    //start or stop recording trace events, at most maxevents per worker
+    void EnableTrace(bool on, std::size_t maxevents = 1 << 20) {
+        maxEvents_.store(maxevents);
+        tracing_.store(on);
+    }
+    bool Tracing() const { return tracing_.load(std::memory_order_relaxed); }
+    //called by worker id after executing a task
+    void RecordTask(int id, StatsClock::time_point enqueued,
+                    StatsClock::time_point start,
+                    StatsClock::time_point end) {
+        WorkerCounters& w = *workers_[id];
+        w.tasks.Add(1);
+        w.busyNs.Add(Ns(end - start));
+        w.latency.Add(start - enqueued);
+        w.runTime.Add(end - start);
+        if(Tracing()) Trace(w, "task", start, end);
+    }
+    //called by worker id after waiting for work
+    void RecordIdle(int id, StatsClock::time_point start,
+                    StatsClock::time_point end) {
+        WorkerCounters& w = *workers_[id];
+        w.idleNs.Add(Ns(end - start));
+        if(Tracing()) Trace(w, "idle", start, end);
+    }
+    void RecordSteal(int id) { workers_[id]->steals.Add(1); }
+    ExecutorSnapshot Snapshot() const {
+        std::lock_guard< std::mutex > guard(workersMutex_);
+        ExecutorSnapshot s;
+        for(auto& c: workers_) {
+            WorkerSnapshot w;
+            w.tasks = c->tasks.Get();
+            w.steals = c->steals.Get();
+            w.idleMs = c->idleNs.Get() / 1E6;
+            w.busyMs = c->busyNs.Get() / 1E6;
+            w.latency = c->latency.Snapshot();
+            w.runTime = c->runTime.Snapshot();
+            s.workers.push_back(w);
+        }
+        return s;
+    }
+    //Chrome trace-event format: one complete ('X') event per task or idle
+    //period, one thread per worker, timestamps in us from Reset
+    void WriteChromeTrace(std::ostream& os) const {
+        const std::ios::fmtflags flags = os.flags();
+        const std::streamsize precision = os.precision();
+        std::lock_guard< std::mutex > guard(workersMutex_);
+        os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+        bool first = true;
+        for(std::size_t id = 0; id != workers_.size(); ++id) {
+            WorkerCounters& w = *workers_[id];
+            std::lock_guard< std::mutex > guard(w.traceMutex);
+            if(!first) os << ",\n";
+            first = false;
+            os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+               << id << ",\"args\":{\"name\":\"worker " << id << "\"}}";
+            for(auto& e: w.trace) {
+                os << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\","
+                   << "\"pid\":1,\"tid\":" << id
+                   << ",\"ts\":" << Us(e.start - origin_)
+                   << ",\"dur\":" << Us(e.end - e.start) << '}';
+            }
+        }
+        os << "\n]}\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+private:
+    static std::uint64_t Ns(StatsClock::duration d) {
+        return std::uint64_t(std::chrono::duration_cast<
+                               std::chrono::nanoseconds >(d).count());
+    }
+    static double Us(StatsClock::duration d) {
+        return std::chrono::duration< double, std::micro >(d).count();
+    }
+    void Trace(WorkerCounters& w, const char* name,
+               StatsClock::time_point start, StatsClock::time_point end) {
+        std::lock_guard< std::mutex > guard(w.traceMutex);
+        if(w.trace.size() < maxEvents_.load(std::memory_order_relaxed))
+            w.trace.push_back(TraceEvent{name, start, end});
+    }
+private:
+    std::vector< std::unique_ptr< WorkerCounters > > workers_;
+    //guards workers_ and origin_ against Reset, the workers do not lock it
+    mutable std::mutex workersMutex_;
+    std::atomic< bool > tracing_{false};
+    std::atomic< std::size_t > maxEvents_{1 << 20};
+    StatsClock::time_point origin_;
+};
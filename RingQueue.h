@@ -0,0 +1,223 @@
+//author: Ugo Varetto
+//bounded lock-free multi-producer multi-consumer queue, drop-in replacement
+//for SyncQueue: same Push/Pop interface plus non-blocking TryPush/TryPop.
+//
+//Implementation: array of slots each with a sequence number
+//(D. Vyukov's bounded MPMC queue); producers and consumers claim a slot with
+//a CAS on their own index and then publish it by updating the slot sequence
+//number, no locks are taken and no memory is allocated after construction.
+//
+//A mutex/condition variable pair is only used to park threads on an empty
+//queue or, with the BLOCK policy, on a full queue; the lock-free fast path
+//never touches it unless there are parked threads.
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+//what Push does when the queue is full
+enum class Backpressure {
+    BLOCK, //spin for a while then park until a slot is released
+    SPIN,  //busy wait (yielding) until a slot is released
+    FAIL   //throw std::overflow_error
+};
+
+template < typename T >
+class RingQueue {
+    struct Slot {
+        std::atomic< std::size_t > seq;
+        T data;
+    };
+    enum : std::size_t { CACHE_LINE = 64 };
+    enum : int { SPIN_COUNT = 64 };
+public:
+    //capacity must be a power of two
+    RingQueue(std::size_t capacity = 4096,
+              Backpressure policy = Backpressure::BLOCK)
+        : capacity_(capacity), mask_(capacity - 1), policy_(policy),
+          slots_(new Slot[capacity]) {
+        if(capacity < 2 || (capacity & (capacity - 1)) != 0)
+            throw std::invalid_argument("Capacity must be a power of two");
+        for(std::size_t i = 0; i != capacity_; ++i)
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        enqueue_.store(0, std::memory_order_relaxed);
+        dequeue_.store(0, std::memory_order_relaxed);
+    }
+    RingQueue(const RingQueue&) = delete;
+    RingQueue& operator=(const RingQueue&) = delete;
+    //returns false if the queue is full
+    bool TryPush(const T& e) {
+        T c(e);
+        return TryPush(std::move(c));
+    }
+    //returns false if the queue is full, e is not moved from in that case
+    bool TryPush(T&& e) {
+        if(!Enqueue(e)) return false;
+        Wake(popWaiters_, notEmpty_);
+        return true;
+    }
+    //returns false if the queue is empty
+    bool TryPop(T& e) {
+        if(!Dequeue(e)) return false;
+        Wake(pushWaiters_, notFull_);
+        return true;
+    }
+    //behavior on full queue depends on the backpressure policy
+    void Push(const T& e) {
+        T c(e);
+        Push(std::move(c));
+    }
+    void Push(T&& e) {
+        for(int i = 0; i != SPIN_COUNT; ++i) {
+            if(TryPush(std::move(e))) return;
+            if(policy_ == Backpressure::FAIL)
+                throw std::overflow_error("Queue full");
+            std::this_thread::yield();
+        }
+        if(policy_ == Backpressure::SPIN) {
+            while(!TryPush(std::move(e))) std::this_thread::yield();
+            return;
+        }
+        Park(pushWaiters_, notFull_, [this, &e]{ return Enqueue(e); });
+        Wake(popWaiters_, notEmpty_);
+    }
+    //insert a range of elements waking up the parked consumers only once,
+    //when the queue is full the consumers are woken up before applying the
+    //backpressure policy; first is advanced past each inserted element: if
+    //Push throws [first, last) are the elements not inserted
+    template < typename It >
+    void Push(It& first, It last) {
+        for(; first != last; ++first) {
+            T e(*first);
+            if(Enqueue(e)) continue;
+            WakeAll(popWaiters_, notEmpty_);
+            Push(std::move(e));
+        }
+        WakeAll(popWaiters_, notEmpty_);
+    }
+    //blocks if queue empty: spin for a while then park
+    T Pop() {
+        T e;
+        for(int i = 0; i != SPIN_COUNT; ++i) {
+            if(TryPop(e)) return e;
+            std::this_thread::yield();
+        }
+        Park(popWaiters_, notEmpty_, [this, &e]{ return Dequeue(e); });
+        Wake(pushWaiters_, notFull_);
+        return e;
+    }
+    //approximate when called concurrently with Push/Pop
+    std::size_t Size() const {
+        const std::size_t e = enqueue_.load(std::memory_order_relaxed);
+        const std::size_t d = dequeue_.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+    bool Empty() const { return Size() == 0; }
+    std::size_t Capacity() const { return capacity_; }
+    friend class Executor; //to allow calls to Clear
+private:
+    void Clear() {
+        T e;
+        while(TryPop(e));
+    }
+    //claim the slot at the enqueue index, copy element and publish the
+    //slot by setting its sequence number to index + 1
+    bool Enqueue(T& e) {
+        std::size_t pos = enqueue_.load(std::memory_order_relaxed);
+        Slot* s = nullptr;
+        while(true) {
+            s = &slots_[pos & mask_];
+            const std::size_t seq = s->seq.load(std::memory_order_acquire);
+            const std::ptrdiff_t dif = std::ptrdiff_t(seq)
+                                       - std::ptrdiff_t(pos);
+            if(dif == 0) {
+                if(enqueue_.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed))
+                    break;
+            } else if(dif < 0) {
+                return false; //full
+            } else {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+        s->data = std::move(e);
+        s->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    //claim the slot at the dequeue index, move element out and release
+    //the slot for the next round by setting its sequence number to
+    //index + capacity
+    bool Dequeue(T& e) {
+        std::size_t pos = dequeue_.load(std::memory_order_relaxed);
+        Slot* s = nullptr;
+        while(true) {
+            s = &slots_[pos & mask_];
+            const std::size_t seq = s->seq.load(std::memory_order_acquire);
+            const std::ptrdiff_t dif = std::ptrdiff_t(seq)
+                                       - std::ptrdiff_t(pos + 1);
+            if(dif == 0) {
+                if(dequeue_.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed))
+                    break;
+            } else if(dif < 0) {
+                return false; //empty
+            } else {
+                pos = dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+        e = std::move(s->data);
+        s->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+    //park the current thread until 'f' returns true;
+    //a thread that changes the state of the queue executes a full fence and
+    //then checks the number of waiters, a parked thread increments the
+    //waiter count, executes a full fence and then re-checks the queue:
+    //one of the two is guaranteed to see the other's update and since the
+    //waiter holds the lock until it is inside 'wait' the notification
+    //cannot be lost
+    template < typename F >
+    void Park(std::atomic< int >& waiters, std::condition_variable& cond,
+              F&& f) {
+        std::unique_lock< std::mutex > lock(mutex_);
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(!f()) cond.wait(lock);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void Wake(std::atomic< int >& waiters, std::condition_variable& cond) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard< std::mutex > guard(mutex_);
+            cond.notify_one();
+        }
+    }
+    void WakeAll(std::atomic< int >& waiters, std::condition_variable& cond) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard< std::mutex > guard(mutex_);
+            cond.notify_all();
+        }
+    }
+private:
+    const std::size_t capacity_;
+    const std::size_t mask_;
+    const Backpressure policy_;
+    std::unique_ptr< Slot[] > slots_;
+    //producer and consumer indices on separate cache lines
+    char pad0_[CACHE_LINE];
+    std::atomic< std::size_t > enqueue_;
+    char pad1_[CACHE_LINE - sizeof(std::atomic< std::size_t >)];
+    std::atomic< std::size_t > dequeue_;
+    char pad2_[CACHE_LINE - sizeof(std::atomic< std::size_t >)];
+    std::atomic< int > popWaiters_{0};
+    std::atomic< int > pushWaiters_{0};
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+};
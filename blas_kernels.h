@@ -0,0 +1,1809 @@
+//Author: Ugo Varetto
+//header-only vector kernels: dot product, BLAS level 1 (axpy, scal, asum,
+//nrm2), row-major gemv, batched and tiled dot products of queries against a
+//matrix of candidates and top-k search for float and double; mixed precision
+//dot product of float, fp16 and bf16 vectors with float or double
+//accumulation.
+//
+//SIMD kernels are compiled through target attributes for SSE2, AVX2 + FMA
+//and AVX-512 and selected at run-time from the instruction set supported by
+//the CPU, possibly lowered through the DOT_ISA environment variable (scalar,
+//sse2, avx2, avx512); no -m flag is required.
+//
+//The parallel versions run on a persistent thread pool (reduce_pool_t): the
+//input is split into one contiguous chunk per thread (chunk_bounds) and the
+//partial results of reductions are combined in a fixed tree order, the result
+//is the same at each call for a fixed number of threads. The method, thread
+//count and block size of dot() can be tuned on the machine (autotune_dot)
+//and persisted to a file read by later runs (dot_config).
+//
+//See dot_product_c++11.cpp for the checks and benchmarks.
+#pragma once
+#if __cplusplus < 201103L
+#error "C++ 11 required"
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#define DOT_X86
+#include <immintrin.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h> //sysconf
+
+//------------------------------------------------------------------------------
+//instruction set selection
+enum class isa_t {SCALAR, SSE2, AVX2, AVX512};
+
+inline const char* isa_name(isa_t isa) {
+    switch(isa) {
+    case isa_t::SSE2: return "sse2";
+    case isa_t::AVX2: return "avx2";
+    case isa_t::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+//best instruction set supported by the CPU (and the OS); AVX2 implies FMA
+//and F16C, present on all the CPUs supporting AVX2
+inline isa_t detect_isa() {
+#ifdef DOT_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) return isa_t::AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+       && __builtin_cpu_supports("f16c"))
+        return isa_t::AVX2;
+    if(__builtin_cpu_supports("sse2")) return isa_t::SSE2;
+#endif
+    return isa_t::SCALAR;
+}
+
+//detected instruction set, possibly lowered through DOT_ISA
+inline isa_t active_isa() {
+    static const isa_t isa = []() {
+        const isa_t detected = detect_isa();
+        const char* env = std::getenv("DOT_ISA");
+        if(!env) return detected;
+        const isa_t all[] = {isa_t::SCALAR, isa_t::SSE2, isa_t::AVX2,
+                             isa_t::AVX512};
+        for(isa_t i: all) {
+            if(std::string(env) == isa_name(i))
+                return std::min(i, detected);
+        }
+        return detected;
+    }();
+    return isa;
+}
+
+
+//------------------------------------------------------------------------------
+//kernels: four independent accumulators hide the latency of the add/fma
+//instructions; the first elements are processed one at a time until x is
+//aligned, the last elements that do not fill a vector register are processed
+//with scalar code or, with AVX-512, with masked loads: no size or alignment
+//requirement
+template < typename T >
+using dot_kernel_t = T (*)(std::size_t, const T*, const T*);
+
+template < typename T >
+T dot_scalar(std::size_t n, const T* x, const T* y) {
+    T d0 = T(0), d1 = T(0), d2 = T(0), d3 = T(0);
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        d0 += x[i] * y[i];
+        d1 += x[i + 1] * y[i + 1];
+        d2 += x[i + 2] * y[i + 2];
+        d3 += x[i + 3] * y[i + 3];
+    }
+    for(; i != n; ++i) d0 += x[i] * y[i];
+    return (d0 + d1) + (d2 + d3);
+}
+
+//number of elements to process before x + i is aligned on a 'bytes' boundary
+template < typename T >
+std::size_t head_size(std::size_t n, const T* x, std::size_t bytes) {
+    const std::size_t misalign = std::uintptr_t(x) % bytes;
+    if(misalign == 0 || misalign % sizeof(T) != 0) return 0;
+    return std::min(n, (bytes - misalign) / sizeof(T));
+}
+
+//prefetch the BYTES bytes read by one loop iteration, PREFETCH bytes ahead
+//of x and y; LOCALITY is the __builtin_prefetch locality: 0 = non-temporal
+//(prefetchnta on x86), 3 = all cache levels; no-op if PREFETCH == 0
+template < int PREFETCH, int LOCALITY, int BYTES, typename T >
+inline void prefetch_ahead(const T* x, const T* y) {
+    if(PREFETCH == 0) return;
+    const char* px = reinterpret_cast< const char* >(x) + PREFETCH;
+    const char* py = reinterpret_cast< const char* >(y) + PREFETCH;
+    for(int b = 0; b < BYTES; b += 64) {
+        __builtin_prefetch(px + b, 0, LOCALITY);
+        __builtin_prefetch(py + b, 0, LOCALITY);
+    }
+}
+
+#ifdef DOT_X86
+__attribute__((target("sse2")))
+inline double hsum_sse2(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("sse2")))
+inline float hsum_sse2(__m128 v) {
+    const __m128 h = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(h, _mm_shuffle_ps(h, h, 1)));
+}
+
+template < int PREFETCH, int LOCALITY >
+__attribute__((target("sse2")))
+double dot_sse2(std::size_t n, const double* x, const double* y) {
+    const std::size_t h = head_size(n, x, 16);
+    double s = dot_scalar(h, x, y);
+    __m128d d0 = _mm_setzero_pd(), d1 = d0, d2 = d0, d3 = d0;
+    std::size_t i = h;
+    for(; i + 8 <= n; i += 8) {
+        prefetch_ahead< PREFETCH, LOCALITY, 64 >(x + i, y + i);
+        d0 = _mm_add_pd(d0, _mm_mul_pd(_mm_load_pd(x + i),
+                                       _mm_loadu_pd(y + i)));
+        d1 = _mm_add_pd(d1, _mm_mul_pd(_mm_load_pd(x + i + 2),
+                                       _mm_loadu_pd(y + i + 2)));
+        d2 = _mm_add_pd(d2, _mm_mul_pd(_mm_load_pd(x + i + 4),
+                                       _mm_loadu_pd(y + i + 4)));
+        d3 = _mm_add_pd(d3, _mm_mul_pd(_mm_load_pd(x + i + 6),
+                                       _mm_loadu_pd(y + i + 6)));
+    }
+    for(; i + 2 <= n; i += 2)
+        d0 = _mm_add_pd(d0, _mm_mul_pd(_mm_load_pd(x + i),
+                                       _mm_loadu_pd(y + i)));
+    s += dot_scalar(n - i, x + i, y + i);
+    return s + hsum_sse2(_mm_add_pd(_mm_add_pd(d0, d1), _mm_add_pd(d2, d3)));
+}
+
+template < int PREFETCH, int LOCALITY >
+__attribute__((target("sse2")))
+float dot_sse2(std::size_t n, const float* x, const float* y) {
+    const std::size_t h = head_size(n, x, 16);
+    float s = dot_scalar(h, x, y);
+    __m128 d0 = _mm_setzero_ps(), d1 = d0, d2 = d0, d3 = d0;
+    std::size_t i = h;
+    for(; i + 16 <= n; i += 16) {
+        prefetch_ahead< PREFETCH, LOCALITY, 64 >(x + i, y + i);
+        d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_load_ps(x + i),
+                                       _mm_loadu_ps(y + i)));
+        d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_load_ps(x + i + 4),
+                                       _mm_loadu_ps(y + i + 4)));
+        d2 = _mm_add_ps(d2, _mm_mul_ps(_mm_load_ps(x + i + 8),
+                                       _mm_loadu_ps(y + i + 8)));
+        d3 = _mm_add_ps(d3, _mm_mul_ps(_mm_load_ps(x + i + 12),
+                                       _mm_loadu_ps(y + i + 12)));
+    }
+    for(; i + 4 <= n; i += 4)
+        d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_load_ps(x + i),
+                                       _mm_loadu_ps(y + i)));
+    s += dot_scalar(n - i, x + i, y + i);
+    return s + hsum_sse2(_mm_add_ps(_mm_add_ps(d0, d1), _mm_add_ps(d2, d3)));
+}
+
+__attribute__((target("avx2,fma")))
+inline double hsum_avx2(__m256d v) {
+    const __m128d h = _mm_add_pd(_mm256_castpd256_pd128(v),
+                                 _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+__attribute__((target("avx2,fma")))
+inline float hsum_avx2(__m256 v) {
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    return _mm_cvtss_f32(_mm_add_ss(h, _mm_shuffle_ps(h, h, 1)));
+}
+
+template < int PREFETCH, int LOCALITY >
+__attribute__((target("avx2,fma")))
+double dot_avx2(std::size_t n, const double* x, const double* y) {
+    const std::size_t h = head_size(n, x, 32);
+    double s = dot_scalar(h, x, y);
+    __m256d d0 = _mm256_setzero_pd(), d1 = d0, d2 = d0, d3 = d0;
+    std::size_t i = h;
+    for(; i + 16 <= n; i += 16) {
+        prefetch_ahead< PREFETCH, LOCALITY, 128 >(x + i, y + i);
+        d0 = _mm256_fmadd_pd(_mm256_load_pd(x + i),
+                             _mm256_loadu_pd(y + i), d0);
+        d1 = _mm256_fmadd_pd(_mm256_load_pd(x + i + 4),
+                             _mm256_loadu_pd(y + i + 4), d1);
+        d2 = _mm256_fmadd_pd(_mm256_load_pd(x + i + 8),
+                             _mm256_loadu_pd(y + i + 8), d2);
+        d3 = _mm256_fmadd_pd(_mm256_load_pd(x + i + 12),
+                             _mm256_loadu_pd(y + i + 12), d3);
+    }
+    for(; i + 4 <= n; i += 4)
+        d0 = _mm256_fmadd_pd(_mm256_load_pd(x + i),
+                             _mm256_loadu_pd(y + i), d0);
+    s += dot_scalar(n - i, x + i, y + i);
+    return s + hsum_avx2(_mm256_add_pd(_mm256_add_pd(d0, d1),
+                                       _mm256_add_pd(d2, d3)));
+}
+
+template < int PREFETCH, int LOCALITY >
+__attribute__((target("avx2,fma")))
+float dot_avx2(std::size_t n, const float* x, const float* y) {
+    const std::size_t h = head_size(n, x, 32);
+    float s = dot_scalar(h, x, y);
+    __m256 d0 = _mm256_setzero_ps(), d1 = d0, d2 = d0, d3 = d0;
+    std::size_t i = h;
+    for(; i + 32 <= n; i += 32) {
+        prefetch_ahead< PREFETCH, LOCALITY, 128 >(x + i, y + i);
+        d0 = _mm256_fmadd_ps(_mm256_load_ps(x + i),
+                             _mm256_loadu_ps(y + i), d0);
+        d1 = _mm256_fmadd_ps(_mm256_load_ps(x + i + 8),
+                             _mm256_loadu_ps(y + i + 8), d1);
+        d2 = _mm256_fmadd_ps(_mm256_load_ps(x + i + 16),
+                             _mm256_loadu_ps(y + i + 16), d2);
+        d3 = _mm256_fmadd_ps(_mm256_load_ps(x + i + 24),
+                             _mm256_loadu_ps(y + i + 24), d3);
+    }
+    for(; i + 8 <= n; i += 8)
+        d0 = _mm256_fmadd_ps(_mm256_load_ps(x + i),
+                             _mm256_loadu_ps(y + i), d0);
+    s += dot_scalar(n - i, x + i, y + i);
+    return s + hsum_avx2(_mm256_add_ps(_mm256_add_ps(d0, d1),
+                                       _mm256_add_ps(d2, d3)));
+}
+
+//horizontal sums through memory: _mm512_reduce_add_* triggers
+//-Wuninitialized warnings in some versions of the gcc headers
+__attribute__((target("avx512f")))
+inline double hsum_avx512(__m512d v) {
+    double t[8];
+    _mm512_storeu_pd(t, v);
+    return ((t[0] + t[1]) + (t[2] + t[3])) + ((t[4] + t[5]) + (t[6] + t[7]));
+}
+
+__attribute__((target("avx512f")))
+inline float hsum_avx512(__m512 v) {
+    float t[16];
+    _mm512_storeu_ps(t, v);
+    float s = 0;
+    for(int i = 0; i != 16; ++i) s += t[i];
+    return s;
+}
+
+template < int PREFETCH, int LOCALITY >
+__attribute__((target("avx512f")))
+double dot_avx512(std::size_t n, const double* x, const double* y) {
+    const std::size_t h = head_size(n, x, 64);
+    double s = dot_scalar(h, x, y);
+    __m512d d0 = _mm512_setzero_pd(), d1 = d0, d2 = d0, d3 = d0;
+    std::size_t i = h;
+    for(; i + 32 <= n; i += 32) {
+        prefetch_ahead< PREFETCH, LOCALITY, 256 >(x + i, y + i);
+        d0 = _mm512_fmadd_pd(_mm512_load_pd(x + i),
+                             _mm512_loadu_pd(y + i), d0);
+        d1 = _mm512_fmadd_pd(_mm512_load_pd(x + i + 8),
+                             _mm512_loadu_pd(y + i + 8), d1);
+        d2 = _mm512_fmadd_pd(_mm512_load_pd(x + i + 16),
+                             _mm512_loadu_pd(y + i + 16), d2);
+        d3 = _mm512_fmadd_pd(_mm512_load_pd(x + i + 24),
+                             _mm512_loadu_pd(y + i + 24), d3);
+    }
+    for(; i + 8 <= n; i += 8)
+        d0 = _mm512_fmadd_pd(_mm512_load_pd(x + i),
+                             _mm512_loadu_pd(y + i), d0);
+    if(i != n) {
+        const __mmask8 m = __mmask8((1u << (n - i)) - 1);
+        d1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, x + i),
+                             _mm512_maskz_loadu_pd(m, y + i), d1);
+    }
+    return s + hsum_avx512(_mm512_add_pd(_mm512_add_pd(d0, d1),
+                                         _mm512_add_pd(d2, d3)));
+}
+
+template < int PREFETCH, int LOCALITY >
+__attribute__((target("avx512f")))
+float dot_avx512(std::size_t n, const float* x, const float* y) {
+    const std::size_t h = head_size(n, x, 64);
+    float s = dot_scalar(h, x, y);
+    __m512 d0 = _mm512_setzero_ps(), d1 = d0, d2 = d0, d3 = d0;
+    std::size_t i = h;
+    for(; i + 64 <= n; i += 64) {
+        prefetch_ahead< PREFETCH, LOCALITY, 256 >(x + i, y + i);
+        d0 = _mm512_fmadd_ps(_mm512_load_ps(x + i),
+                             _mm512_loadu_ps(y + i), d0);
+        d1 = _mm512_fmadd_ps(_mm512_load_ps(x + i + 16),
+                             _mm512_loadu_ps(y + i + 16), d1);
+        d2 = _mm512_fmadd_ps(_mm512_load_ps(x + i + 32),
+                             _mm512_loadu_ps(y + i + 32), d2);
+        d3 = _mm512_fmadd_ps(_mm512_load_ps(x + i + 48),
+                             _mm512_loadu_ps(y + i + 48), d3);
+    }
+    for(; i + 16 <= n; i += 16)
+        d0 = _mm512_fmadd_ps(_mm512_load_ps(x + i),
+                             _mm512_loadu_ps(y + i), d0);
+    if(i != n) {
+        const __mmask16 m = __mmask16((1u << (n - i)) - 1);
+        d1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i),
+                             _mm512_maskz_loadu_ps(m, y + i), d1);
+    }
+    return s + hsum_avx512(_mm512_add_ps(_mm512_add_ps(d0, d1),
+                                         _mm512_add_ps(d2, d3)));
+}
+#endif
+
+//prefetch distance of the streaming kernels
+const int PREFETCH_BYTES = 1024;
+
+//kernel for instruction set isa, with software prefetch if PREFETCH > 0
+template < typename T, int PREFETCH = 0, int LOCALITY = 3 >
+dot_kernel_t< T > select_dot_kernel(isa_t isa) {
+    switch(isa) {
+#ifdef DOT_X86
+    case isa_t::SSE2: return dot_sse2< PREFETCH, LOCALITY >;
+    case isa_t::AVX2: return dot_avx2< PREFETCH, LOCALITY >;
+    case isa_t::AVX512: return dot_avx512< PREFETCH, LOCALITY >;
+#endif
+    default: return dot_scalar< T >;
+    }
+}
+
+//kernel for the active instruction set
+template < typename T >
+dot_kernel_t< T > dot_kernel() {
+    static const dot_kernel_t< T > k = select_dot_kernel< T >(active_isa());
+    return k;
+}
+
+//streaming kernels for the active instruction set: same as dot_kernel with
+//the addition of software prefetches PREFETCH_BYTES ahead, non-temporal
+//prefetches (prefetchnta) keep the streamed data out of the outer cache
+//levels, which only pays off on some architectures: use the benchmark
+template < typename T >
+dot_kernel_t< T > dot_stream_kernel(bool nontemporal) {
+    static const dot_kernel_t< T > t0 =
+        select_dot_kernel< T, PREFETCH_BYTES, 3 >(active_isa());
+    static const dot_kernel_t< T > nta =
+        select_dot_kernel< T, PREFETCH_BYTES, 0 >(active_isa());
+    return nontemporal ? nta : t0;
+}
+
+//------------------------------------------------------------------------------
+template < typename T >
+std::function< T () >
+make_dotblock(int N, const T* x, const T* y, int block) {
+    //in case the size is not evenly divisible by the block size
+    //we need to allocate additional bytes in the buffers in order
+    //to copy block + N % block elements
+    //
+    //Problem: if you declare the std::vector outside the lambda function
+    //and pass it by value to each closure through [=], declaring
+    //the lambda 'mutable', it is slower than declaring it inside the
+    //body of the lambda; if you try to pass it by refreence
+    //through [&] you get a segfault
+    //Solution: declare empty vectors and issue a resize inside the lambda
+    //function: this does not make any difference in case the lamda is called
+    //only once as in this case, but when calling it multiple times with the
+    //same data size it does speed up operations because no reallocation is
+    //performed
+    //
+    //each block is processed by the SIMD kernel selected at run-time, this
+    //replaces the former make_dotblock_avx and its size restrictions
+    std::vector< T > b1(0);
+    std::vector< T > b2(0);
+    const dot_kernel_t< T > kernel = dot_kernel< T >();
+    return [=]() mutable {
+        b1.resize(std::min(2 * block, N));
+        b2.resize(std::min(2 * block, N));
+        T d = T(0);
+        for(int b = 0; b < N; b += block) {
+             const int bsize = N - b < 2 * block ? N - b : block;
+             std::copy(x + b, x + b + bsize, b1.begin());
+             std::copy(y + b, y + b + bsize, b2.begin());
+             d += kernel(bsize, b1.data(), b2.data());
+             if(bsize != block) break;
+         }
+         return d;
+      };
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//size of the level 1 (data), 2 or 3 cache
+inline std::size_t cache_size(int level) {
+    long s = 0;
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+    switch(level) {
+    case 1: s = sysconf(_SC_LEVEL1_DCACHE_SIZE); break;
+    case 2: s = sysconf(_SC_LEVEL2_CACHE_SIZE); break;
+    default: s = sysconf(_SC_LEVEL3_CACHE_SIZE); break;
+    }
+#endif
+    if(s > 0) return std::size_t(s);
+    return level == 1 ? std::size_t(32) << 10
+                      : level == 2 ? std::size_t(256) << 10
+                                   : std::size_t(8) << 20;
+}
+
+//last level cache size
+inline std::size_t llc_size() { return cache_size(3); }
+
+//------------------------------------------------------------------------------
+//persistent thread pool for parallel reductions: nt - 1 worker threads plus
+//the calling thread; run(f) executes f(i) once for each thread index i in
+//[0, nt), index 0 on the calling thread. Workers waiting for a job spin for
+//a while before blocking on a condition variable, so that back to back
+//calls only pay the wake-up cost
+class reduce_pool_t {
+public:
+    explicit reduce_pool_t(int nt) : nt_(nt), errors_(nt) {
+        if(nt < 1) throw std::range_error("Number of threads < 1");
+        for(int i = 1; i < nt; ++i)
+            threads_.push_back(std::thread([this, i]{ worker(i); }));
+    }
+    reduce_pool_t(const reduce_pool_t&) = delete;
+    reduce_pool_t& operator=(const reduce_pool_t&) = delete;
+    int size() const { return nt_; }
+    //blocking; the first exception thrown by f is re-thrown
+    void run(const std::function< void (int) >& f) {
+        std::lock_guard< std::mutex > guard(run_mutex_);
+        job_ = &f;
+        pending_.store(nt_ - 1);
+        {
+            std::lock_guard< std::mutex > lock(mutex_);
+            generation_.fetch_add(1, std::memory_order_release);
+        }
+        cond_.notify_all();
+        execute(0);
+        while(pending_.load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+        for(auto& e: errors_) {
+            if(e) {
+                std::exception_ptr r = e;
+                std::fill(errors_.begin(), errors_.end(), nullptr);
+                std::rethrow_exception(r);
+            }
+        }
+    }
+    ~reduce_pool_t() {
+        {
+            std::lock_guard< std::mutex > lock(mutex_);
+            stop_ = true;
+            generation_.fetch_add(1, std::memory_order_release);
+        }
+        cond_.notify_all();
+        for(auto& t: threads_) t.join();
+    }
+private:
+    void execute(int i) {
+        try {
+            (*job_)(i);
+        } catch(...) {
+            errors_[i] = std::current_exception();
+        }
+    }
+    void worker(int i) {
+        std::uint64_t seen = 0;
+        while(true) {
+            std::uint64_t g = generation_.load(std::memory_order_acquire);
+            for(int s = 0; g == seen && s != SPIN_COUNT; ++s) {
+                std::this_thread::yield();
+                g = generation_.load(std::memory_order_acquire);
+            }
+            if(g == seen) {
+                std::unique_lock< std::mutex > lock(mutex_);
+                cond_.wait(lock, [this, seen]{
+                    return generation_.load() != seen; });
+                g = generation_.load();
+            }
+            seen = g;
+            if(stop_) break;
+            execute(i);
+            pending_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+private:
+    enum {SPIN_COUNT = 2000};
+    const int nt_;
+    std::vector< std::thread > threads_;
+    std::vector< std::exception_ptr > errors_; //one slot per thread index
+    const std::function< void (int) >* job_ = nullptr;
+    std::atomic< std::uint64_t > generation_{0}; //incremented for each job
+    std::atomic< int > pending_{0}; //workers still running the current job
+    bool stop_ = false; //guarded by mutex_
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::mutex run_mutex_; //serializes concurrent run() calls
+};
+
+//shared pool with nt threads, re-created when a different number of
+//threads is requested
+inline std::shared_ptr< reduce_pool_t > reduce_pool(int nt) {
+    static std::mutex mutex;
+    static std::shared_ptr< reduce_pool_t > pool;
+    std::lock_guard< std::mutex > guard(mutex);
+    if(!pool || pool->size() != nt) {
+        pool.reset();
+        pool = std::make_shared< reduce_pool_t >(nt);
+    }
+    return pool;
+}
+
+//padded to avoid false sharing between the partial results of different
+//threads
+template < typename T >
+struct padded_t {
+    T value;
+    char pad[64];
+};
+
+//[0, n) is split into nt contiguous chunks, chunk i is
+//[i * (n / nt), (i + 1) * (n / nt)) and the last one includes the remainder
+inline void chunk_bounds(int i, int nt, std::size_t n,
+                         std::size_t& b, std::size_t& e) {
+    const std::size_t csize = n / nt;
+    b = i * csize;
+    e = i == nt - 1 ? n : b + csize;
+}
+
+//chunk(begin_i, end_i) is called by thread i for each non-empty chunk
+template < typename ChunkF >
+void parallel_for_chunks(reduce_pool_t& pool, std::size_t n, ChunkF chunk) {
+    const int nt = pool.size();
+    if(n == 0) return;
+    pool.run([&](int i) {
+        std::size_t b, e;
+        chunk_bounds(i, nt, n, b, e);
+        if(b != e) chunk(b, e);
+    });
+}
+
+//partial_i = chunk(begin_i, end_i) is computed by thread i and the partials
+//are combined pairwise in a fixed tree order: the result is deterministic
+//for a fixed number of threads
+template < typename T, typename ChunkF, typename CombineF >
+T parallel_reduce_chunks(reduce_pool_t& pool, std::size_t n, T init,
+                         ChunkF chunk, CombineF combine) {
+    const int nt = pool.size();
+    if(n == 0) return init;
+    std::vector< padded_t< T > > partials(nt);
+    pool.run([&](int i) {
+        std::size_t b, e;
+        chunk_bounds(i, nt, n, b, e);
+        partials[i].value = b == e ? init : chunk(b, e);
+    });
+    //chunks are empty only when n < nt, in which case only the last is not
+    int first = n < std::size_t(nt) ? nt - 1 : 0;
+    for(int stride = 1; first + stride < nt; stride *= 2) {
+        for(int i = first; i + stride < nt; i += 2 * stride)
+            partials[i].value = combine(partials[i].value,
+                                        partials[i + stride].value);
+    }
+    return combine(init, partials[first].value);
+}
+
+//same as std::accumulate(first, last, init, op) with op associative,
+//requires random access iterators
+template < typename It, typename T, typename OpT >
+T parallel_reduce(It first, It last, T init, OpT op,
+                  int nt = std::thread::hardware_concurrency()) {
+    std::shared_ptr< reduce_pool_t > pool = reduce_pool(std::max(nt, 1));
+    return parallel_reduce_chunks(*pool, std::size_t(last - first), init,
+        [first, op](std::size_t b, std::size_t e) {
+            return std::accumulate(first + b + 1, first + e, *(first + b), op);
+        }, op);
+}
+
+//------------------------------------------------------------------------------
+enum class dot_method_t {
+    STL,   //std::inner_product
+    BLOCK, //copy blocks into thread-local buffers, then SIMD kernel
+    SIMD,     //SIMD kernel on input data
+    STREAM,   //SIMD kernel on input data with software prefetch
+    STREAM_NT //SIMD kernel on input data with non-temporal prefetch
+};
+
+inline const char* method_name(dot_method_t m) {
+    switch(m) {
+    case dot_method_t::BLOCK: return "block";
+    case dot_method_t::SIMD: return "simd";
+    case dot_method_t::STREAM: return "stream";
+    case dot_method_t::STREAM_NT: return "stream_nt";
+    default: return "stl";
+    }
+}
+
+//single-threaded dot product of size elements
+template < typename T >
+T dot_range(dot_method_t method, int size, const T* x, const T* y,
+            int blocksize) {
+    switch(method) {
+    case dot_method_t::BLOCK:
+        return make_dotblock(size, x, y, blocksize)();
+    case dot_method_t::SIMD:
+        return dot_kernel< T >()(size, x, y);
+    case dot_method_t::STREAM:
+        return dot_stream_kernel< T >(false)(size, x, y);
+    case dot_method_t::STREAM_NT:
+        return dot_stream_kernel< T >(true)(size, x, y);
+    default:
+        return std::inner_product(x, x + size, y, T(0));
+    }
+}
+
+//run on the persistent pool: one chunk per thread, deterministic combine
+template < typename T >
+T dot(int N, const T* X, const T* Y, int nt, int blocksize = 16384,
+      dot_method_t method = dot_method_t::SIMD) {
+    std::shared_ptr< reduce_pool_t > pool = reduce_pool(nt);
+    return parallel_reduce_chunks(*pool, std::size_t(N), T(0),
+        [=](std::size_t b, std::size_t e) {
+            return dot_range(method, int(e - b), X + b, Y + b, blocksize);
+        }, std::plus< T >());
+}
+
+inline bool parse_method(const std::string& name, dot_method_t& method) {
+    const dot_method_t methods[] = {dot_method_t::STL, dot_method_t::BLOCK,
+                                    dot_method_t::SIMD, dot_method_t::STREAM,
+                                    dot_method_t::STREAM_NT};
+    for(dot_method_t m: methods) {
+        if(name == method_name(m)) {
+            method = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+//auto-tuning of dot(): method, number of threads and block size measured on
+//this machine. The sweep covers thread counts from 1 to twice the number of
+//cores (hyper-threads, oversubscription) and, for the block method, block
+//sizes from L1 to the share of the last level cache of each thread. The best
+//configuration is stored in a text file, one line per (instruction set,
+//element size, number of cores), and loaded by later runs
+struct dot_config_t {
+    dot_method_t method = dot_method_t::SIMD;
+    int nt = 1;
+    int blocksize = 16384;
+    double gbs = 0; //measured bandwidth, GB/s
+};
+
+//file: DOT_CONFIG environment variable, default $HOME/.dot_config
+inline std::string dot_config_path() {
+    if(const char* p = std::getenv("DOT_CONFIG")) return p;
+    if(const char* h = std::getenv("HOME")) return std::string(h) +
+                                                   "/.dot_config";
+    return ".dot_config";
+}
+
+//configurations are valid only for the same kernel, element type and core
+//count
+template < typename T >
+std::string dot_config_key() {
+    return std::string(isa_name(active_isa())) + ' '
+           + std::to_string(sizeof(T)) + ' '
+           + std::to_string(std::thread::hardware_concurrency());
+}
+
+//first three fields of a configuration line, empty for comments
+inline std::string dot_config_line_key(const std::string& line) {
+    std::istringstream is(line);
+    std::string isa, elem, cores;
+    if(!(is >> isa >> elem >> cores) || isa[0] == '#') return std::string();
+    return isa + ' ' + elem + ' ' + cores;
+}
+
+//line format: isa element_size cores method threads blocksize GB/s;
+//returns false if the file or a matching entry does not exist
+template < typename T >
+bool load_dot_config(dot_config_t& config,
+                     const std::string& path = dot_config_path()) {
+    std::ifstream is(path);
+    const std::string key = dot_config_key< T >();
+    std::string line;
+    while(std::getline(is, line)) {
+        if(dot_config_line_key(line) != key) continue;
+        std::istringstream ls(line);
+        std::string skip, method;
+        dot_config_t c;
+        if(!(ls >> skip >> skip >> skip >> method >> c.nt >> c.blocksize
+                >> c.gbs)
+           || !parse_method(method, c.method) || c.nt < 1
+           || c.blocksize < 1) continue;
+        config = c;
+        return true;
+    }
+    return false;
+}
+
+//replaces the entry with the same key, the file is written to a temporary
+//file then renamed so that concurrent readers never see a partial file
+template < typename T >
+void save_dot_config(const dot_config_t& config,
+                     const std::string& path = dot_config_path()) {
+    const std::string key = dot_config_key< T >();
+    std::vector< std::string > lines;
+    {
+        std::ifstream is(path);
+        std::string line;
+        while(std::getline(is, line))
+            if(dot_config_line_key(line) != key) lines.push_back(line);
+    }
+    if(lines.empty())
+        lines.push_back("#isa element_size cores method threads blocksize "
+                        "GB/s, written by the dot() auto-tuner");
+    std::ostringstream entry;
+    entry << key << ' ' << method_name(config.method) << ' ' << config.nt
+          << ' ' << config.blocksize << ' ' << config.gbs;
+    lines.push_back(entry.str());
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp);
+        for(auto& l: lines) os << l << '\n';
+        if(!os.flush()) throw std::runtime_error("Cannot write " + tmp);
+    }
+    if(std::rename(tmp.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("Cannot write " + path);
+}
+
+//measures all the configurations on two vectors of n elements (default:
+//twice the last level cache each, memory bound) for at least seconds each;
+//report, if set, is called after each measurement. Among the configurations
+//within 3% of the fastest one the one with fewest threads is returned
+template < typename T >
+dot_config_t autotune_dot(std::size_t n = 0, double seconds = 0.05,
+                          std::function< void (const dot_config_t&) >
+                          report = nullptr) {
+    if(n == 0) n = 2 * llc_size() / sizeof(T);
+    n = std::min(n, std::size_t(std::numeric_limits< int >::max()));
+    const std::vector< T > x(n, T(1)), y(n, T(1));
+    const int cores = std::max(int(std::thread::hardware_concurrency()), 1);
+    std::vector< int > threads{cores, 2 * cores};
+    for(int t = 1; t < 2 * cores; t *= 2) threads.push_back(t);
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()),
+                  threads.end());
+    std::vector< dot_config_t > configs;
+    for(int t: threads) {
+        const dot_method_t methods[] = {dot_method_t::SIMD,
+                                        dot_method_t::STREAM,
+                                        dot_method_t::STREAM_NT};
+        dot_config_t c;
+        c.nt = t;
+        for(dot_method_t m: methods) {
+            c.method = m;
+            configs.push_back(c);
+        }
+        //two buffers of blocksize elements per thread
+        const std::size_t bytes[] = {cache_size(1), cache_size(2) / 2,
+                                     cache_size(2), llc_size() / t};
+        std::vector< int > blocks;
+        for(std::size_t b: bytes)
+            blocks.push_back(int(std::max(b / (2 * sizeof(T)),
+                                          std::size_t(64))));
+        std::sort(blocks.begin(), blocks.end());
+        blocks.erase(std::unique(blocks.begin(), blocks.end()),
+                     blocks.end());
+        c.method = dot_method_t::BLOCK;
+        for(int b: blocks) {
+            c.blocksize = b;
+            configs.push_back(c);
+        }
+    }
+    typedef std::chrono::steady_clock clock_type;
+    volatile T sink = T(0);
+    for(auto& c: configs) {
+        sink = dot(int(n), x.data(), y.data(), c.nt, c.blocksize, c.method);
+        double best = std::numeric_limits< double >::max();
+        const auto start = clock_type::now();
+        do {
+            const auto s = clock_type::now();
+            sink = dot(int(n), x.data(), y.data(), c.nt, c.blocksize,
+                       c.method);
+            best = std::min(best, std::chrono::duration< double >(
+                                    clock_type::now() - s).count());
+        } while(std::chrono::duration< double >(
+                    clock_type::now() - start).count() < seconds);
+        c.gbs = 2 * n * sizeof(T) / best / 1E9;
+        if(report) report(c);
+    }
+    (void)sink;
+    double fastest = 0;
+    for(auto& c: configs) fastest = std::max(fastest, c.gbs);
+    for(auto& c: configs)
+        if(c.gbs >= 0.97 * fastest) return c;
+    return dot_config_t();
+}
+
+//configuration from the file, tuned and saved if missing; returned even if
+//the file cannot be written
+template < typename T >
+dot_config_t dot_config(const std::string& path = dot_config_path()) {
+    dot_config_t c;
+    if(load_dot_config< T >(c, path)) return c;
+    c = autotune_dot< T >();
+    try {
+        save_dot_config< T >(c, path);
+    } catch(const std::exception&) {}
+    return c;
+}
+
+template < typename T >
+T dot(int N, const T* X, const T* Y, const dot_config_t& config) {
+    return dot(N, X, Y, config.nt, config.blocksize, config.method);
+}
+
+//------------------------------------------------------------------------------
+//summation modes, from fastest to most accurate; with u = unit roundoff and
+//cond = sum |x_i y_i| / |x.y| the relative error is bounded by about:
+// - naive: n u cond; SIMD kernel, the accumulators only shorten the chains
+// - pairwise: log2(n) u cond; halves are summed recursively down to blocks of
+//   PAIRWISE_BLOCK elements computed with the SIMD kernel
+// - kahan: u + n u^2 cond; the products are rounded, their sum is compensated
+//   with TwoSum, i.e. Neumaier's improved Kahan summation
+// - dot2: u + n u^2 cond; products and sums are both error-free
+//   transformations (Ogita, Rump, Oishi - Accurate sum and dot product, 2005),
+//   same accuracy as the naive sum computed in twice the working precision
+//the compensated modes keep one (sum, error) pair per SIMD lane, the lanes and
+//the thread partials are merged with TwoSum
+enum class sum_mode_t {NAIVE, PAIRWISE, KAHAN, DOT2};
+
+inline const char* sum_mode_name(sum_mode_t m) {
+    switch(m) {
+    case sum_mode_t::PAIRWISE: return "pairwise";
+    case sum_mode_t::KAHAN: return "kahan";
+    case sum_mode_t::DOT2: return "dot2";
+    default: return "naive";
+    }
+}
+
+//unevaluated sum s + c, c accumulates the rounding errors of s
+template < typename T >
+struct sum_t {
+    T s;
+    T c;
+    T value() const { return s + c; }
+};
+
+template < typename T >
+using sum_kernel_t = sum_t< T > (*)(std::size_t, const T*, const T*);
+
+//the error-free transformations below rely on each operation being rounded
+//separately: contraction of a * b + c into an fma must be disabled
+#define NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#define EFT_INLINE __attribute__((always_inline, optimize("fp-contract=off")))
+
+//s + e == a + b exactly (Knuth)
+template < typename T >
+EFT_INLINE inline void two_sum(T a, T b, T& s, T& e) {
+    s = a + b;
+    const T z = s - a;
+    e = (a - (s - z)) + (b - z);
+}
+
+//p + e == a * b exactly; without hardware fma the operands are split in
+//half-width parts (Veltkamp, Dekker)
+template < bool FMA, typename T >
+EFT_INLINE inline void two_product(T a, T b, T& p, T& e) {
+    p = a * b;
+    if(FMA) {
+        e = std::fma(a, b, -p);
+    } else {
+        const T f = T((1 << ((std::numeric_limits< T >::digits + 1) / 2)) + 1);
+        const T ca = f * a, cb = f * b;
+        const T ah = ca - (ca - a), al = a - ah;
+        const T bh = cb - (cb - b), bl = b - bh;
+        e = ((ah * bh - p) + ah * bl + al * bh) + al * bl;
+    }
+}
+
+//add x * y to the (s, c) pair of one lane
+template < sum_mode_t MODE, bool FMA, typename T >
+EFT_INLINE inline void compensated_step(T& s, T& c, T x, T y) {
+    T p, ep = T(0), t, e;
+    if(MODE == sum_mode_t::DOT2) two_product< FMA >(x, y, p, ep);
+    else p = x * y;
+    two_sum(s, p, t, e);
+    s = t;
+    c += e + ep;
+}
+
+//L independent lanes, written as plain loops over the lanes so that the
+//compiler maps them to vector registers of the enclosing target
+template < sum_mode_t MODE, bool FMA, int L, typename T >
+EFT_INLINE inline sum_t< T > compensated_lanes(std::size_t n, const T* x,
+                                               const T* y) {
+    T s[L], c[L];
+    for(int l = 0; l != L; ++l) s[l] = c[l] = T(0);
+    std::size_t i = 0;
+    for(; i + L <= n; i += L) {
+        for(int l = 0; l != L; ++l)
+            compensated_step< MODE, FMA >(s[l], c[l], x[i + l], y[i + l]);
+    }
+    for(; i != n; ++i)
+        compensated_step< MODE, FMA >(s[0], c[0], x[i], y[i]);
+    sum_t< T > r = {T(0), T(0)};
+    for(int l = 0; l != L; ++l) {
+        T t, e;
+        two_sum(r.s, s[l], t, e);
+        r.s = t;
+        r.c += e + c[l];
+    }
+    return r;
+}
+
+//two vector registers worth of lanes per instruction set
+template < sum_mode_t MODE, typename T >
+NO_FP_CONTRACT
+sum_t< T > compensated_scalar(std::size_t n, const T* x, const T* y) {
+    return compensated_lanes< MODE, false, 4 >(n, x, y);
+}
+
+#ifdef DOT_X86
+template < sum_mode_t MODE, typename T >
+__attribute__((target("sse2"))) NO_FP_CONTRACT
+sum_t< T > compensated_sse2(std::size_t n, const T* x, const T* y) {
+    return compensated_lanes< MODE, false, 32 / sizeof(T) >(n, x, y);
+}
+
+template < sum_mode_t MODE, typename T >
+__attribute__((target("avx2,fma"))) NO_FP_CONTRACT
+sum_t< T > compensated_avx2(std::size_t n, const T* x, const T* y) {
+    return compensated_lanes< MODE, true, 64 / sizeof(T) >(n, x, y);
+}
+
+template < sum_mode_t MODE, typename T >
+__attribute__((target("avx512f"))) NO_FP_CONTRACT
+sum_t< T > compensated_avx512(std::size_t n, const T* x, const T* y) {
+    return compensated_lanes< MODE, true, 128 / sizeof(T) >(n, x, y);
+}
+#endif
+
+template < typename T >
+sum_t< T > naive_sum(std::size_t n, const T* x, const T* y) {
+    const sum_t< T > r = {dot_kernel< T >()(n, x, y), T(0)};
+    return r;
+}
+
+const std::size_t PAIRWISE_BLOCK = 256;
+
+//halves are split at a multiple of PAIRWISE_BLOCK to keep the SIMD kernel
+//on full blocks
+template < typename T >
+T dot_pairwise(std::size_t n, const T* x, const T* y) {
+    if(n <= PAIRWISE_BLOCK) return dot_kernel< T >()(n, x, y);
+    const std::size_t h =
+        (n / 2 + PAIRWISE_BLOCK - 1) / PAIRWISE_BLOCK * PAIRWISE_BLOCK;
+    return dot_pairwise(h, x, y) + dot_pairwise(n - h, x + h, y + h);
+}
+
+template < typename T >
+sum_t< T > pairwise_sum(std::size_t n, const T* x, const T* y) {
+    const sum_t< T > r = {dot_pairwise(n, x, y), T(0)};
+    return r;
+}
+
+template < typename T, sum_mode_t MODE >
+sum_kernel_t< T > select_compensated_kernel(isa_t isa) {
+    switch(isa) {
+#ifdef DOT_X86
+    case isa_t::SSE2: return compensated_sse2< MODE, T >;
+    case isa_t::AVX2: return compensated_avx2< MODE, T >;
+    case isa_t::AVX512: return compensated_avx512< MODE, T >;
+#endif
+    default: return compensated_scalar< MODE, T >;
+    }
+}
+
+template < typename T >
+sum_kernel_t< T > select_sum_kernel(isa_t isa, sum_mode_t mode) {
+    switch(mode) {
+    case sum_mode_t::PAIRWISE: return pairwise_sum< T >;
+    case sum_mode_t::KAHAN:
+        return select_compensated_kernel< T, sum_mode_t::KAHAN >(isa);
+    case sum_mode_t::DOT2:
+        return select_compensated_kernel< T, sum_mode_t::DOT2 >(isa);
+    default: return naive_sum< T >;
+    }
+}
+
+template < typename T >
+NO_FP_CONTRACT sum_t< T > merge_sums(const sum_t< T >& a, const sum_t< T >& b) {
+    sum_t< T > r;
+    T e;
+    two_sum(a.s, b.s, r.s, e);
+    r.c = (a.c + b.c) + e;
+    return r;
+}
+
+//dot product with the requested summation mode, on the persistent pool
+template < typename T >
+T dot(int N, const T* X, const T* Y, int nt, sum_mode_t mode) {
+    const sum_kernel_t< T > kernel = select_sum_kernel< T >(active_isa(), mode);
+    const sum_t< T > zero = {T(0), T(0)};
+    std::shared_ptr< reduce_pool_t > pool = reduce_pool(nt);
+    return parallel_reduce_chunks(*pool, std::size_t(N), zero,
+        [=](std::size_t b, std::size_t e) {
+            return kernel(e - b, X + b, Y + b);
+        }, merge_sums< T >).value();
+}
+
+//relative error bound of the naive sum of n products of positive numbers:
+//gamma_n = n u / (1 - n u), u = unit roundoff
+template < typename T >
+double dot_error_bound(std::size_t n) {
+    const double nu = double(n) * std::numeric_limits< T >::epsilon() / 2;
+    return nu < 1 ? nu / (1 - nu) : 1;
+}
+
+//------------------------------------------------------------------------------
+//BLAS level 1 and 2 kernels, unit stride. The loops are written once, as
+//always_inline static run() functions of a kernel type K, and isa_kernel_t
+//instantiates them with the target attributes of each instruction set;
+//reductions keep LANES independent accumulators so that they vectorize
+//without reassociating the sums
+#define KERNEL_INLINE __attribute__((always_inline))
+
+template < typename K, typename F = decltype(&K::run) >
+struct isa_kernel_t;
+
+template < typename K, typename R, typename... ArgsT >
+struct isa_kernel_t< K, R (*)(ArgsT...) > {
+    typedef R (*kernel_t)(ArgsT...);
+    static R scalar(ArgsT... args) { return K::run(args...); }
+#ifdef DOT_X86
+    __attribute__((target("sse2")))
+    static R sse2(ArgsT... args) { return K::run(args...); }
+    __attribute__((target("avx2,fma")))
+    static R avx2(ArgsT... args) { return K::run(args...); }
+    __attribute__((target("avx512f")))
+    static R avx512(ArgsT... args) { return K::run(args...); }
+#endif
+    static kernel_t select(isa_t isa) {
+        switch(isa) {
+#ifdef DOT_X86
+        case isa_t::SSE2: return sse2;
+        case isa_t::AVX2: return avx2;
+        case isa_t::AVX512: return avx512;
+#endif
+        default: return scalar;
+        }
+    }
+    //kernel for the active instruction set
+    static kernel_t get() {
+        static const kernel_t k = select(active_isa());
+        return k;
+    }
+};
+
+//four AVX-512 registers worth of accumulators, as in the dot kernels
+template < typename T >
+struct lanes_t {
+    enum : int { LANES = 256 / sizeof(T) };
+};
+
+//y = a * x + y
+template < typename T >
+struct axpy_kernel_t {
+    KERNEL_INLINE static void run(std::size_t n, T a, const T* x, T* y) {
+        for(std::size_t i = 0; i != n; ++i) y[i] += a * x[i];
+    }
+};
+
+//x = a * x
+template < typename T >
+struct scal_kernel_t {
+    KERNEL_INLINE static void run(std::size_t n, T a, T* x) {
+        for(std::size_t i = 0; i != n; ++i) x[i] *= a;
+    }
+};
+
+//sum |x_i|
+template < typename T >
+struct asum_kernel_t {
+    KERNEL_INLINE static T run(std::size_t n, const T* x) {
+        const int L = lanes_t< T >::LANES;
+        T s[L];
+        for(int l = 0; l != L; ++l) s[l] = T(0);
+        std::size_t i = 0;
+        for(; i + L <= n; i += L) {
+            for(int l = 0; l != L; ++l) s[l] += std::abs(x[i + l]);
+        }
+        for(; i != n; ++i) s[0] += std::abs(x[i]);
+        return sum_lanes(s);
+    }
+    KERNEL_INLINE static T sum_lanes(const T* s) {
+        T r = T(0);
+        for(int l = 0; l != lanes_t< T >::LANES; ++l) r += s[l];
+        return r;
+    }
+};
+
+//sum (scale * x_i)^2
+template < typename T >
+struct sumsq_kernel_t {
+    KERNEL_INLINE static T run(std::size_t n, T scale, const T* x) {
+        const int L = lanes_t< T >::LANES;
+        T s[L];
+        for(int l = 0; l != L; ++l) s[l] = T(0);
+        std::size_t i = 0;
+        for(; i + L <= n; i += L) {
+            for(int l = 0; l != L; ++l) {
+                const T v = scale * x[i + l];
+                s[l] += v * v;
+            }
+        }
+        for(; i != n; ++i) s[0] += (scale * x[i]) * (scale * x[i]);
+        return asum_kernel_t< T >::sum_lanes(s);
+    }
+};
+
+//max |x_i|
+template < typename T >
+struct amax_kernel_t {
+    KERNEL_INLINE static T run(std::size_t n, const T* x) {
+        const int L = lanes_t< T >::LANES;
+        T m[L];
+        for(int l = 0; l != L; ++l) m[l] = T(0);
+        std::size_t i = 0;
+        for(; i + L <= n; i += L) {
+            for(int l = 0; l != L; ++l) {
+                const T v = std::abs(x[i + l]);
+                m[l] = m[l] < v ? v : m[l];
+            }
+        }
+        for(; i != n; ++i) m[0] = std::max(m[0], std::abs(x[i]));
+        return *std::max_element(m, m + L);
+    }
+};
+
+//y = a * x + y
+template < typename T >
+void axpy(int n, T a, const T* x, T* y, int nt) {
+    const auto kernel = isa_kernel_t< axpy_kernel_t< T > >::get();
+    parallel_for_chunks(*reduce_pool(nt), std::size_t(n),
+        [=](std::size_t b, std::size_t e) {
+            kernel(e - b, a, x + b, y + b);
+        });
+}
+
+//x = a * x
+template < typename T >
+void scal(int n, T a, T* x, int nt) {
+    const auto kernel = isa_kernel_t< scal_kernel_t< T > >::get();
+    parallel_for_chunks(*reduce_pool(nt), std::size_t(n),
+        [=](std::size_t b, std::size_t e) {
+            kernel(e - b, a, x + b);
+        });
+}
+
+//sum |x_i|
+template < typename T >
+T asum(int n, const T* x, int nt) {
+    const auto kernel = isa_kernel_t< asum_kernel_t< T > >::get();
+    return parallel_reduce_chunks(*reduce_pool(nt), std::size_t(n), T(0),
+        [=](std::size_t b, std::size_t e) {
+            return kernel(e - b, x + b);
+        }, std::plus< T >());
+}
+
+//sqrt(sum x_i^2): one pass over the data unless the sum of the squares
+//overflows or is small enough to have lost accuracy to underflow, in which
+//case the data are scaled by 1 / max |x_i| as in the reference BLAS
+template < typename T >
+T nrm2(int n, const T* x, int nt) {
+    std::shared_ptr< reduce_pool_t > pool = reduce_pool(nt);
+    const auto sumsq = isa_kernel_t< sumsq_kernel_t< T > >::get();
+    auto sum_squares = [&](T scale) {
+        return parallel_reduce_chunks(*pool, std::size_t(n), T(0),
+            [=](std::size_t b, std::size_t e) {
+                return sumsq(e - b, scale, x + b);
+            }, std::plus< T >());
+    };
+    const T ss = sum_squares(T(1));
+    if(std::isnan(ss)) return ss;
+    const T tiny =
+        std::numeric_limits< T >::min() / std::numeric_limits< T >::epsilon();
+    if(std::isfinite(ss) && ss >= tiny) return std::sqrt(ss);
+    const auto amax = isa_kernel_t< amax_kernel_t< T > >::get();
+    const T m = parallel_reduce_chunks(*pool, std::size_t(n), T(0),
+        [=](std::size_t b, std::size_t e) {
+            return amax(e - b, x + b);
+        }, [](T a, T b) { return std::max(a, b); });
+    if(m == T(0) || !std::isfinite(m)) return m;
+    return m * std::sqrt(sum_squares(T(1) / m));
+}
+
+//y = alpha * A x + beta * y, A row-major m x n with leading dimension lda;
+//rows are split among the threads as the elements in dot(), each row is
+//computed by the SIMD dot kernel; y is not read when beta == 0
+template < typename T >
+void gemv(int m, int n, T alpha, const T* A, int lda, const T* x, T beta,
+          T* y, int nt) {
+    if(lda < n) throw std::range_error("Leading dimension < number of columns");
+    const dot_kernel_t< T > kernel = dot_kernel< T >();
+    parallel_for_chunks(*reduce_pool(nt), std::size_t(m),
+        [=](std::size_t b, std::size_t e) {
+            for(std::size_t r = b; r != e; ++r) {
+                const T d = alpha * kernel(n, A + r * lda, x);
+                y[r] = beta == T(0) ? d : d + beta * y[r];
+            }
+        });
+}
+
+//------------------------------------------------------------------------------
+//batched dot products: one or more queries against a row-major matrix of
+//candidates, S[q * lds + c] = Q[q] . C[c]. The micro-kernel computes a block
+//of QR queries x CR candidates (at most 2 x 4) keeping QR x CR accumulators of
+//one vector register each: each query load is reused CR times and each
+//candidate load QR times. The accumulators are gcc vectors of VB bytes, the
+//register width of the instruction set the kernel is instantiated for (vectors
+//wider than the target are lowered very inefficiently). Candidates are split
+//among the threads as the elements in dot(); queries are processed in groups
+//that fit in the L2 cache
+template < typename T, int VB >
+struct dot_tile_kernel_t {
+    typedef T vec_t __attribute__((vector_size(VB)));
+    enum : int { LANES = VB / sizeof(T), QB = 2, CB = 4 };
+    enum : std::size_t { QUERY_BYTES = 128 * 1024 };
+    //vectors are never passed by value: no ABI dependence on the target
+    KERNEL_INLINE static void load(vec_t& v, const T* p) {
+        std::memcpy(&v, p, sizeof(v));
+    }
+    template < int QR, int CR >
+    KERNEL_INLINE static void block(std::size_t n, const T* Q, std::size_t ldq,
+                                    const T* C, std::size_t ldc, T* S,
+                                    std::size_t lds) {
+        const int L = LANES;
+        vec_t acc[QR][CR];
+        for(int q = 0; q != QR; ++q)
+            for(int c = 0; c != CR; ++c) acc[q][c] = vec_t{};
+        std::size_t i = 0;
+        for(; i + L <= n; i += L) {
+            vec_t qv[QR];
+            for(int q = 0; q != QR; ++q) load(qv[q], Q + q * ldq + i);
+            for(int c = 0; c != CR; ++c) {
+                vec_t cv;
+                load(cv, C + c * ldc + i);
+                for(int q = 0; q != QR; ++q) acc[q][c] += qv[q] * cv;
+            }
+        }
+        for(int q = 0; q != QR; ++q) {
+            for(int c = 0; c != CR; ++c) {
+                T t[L];
+                std::memcpy(t, &acc[q][c], sizeof(t));
+                T s = T(0);
+                for(int l = 0; l != L; ++l) s += t[l];
+                for(std::size_t j = i; j != n; ++j)
+                    s += Q[q * ldq + j] * C[c * ldc + j];
+                S[q * lds + c] = s;
+            }
+        }
+    }
+    template < int QR >
+    KERNEL_INLINE static void queries(std::size_t cr, std::size_t n,
+                                      const T* Q, std::size_t ldq, const T* C,
+                                      std::size_t ldc, T* S, std::size_t lds) {
+        switch(cr) {
+        case 1: block< QR, 1 >(n, Q, ldq, C, ldc, S, lds); break;
+        case 2: block< QR, 2 >(n, Q, ldq, C, ldc, S, lds); break;
+        case 3: block< QR, 3 >(n, Q, ldq, C, ldc, S, lds); break;
+        default: block< QR, CB >(n, Q, ldq, C, ldc, S, lds); break;
+        }
+    }
+    KERNEL_INLINE static void run(std::size_t nq, std::size_t nc,
+                                  std::size_t n, const T* Q, std::size_t ldq,
+                                  const T* C, std::size_t ldc, T* S,
+                                  std::size_t lds) {
+        const std::size_t group = std::max(std::size_t(QB),
+            QUERY_BYTES / (std::max(n, std::size_t(1)) * sizeof(T)) / QB * QB);
+        for(std::size_t g = 0; g < nq; g += group) {
+            const std::size_t ge = std::min(nq, g + group);
+            for(std::size_t c = 0; c < nc; c += CB) {
+                const std::size_t cr = std::min(std::size_t(CB), nc - c);
+                std::size_t q = g;
+                for(; q + QB <= ge; q += QB)
+                    queries< QB >(cr, n, Q + q * ldq, ldq, C + c * ldc, ldc,
+                                  S + q * lds + c, lds);
+                if(q != ge)
+                    queries< 1 >(cr, n, Q + q * ldq, ldq, C + c * ldc, ldc,
+                                 S + q * lds + c, lds);
+            }
+        }
+    }
+};
+
+template < typename T >
+using tile_kernel_t = void (*)(std::size_t, std::size_t, std::size_t,
+                               const T*, std::size_t, const T*, std::size_t,
+                               T*, std::size_t);
+
+template < typename T >
+tile_kernel_t< T > select_tile_kernel(isa_t isa) {
+    switch(isa) {
+#ifdef DOT_X86
+    case isa_t::SSE2: return isa_kernel_t< dot_tile_kernel_t< T, 16 > >::sse2;
+    case isa_t::AVX2: return isa_kernel_t< dot_tile_kernel_t< T, 32 > >::avx2;
+    case isa_t::AVX512:
+        return isa_kernel_t< dot_tile_kernel_t< T, 64 > >::avx512;
+#endif
+    default: return isa_kernel_t< dot_tile_kernel_t< T, 16 > >::scalar;
+    }
+}
+
+//S[q * lds + c] = Q[q] . C[c] for q in [0, nq), c in [0, nc): nq queries
+//and nc candidates of n elements, row-major with leading dimensions ldq and
+//ldc; S is provided by the caller, with lds >= nc
+template < typename T >
+void dot_tile(int nq, int nc, int n, const T* Q, int ldq, const T* C, int ldc,
+              T* S, int lds, int nt) {
+    if(ldq < n || ldc < n)
+        throw std::range_error("Leading dimension < vector size");
+    if(nq > 1 && lds < nc)
+        throw std::range_error("Leading dimension of scores < candidates");
+    if(nq < 1) return;
+    static const tile_kernel_t< T > kernel =
+        select_tile_kernel< T >(active_isa());
+    parallel_for_chunks(*reduce_pool(nt), std::size_t(nc),
+        [=](std::size_t b, std::size_t e) {
+            kernel(nq, e - b, n, Q, ldq, C + b * ldc, ldc, S + b, lds);
+        });
+}
+
+//scores[r] = query . C[r], C row-major rows x n with leading dimension ldc;
+//scores is provided by the caller
+template < typename T >
+void dot_batch(int rows, int n, const T* query, const T* C, int ldc,
+               T* scores, int nt) {
+    dot_tile(1, rows, n, query, n, C, ldc, scores, rows, nt);
+}
+
+//------------------------------------------------------------------------------
+//top-k: the k candidates with the highest dot product with a query. Each
+//thread scans its chunk of candidates in blocks of TOPK_BLOCK scores computed
+//by the tile kernel and keeps its k best in a bounded heap; the heaps are
+//merged in the fixed tree order of parallel_reduce_chunks. Scores below the
+//running threshold (the k-th best score of the thread, or of any thread,
+//shared through an atomic) are rejected with one comparison, without
+//touching the heap. With the L2 norms of the candidates the dot products of
+//runs of candidates whose Cauchy-Schwarz bound |q| |c| is below the threshold
+//are not computed at all.
+//Candidates are ordered by decreasing score, then increasing id: the result
+//is the same for any number of threads; NaN scores are ignored
+template < typename T >
+struct scored_id_t {
+    T score;
+    std::size_t id;
+};
+
+template < typename T >
+inline bool better(const scored_id_t< T >& a, const scored_id_t< T >& b) {
+    return a.score > b.score || (a.score == b.score && a.id < b.id);
+}
+
+//bounded heap of the k best candidates, the worst one on top
+template < typename T >
+class topk_heap_t {
+public:
+    explicit topk_heap_t(std::size_t k = 0) : k_(k) {}
+    //scores below the threshold cannot enter the heap
+    T threshold() const {
+        return full() ? heap_.front().score
+                      : -std::numeric_limits< T >::infinity();
+    }
+    bool full() const { return k_ != 0 && heap_.size() == k_; }
+    void push(const scored_id_t< T >& s) {
+        if(k_ == 0 || s.score != s.score) return;
+        if(heap_.size() < k_) {
+            heap_.push_back(s);
+            std::push_heap(heap_.begin(), heap_.end(), better< T >);
+        } else if(better(s, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), better< T >);
+            heap_.back() = s;
+            std::push_heap(heap_.begin(), heap_.end(), better< T >);
+        }
+    }
+    void merge(const topk_heap_t& h) {
+        for(auto& s: h.heap_) push(s);
+    }
+    //best first
+    std::vector< scored_id_t< T > > sorted() const {
+        std::vector< scored_id_t< T > > r(heap_);
+        std::sort(r.begin(), r.end(), better< T >);
+        return r;
+    }
+private:
+    std::size_t k_;
+    std::vector< scored_id_t< T > > heap_;
+};
+
+//norms[r] = |C[r]|, input of top_k
+template < typename T >
+void row_norms(int rows, int n, const T* C, int ldc, T* norms, int nt) {
+    const auto sumsq = isa_kernel_t< sumsq_kernel_t< T > >::get();
+    parallel_for_chunks(*reduce_pool(nt), std::size_t(rows),
+        [=](std::size_t b, std::size_t e) {
+            for(std::size_t r = b; r != e; ++r)
+                norms[r] = std::sqrt(sumsq(n, T(1), C + r * ldc));
+        });
+}
+
+const std::size_t TOPK_BLOCK = 256;
+
+//max(a, v), lock-free
+template < typename T >
+void atomic_max(std::atomic< T >& a, T v) {
+    T cur = a.load(std::memory_order_relaxed);
+    while(cur < v && !a.compare_exchange_weak(cur, v,
+                                              std::memory_order_relaxed)) {}
+}
+
+//ids (row indices) and scores of the k rows of C with the highest dot
+//product with query, best first; norms: optional row norms (row_norms)
+template < typename T >
+std::vector< scored_id_t< T > > top_k(int rows, int n, const T* query,
+                                      const T* C, int ldc, std::size_t k,
+                                      int nt, const T* norms = nullptr) {
+    if(ldc < n) throw std::range_error("Leading dimension < vector size");
+    static const tile_kernel_t< T > kernel =
+        select_tile_kernel< T >(active_isa());
+    std::atomic< T > shared(-std::numeric_limits< T >::infinity());
+    T qnorm = T(0);
+    //the computed dot product can exceed the bound by the rounding error
+    T slack = T(0);
+    if(norms) {
+        const auto sumsq = isa_kernel_t< sumsq_kernel_t< T > >::get();
+        qnorm = std::sqrt(sumsq(n, T(1), query));
+        slack = T(1 + 4 * (n + 2) * std::numeric_limits< T >::epsilon());
+    }
+    const topk_heap_t< T > heap = parallel_reduce_chunks(*reduce_pool(nt),
+        std::size_t(rows), topk_heap_t< T >(k),
+        [&](std::size_t b, std::size_t e) {
+            topk_heap_t< T > h(k);
+            T scores[TOPK_BLOCK];
+            for(std::size_t s = b; s < e; s += TOPK_BLOCK) {
+                const std::size_t se = std::min(e, s + TOPK_BLOCK);
+                T thr = std::max(h.threshold(),
+                                 shared.load(std::memory_order_relaxed));
+                //runs of candidates that can enter the heap
+                std::size_t r = s;
+                while(r != se) {
+                    std::size_t re = r;
+                    if(norms) {
+                        while(r != se && norms[r] * qnorm * slack < thr) ++r;
+                        re = r;
+                        while(re != se && !(norms[re] * qnorm * slack < thr))
+                            ++re;
+                    } else {
+                        re = se;
+                    }
+                    if(r == re) break;
+                    kernel(1, re - r, n, query, n, C + r * ldc, ldc,
+                           scores + (r - s), TOPK_BLOCK);
+                    for(std::size_t c = r; c != re; ++c) {
+                        const T score = scores[c - s];
+                        if(score < thr) continue;
+                        h.push(scored_id_t< T >{score, c});
+                        if(h.full()) thr = std::max(thr, h.threshold());
+                    }
+                    r = re;
+                }
+                if(h.full()) atomic_max(shared, h.threshold());
+            }
+            return h;
+        },
+        [](topk_heap_t< T > a, const topk_heap_t< T >& b) {
+            a.merge(b);
+            return a;
+        });
+    return heap.sorted();
+}
+
+//------------------------------------------------------------------------------
+//mixed precision: vectors stored as float, IEEE half (fp16) or bfloat16 are
+//converted to float on load and accumulated in float or double, halving or
+//quartering the memory traffic of a double dot product. The AVX2 kernels
+//convert with F16C, the AVX-512 kernels with the AVX-512F instructions, bf16
+//is converted by shifting into the high half of a float; SSE2 and scalar use
+//the scalar conversions below
+
+//16 bit storage types
+struct fp16_t {
+    std::uint16_t bits;
+};
+
+struct bf16_t {
+    std::uint16_t bits;
+};
+
+inline float float_from_bits(std::uint32_t u) {
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+inline std::uint32_t float_bits(float f) {
+    std::uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+inline float to_float(float f) { return f; }
+
+inline float to_float(bf16_t b) {
+    return float_from_bits(std::uint32_t(b.bits) << 16);
+}
+
+inline float to_float(fp16_t h) {
+    const std::uint32_t sign = std::uint32_t(h.bits & 0x8000) << 16;
+    const std::uint32_t exp = (h.bits >> 10) & 0x1f;
+    std::uint32_t mant = h.bits & 0x3ff;
+    if(exp == 0x1f) return float_from_bits(sign | 0x7f800000 | (mant << 13));
+    if(exp != 0)
+        return float_from_bits(sign | ((exp + 112) << 23) | (mant << 13));
+    if(mant == 0) return float_from_bits(sign);
+    //subnormal: normalize the mantissa
+    std::uint32_t e = 113;
+    while(!(mant & 0x400)) {
+        mant <<= 1;
+        --e;
+    }
+    return float_from_bits(sign | (e << 23) | ((mant & 0x3ff) << 13));
+}
+
+//round to nearest even, overflow to infinity
+inline bf16_t to_bf16(float f) {
+    std::uint32_t u = float_bits(f);
+    if((u & 0x7fffffff) > 0x7f800000) //quiet NaN
+        return bf16_t{std::uint16_t((u >> 16) | 0x40)};
+    u += 0x7fff + ((u >> 16) & 1);
+    return bf16_t{std::uint16_t(u >> 16)};
+}
+
+inline fp16_t to_fp16(float f) {
+    std::uint32_t u = float_bits(f);
+    const std::uint32_t sign = (u >> 16) & 0x8000;
+    u &= 0x7fffffff;
+    std::uint32_t h;
+    if(u >= (127 + 16) << 23) { //overflow, infinity or NaN
+        h = u > 0x7f800000 ? 0x7e00 : 0x7c00;
+    } else if(u < (127 - 14) << 23) { //subnormal or zero: the addition
+        //aligns the mantissa and rounds it to nearest even
+        const std::uint32_t magic = (127 - 15 + 23 - 10 + 1) << 23;
+        h = float_bits(float_from_bits(u) + float_from_bits(magic)) - magic;
+    } else {
+        const std::uint32_t odd = (u >> 13) & 1;
+        u += (std::uint32_t(15 - 127) << 23) + 0xfff + odd;
+        h = u >> 13;
+    }
+    return fp16_t{std::uint16_t(h | sign)};
+}
+
+//conversion from float to one of the storage types
+template < typename T >
+T from_float(float f);
+
+template <>
+inline float from_float< float >(float f) { return f; }
+
+template <>
+inline fp16_t from_float< fp16_t >(float f) { return to_fp16(f); }
+
+template <>
+inline bf16_t from_float< bf16_t >(float f) { return to_bf16(f); }
+
+template < typename In, typename Acc >
+using mixed_kernel_t = Acc (*)(std::size_t, const In*, const In*);
+
+template < typename In, typename Acc >
+Acc dot_mixed_scalar(std::size_t n, const In* x, const In* y) {
+    Acc d0 = Acc(0), d1 = Acc(0), d2 = Acc(0), d3 = Acc(0);
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        d0 += Acc(to_float(x[i])) * Acc(to_float(y[i]));
+        d1 += Acc(to_float(x[i + 1])) * Acc(to_float(y[i + 1]));
+        d2 += Acc(to_float(x[i + 2])) * Acc(to_float(y[i + 2]));
+        d3 += Acc(to_float(x[i + 3])) * Acc(to_float(y[i + 3]));
+    }
+    for(; i != n; ++i) d0 += Acc(to_float(x[i])) * Acc(to_float(y[i]));
+    return (d0 + d1) + (d2 + d3);
+}
+
+#ifdef DOT_X86
+//8 floats from 8 stored values
+__attribute__((target("avx2,fma,f16c")))
+inline __m256 load8_avx2(const float* p) { return _mm256_loadu_ps(p); }
+
+__attribute__((target("avx2,fma,f16c")))
+inline __m256 load8_avx2(const fp16_t* p) {
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast< const __m128i* >(p)));
+}
+
+__attribute__((target("avx2,fma,f16c")))
+inline __m256 load8_avx2(const bf16_t* p) {
+    const __m128i b = _mm_loadu_si128(reinterpret_cast< const __m128i* >(p));
+    return _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_cvtepu16_epi32(b), 16));
+}
+
+//accumulators for 8 products
+template < typename Acc >
+struct avx2_acc_t;
+
+template <>
+struct avx2_acc_t< float > {
+    __m256 v;
+    __attribute__((target("avx2,fma,f16c"))) void zero() {
+        v = _mm256_setzero_ps();
+    }
+    __attribute__((target("avx2,fma,f16c"))) void fma(__m256 x, __m256 y) {
+        v = _mm256_fmadd_ps(x, y, v);
+    }
+    __attribute__((target("avx2,fma,f16c"))) float sum() const {
+        return hsum_avx2(v);
+    }
+};
+
+template <>
+struct avx2_acc_t< double > {
+    __m256d lo;
+    __m256d hi;
+    __attribute__((target("avx2,fma,f16c"))) void zero() {
+        lo = hi = _mm256_setzero_pd();
+    }
+    __attribute__((target("avx2,fma,f16c"))) void fma(__m256 x, __m256 y) {
+        lo = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)),
+                             _mm256_cvtps_pd(_mm256_castps256_ps128(y)), lo);
+        hi = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)),
+                             _mm256_cvtps_pd(_mm256_extractf128_ps(y, 1)), hi);
+    }
+    __attribute__((target("avx2,fma,f16c"))) double sum() const {
+        return hsum_avx2(_mm256_add_pd(lo, hi));
+    }
+};
+
+template < typename In, typename Acc >
+__attribute__((target("avx2,fma,f16c")))
+Acc dot_mixed_avx2(std::size_t n, const In* x, const In* y) {
+    avx2_acc_t< Acc > d0, d1, d2, d3;
+    d0.zero(); d1.zero(); d2.zero(); d3.zero();
+    std::size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        d0.fma(load8_avx2(x + i), load8_avx2(y + i));
+        d1.fma(load8_avx2(x + i + 8), load8_avx2(y + i + 8));
+        d2.fma(load8_avx2(x + i + 16), load8_avx2(y + i + 16));
+        d3.fma(load8_avx2(x + i + 24), load8_avx2(y + i + 24));
+    }
+    for(; i + 8 <= n; i += 8) d0.fma(load8_avx2(x + i), load8_avx2(y + i));
+    return ((d0.sum() + d1.sum()) + (d2.sum() + d3.sum()))
+           + dot_mixed_scalar< In, Acc >(n - i, x + i, y + i);
+}
+
+//16 floats from 16 stored values; the zero-masked (maskz) forms of the
+//conversion and extraction intrinsics are used because the unmasked ones
+//trigger -Wmaybe-uninitialized in some versions of the gcc headers
+__attribute__((target("avx512f")))
+inline __m512 load16_avx512(const float* p) { return _mm512_loadu_ps(p); }
+
+__attribute__((target("avx512f")))
+inline __m512 load16_avx512(const fp16_t* p) {
+    return _mm512_maskz_cvtph_ps(__mmask16(0xffff),
+        _mm256_loadu_si256(reinterpret_cast< const __m256i* >(p)));
+}
+
+__attribute__((target("avx512f")))
+inline __m512 load16_avx512(const bf16_t* p) {
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast< const __m256i* >(p));
+    const __mmask16 all = 0xffff;
+    return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(
+        all, _mm512_maskz_cvtepu16_epi32(all, b), 16));
+}
+
+//accumulators for 16 products
+template < typename Acc >
+struct avx512_acc_t;
+
+template <>
+struct avx512_acc_t< float > {
+    __m512 v;
+    __attribute__((target("avx512f"))) void zero() {
+        v = _mm512_setzero_ps();
+    }
+    __attribute__((target("avx512f"))) void fma(__m512 x, __m512 y) {
+        v = _mm512_fmadd_ps(x, y, v);
+    }
+    __attribute__((target("avx512f"))) float sum() const {
+        return hsum_avx512(v);
+    }
+};
+
+template <>
+struct avx512_acc_t< double > {
+    __m512d lo;
+    __m512d hi;
+    __attribute__((target("avx512f"))) void zero() {
+        lo = hi = _mm512_setzero_pd();
+    }
+    __attribute__((target("avx512f"))) void fma(__m512 x, __m512 y) {
+        lo = _mm512_fmadd_pd(half< 0 >(x), half< 0 >(y), lo);
+        hi = _mm512_fmadd_pd(half< 1 >(x), half< 1 >(y), hi);
+    }
+    __attribute__((target("avx512f"))) double sum() const {
+        return hsum_avx512(_mm512_add_pd(lo, hi));
+    }
+    //lower (H = 0) or upper (H = 1) 8 floats converted to double; extracted
+    //as integers: _mm512_extractf32x8_ps requires AVX512DQ
+    template < int H >
+    __attribute__((target("avx512f"))) static __m512d half(__m512 v) {
+        const __m256i h = _mm512_maskz_extracti64x4_epi64(
+            __mmask8(0xf), _mm512_castps_si512(v), H);
+        return _mm512_maskz_cvtps_pd(__mmask8(0xff), _mm256_castsi256_ps(h));
+    }
+};
+
+template < typename In, typename Acc >
+__attribute__((target("avx512f")))
+Acc dot_mixed_avx512(std::size_t n, const In* x, const In* y) {
+    avx512_acc_t< Acc > d0, d1, d2, d3;
+    d0.zero(); d1.zero(); d2.zero(); d3.zero();
+    std::size_t i = 0;
+    for(; i + 64 <= n; i += 64) {
+        d0.fma(load16_avx512(x + i), load16_avx512(y + i));
+        d1.fma(load16_avx512(x + i + 16), load16_avx512(y + i + 16));
+        d2.fma(load16_avx512(x + i + 32), load16_avx512(y + i + 32));
+        d3.fma(load16_avx512(x + i + 48), load16_avx512(y + i + 48));
+    }
+    for(; i + 16 <= n; i += 16)
+        d0.fma(load16_avx512(x + i), load16_avx512(y + i));
+    return ((d0.sum() + d1.sum()) + (d2.sum() + d3.sum()))
+           + dot_mixed_scalar< In, Acc >(n - i, x + i, y + i);
+}
+#endif
+
+//In: float, fp16_t or bf16_t; Acc: float or double
+template < typename In, typename Acc >
+mixed_kernel_t< In, Acc > select_mixed_kernel(isa_t isa) {
+    switch(isa) {
+#ifdef DOT_X86
+    case isa_t::AVX2: return dot_mixed_avx2< In, Acc >;
+    case isa_t::AVX512: return dot_mixed_avx512< In, Acc >;
+#endif
+    default: return dot_mixed_scalar< In, Acc >;
+    }
+}
+
+template < typename In, typename Acc >
+mixed_kernel_t< In, Acc > mixed_kernel() {
+    static const mixed_kernel_t< In, Acc > k =
+        select_mixed_kernel< In, Acc >(active_isa());
+    return k;
+}
+
+//dot< In, Acc >(N, X, Y, nt): mixed precision dot product on the persistent
+//pool, same partitioning and combine order as dot()
+template < typename In, typename Acc >
+Acc dot(int N, const In* X, const In* Y, int nt) {
+    const mixed_kernel_t< In, Acc > kernel = mixed_kernel< In, Acc >();
+    return parallel_reduce_chunks(*reduce_pool(nt), std::size_t(N), Acc(0),
+        [=](std::size_t b, std::size_t e) {
+            return kernel(e - b, X + b, Y + b);
+        }, std::plus< Acc >());
+}
@@ -0,0 +1,366 @@
+//
+// Author: Ugo Varetto
+//
+// Allocator instrumentation: InstrumentedAllocator<T, AllocT> wraps any
+// allocator and records, in an AllocStats object shared by the containers
+// to observe:
+//
+// - number of allocations and deallocations, bytes allocated and freed;
+// - live and peak bytes;
+// - histogram of the allocation sizes, power of two bins;
+// - optionally, every sampleEvery allocations, the call stack (glibc
+//   backtrace; link with -rdynamic to get function names in reports).
+//
+// Each thread updates its own, separately allocated, block of counters
+// with relaxed atomic operations, no locks; counters are summed when read.
+// Live bytes are exact. Threads publish their live bytes every PEAK_SLACK
+// bytes; on each allocation the peak is compared with the published live
+// bytes plus the unpublished ones of the allocating thread: it is exact with
+// one thread, with more threads it can be off by the bytes not yet
+// published by the other threads, at most PEAK_SLACK per thread. Sampled
+// call stacks are stored under a mutex.
+//
+// AllocStats objects register themselves: AllocStats::ReportAll prints all
+// the live ones, sorted by number of allocations, to find the containers
+// that cause allocator churn. The first MAX_STATS AllocStats objects get
+// per-thread counters, the following ones share one block of counters.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__has_include)
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define INSTRUMENTED_ALLOCATOR_BACKTRACE
+#endif
+#endif
+
+//counters summed over all threads
+struct AllocCounts {
+    enum : int { HISTOGRAM_BINS = 48 };
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    std::uint64_t bytesAllocated = 0;
+    std::uint64_t bytesFreed = 0;
+    std::int64_t liveBytes = 0;
+    std::int64_t peakBytes = 0;
+    //bin i: allocations of (2^(i-1), 2^i] bytes, bin 0: 0 or 1 byte, last
+    //bin: larger allocations too
+    std::uint64_t histogram[HISTOGRAM_BINS] = {};
+};
+
+//call stack sampled every n allocations: n allocations of bytes / samples
+//bytes on average
+struct AllocCallSite {
+    std::vector< void* > frames;
+    std::uint64_t samples = 0;
+    std::uint64_t bytes = 0;
+};
+
+class AllocStats {
+public:
+    enum : int { MAX_STATS = 256, MAX_FRAMES = 16 };
+    static const std::int64_t PEAK_SLACK = 64 << 10;
+    //sampleEvery = 0: no call stack sampling
+    explicit AllocStats(std::string name, int sampleEvery = 0)
+        : name_(std::move(name)), sampleEvery_(sampleEvery),
+          id_(NextId().fetch_add(1)) {
+        Registry& r = GetRegistry();
+        std::lock_guard< std::mutex > lock(r.mutex);
+        r.stats.push_back(this);
+    }
+    AllocStats(const AllocStats&) = delete;
+    AllocStats& operator=(const AllocStats&) = delete;
+    //no allocator using this object can be used after destruction
+    ~AllocStats() {
+        {
+            Registry& r = GetRegistry();
+            std::lock_guard< std::mutex > lock(r.mutex);
+            r.stats.erase(std::find(r.stats.begin(), r.stats.end(), this));
+        }
+        Counters* c = counters_.load();
+        while(c) {
+            Counters* next = c->next;
+            delete c;
+            c = next;
+        }
+    }
+    const std::string& Name() const { return name_; }
+    void OnAllocate(std::size_t bytes) {
+        Counters& c = ThreadCounters();
+        c.allocations.fetch_add(1, std::memory_order_relaxed);
+        c.bytesAllocated.fetch_add(bytes, std::memory_order_relaxed);
+        c.histogram[Bin(bytes)].fetch_add(1, std::memory_order_relaxed);
+        AddLive(c, std::int64_t(bytes));
+        if(sampleEvery_
+           && c.countdown.fetch_sub(1, std::memory_order_relaxed) <= 1) {
+            c.countdown.store(sampleEvery_, std::memory_order_relaxed);
+            Sample(bytes);
+        }
+    }
+    void OnDeallocate(std::size_t bytes) {
+        Counters& c = ThreadCounters();
+        c.deallocations.fetch_add(1, std::memory_order_relaxed);
+        c.bytesFreed.fetch_add(bytes, std::memory_order_relaxed);
+        AddLive(c, -std::int64_t(bytes));
+    }
+    AllocCounts Counts() const {
+        AllocCounts s;
+        for(const Counters* c = counters_.load(); c; c = c->next) {
+            s.allocations += c->allocations.load(std::memory_order_relaxed);
+            s.deallocations +=
+                c->deallocations.load(std::memory_order_relaxed);
+            s.bytesAllocated +=
+                c->bytesAllocated.load(std::memory_order_relaxed);
+            s.bytesFreed += c->bytesFreed.load(std::memory_order_relaxed);
+            for(int i = 0; i != AllocCounts::HISTOGRAM_BINS; ++i)
+                s.histogram[i] +=
+                    c->histogram[i].load(std::memory_order_relaxed);
+        }
+        s.liveBytes = std::int64_t(s.bytesAllocated - s.bytesFreed);
+        s.peakBytes = std::max(peak_.load(std::memory_order_relaxed),
+                               s.liveBytes);
+        return s;
+    }
+    //sampled call sites, most bytes first
+    std::vector< AllocCallSite > CallSites() const {
+        std::vector< AllocCallSite > sites;
+        {
+            std::lock_guard< std::mutex > lock(sitesMutex_);
+            for(const auto& s: sites_) sites.push_back(s.second);
+        }
+        std::sort(sites.begin(), sites.end(),
+                  [](const AllocCallSite& a, const AllocCallSite& b) {
+                      return a.bytes > b.bytes;
+                  });
+        return sites;
+    }
+    //counters, non-empty histogram bins and the first maxSites call sites
+    void Report(std::ostream& os, std::size_t maxSites = 5) const {
+        const AllocCounts s = Counts();
+        os << name_ << ": " << s.allocations << " allocations, "
+           << s.deallocations << " deallocations, " << s.bytesAllocated
+           << " bytes allocated, live " << s.liveBytes << ", peak "
+           << s.peakBytes << '\n';
+        os << "  sizes:";
+        for(int i = 0; i != AllocCounts::HISTOGRAM_BINS; ++i)
+            if(s.histogram[i])
+                os << " <=" << (std::uint64_t(1) << i) << ": "
+                   << s.histogram[i];
+        os << '\n';
+        std::vector< AllocCallSite > sites = CallSites();
+        if(sites.size() > maxSites) sites.resize(maxSites);
+        for(const AllocCallSite& site: sites) {
+            os << "  call site: " << site.samples << " samples, "
+               << site.bytes << " bytes\n";
+            PrintFrames(os, site.frames);
+        }
+    }
+    //all the AllocStats objects, most allocations first
+    static void ReportAll(std::ostream& os, std::size_t maxSites = 5) {
+        Registry& r = GetRegistry();
+        std::lock_guard< std::mutex > lock(r.mutex);
+        std::vector< std::pair< std::uint64_t, const AllocStats* > > all;
+        for(const AllocStats* s: r.stats)
+            all.push_back(std::make_pair(s->Counts().allocations, s));
+        std::sort(all.begin(), all.end(),
+                  [](const std::pair< std::uint64_t, const AllocStats* >& a,
+                     const std::pair< std::uint64_t, const AllocStats* >& b) {
+                      return a.first > b.first;
+                  });
+        for(const auto& s: all) s.second->Report(os, maxSites);
+    }
+private:
+    //one per thread, written by the owning thread only unless shared
+    struct Counters {
+        std::atomic< std::uint64_t > allocations{0};
+        std::atomic< std::uint64_t > deallocations{0};
+        std::atomic< std::uint64_t > bytesAllocated{0};
+        std::atomic< std::uint64_t > bytesFreed{0};
+        //live bytes not yet published to live_
+        std::atomic< std::int64_t > pending{0};
+        //allocations until the next sample
+        std::atomic< int > countdown{0};
+        std::atomic< std::uint64_t > histogram[AllocCounts::HISTOGRAM_BINS];
+        Counters* next = nullptr;
+        Counters() {
+            for(auto& h: histogram) h.store(0, std::memory_order_relaxed);
+        }
+    };
+    struct Registry {
+        std::mutex mutex;
+        std::vector< const AllocStats* > stats;
+    };
+    //never destroyed: AllocStats objects can be static
+    static Registry& GetRegistry() {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+    static std::atomic< int >& NextId() {
+        static std::atomic< int > id{0};
+        return id;
+    }
+    static int Bin(std::size_t bytes) {
+        int b = 0;
+        while(b != AllocCounts::HISTOGRAM_BINS - 1
+              && (std::uint64_t(1) << b) < bytes)
+            ++b;
+        return b;
+    }
+    Counters& ThreadCounters() {
+        if(id_ >= MAX_STATS) return Shared();
+        //trivially destructible, usable from static destructors
+        thread_local Counters* counters[MAX_STATS] = {};
+        Counters*& c = counters[id_];
+        if(!c) c = AddCounters();
+        return *c;
+    }
+    Counters& Shared() {
+        std::call_once(sharedOnce_, [this]() { shared_ = AddCounters(); });
+        return *shared_;
+    }
+    Counters* AddCounters() {
+        Counters* c = new Counters();
+        c->countdown.store(sampleEvery_, std::memory_order_relaxed);
+        c->next = counters_.load();
+        while(!counters_.compare_exchange_weak(c->next, c)) {}
+        return c;
+    }
+    //what is moved from pending to live_ is always subtracted from pending,
+    //also with concurrent writers
+    void AddLive(Counters& c, std::int64_t bytes) {
+        const std::int64_t p =
+            c.pending.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if(p < std::int64_t(PEAK_SLACK) && p > -std::int64_t(PEAK_SLACK)) {
+            if(bytes > 0)
+                UpdatePeak(live_.load(std::memory_order_relaxed) + p);
+            return;
+        }
+        c.pending.fetch_sub(p, std::memory_order_relaxed);
+        UpdatePeak(live_.fetch_add(p, std::memory_order_relaxed) + p);
+    }
+    //a store only when the peak increases
+    void UpdatePeak(std::int64_t live) {
+        std::int64_t peak = peak_.load(std::memory_order_relaxed);
+        while(live > peak
+              && !peak_.compare_exchange_weak(peak, live,
+                                              std::memory_order_relaxed)) {}
+    }
+#ifdef INSTRUMENTED_ALLOCATOR_BACKTRACE
+    __attribute__((noinline)) void Sample(std::size_t bytes) {
+        void* frames[MAX_FRAMES + 1];
+        const int n = backtrace(frames, MAX_FRAMES + 1);
+        //without Sample
+        std::vector< void* > key(frames + std::min(n, 1), frames + n);
+        std::lock_guard< std::mutex > lock(sitesMutex_);
+        AllocCallSite& site = sites_[key];
+        if(site.frames.empty()) site.frames = key;
+        ++site.samples;
+        site.bytes += bytes;
+    }
+    static void PrintFrames(std::ostream& os,
+                            const std::vector< void* >& frames) {
+        char** symbols = backtrace_symbols(frames.data(), int(frames.size()));
+        for(std::size_t i = 0; i != frames.size(); ++i) {
+            os << "    ";
+            if(symbols) os << symbols[i];
+            else os << frames[i];
+            os << '\n';
+        }
+        std::free(symbols);
+    }
+#else
+    void Sample(std::size_t) {}
+    static void PrintFrames(std::ostream&, const std::vector< void* >&) {}
+#endif
+private:
+    std::string name_;
+    int sampleEvery_;
+    int id_;
+    std::atomic< Counters* > counters_{nullptr};
+    std::once_flag sharedOnce_;
+    Counters* shared_ = nullptr;
+    std::atomic< std::int64_t > live_{0};
+    std::atomic< std::int64_t > peak_{0};
+    mutable std::mutex sitesMutex_;
+    std::map< std::vector< void* >, AllocCallSite > sites_;
+};
+
+//forwards to AllocT through std::allocator_traits, records allocations and
+//deallocations in stats, which must outlive the allocator
+template < typename T, typename AllocT = std::allocator< T > >
+class InstrumentedAllocator {
+    using Traits = std::allocator_traits< AllocT >;
+public:
+    //required
+    using value_type = T;
+    using pointer = typename Traits::pointer;
+    using size_type = typename Traits::size_type;
+    pointer allocate(size_type n) {
+        pointer p = Traits::allocate(alloc_, n);
+        stats_->OnAllocate(n * sizeof(T));
+        return p;
+    }
+    void deallocate(pointer p, size_type n) {
+        stats_->OnDeallocate(n * sizeof(T));
+        Traits::deallocate(alloc_, p, n);
+    }
+    //optional
+    using const_pointer = typename Traits::const_pointer;
+    using void_pointer = typename Traits::void_pointer;
+    using const_void_pointer = typename Traits::const_void_pointer;
+    using difference_type = typename Traits::difference_type;
+    using propagate_on_container_copy_assignment =
+        typename Traits::propagate_on_container_copy_assignment;
+    using propagate_on_container_move_assignment =
+        typename Traits::propagate_on_container_move_assignment;
+    using propagate_on_container_swap =
+        typename Traits::propagate_on_container_swap;
+    //the default rebind would not rebind AllocT
+    template < typename U >
+    struct rebind {
+        using other = InstrumentedAllocator< U,
+                          typename Traits::template rebind_alloc< U > >;
+    };
+    explicit InstrumentedAllocator(AllocStats& stats,
+                                   const AllocT& alloc = AllocT())
+        : stats_(&stats), alloc_(alloc) {}
+    template < typename U, typename A >
+    InstrumentedAllocator(const InstrumentedAllocator< U, A >& other)
+        : stats_(&other.Stats()), alloc_(other.Inner()) {}
+    InstrumentedAllocator select_on_container_copy_construction() const {
+        return InstrumentedAllocator(
+                   *stats_,
+                   Traits::select_on_container_copy_construction(alloc_));
+    }
+    size_type max_size() const { return Traits::max_size(alloc_); }
+    AllocStats& Stats() const { return *stats_; }
+    const AllocT& Inner() const { return alloc_; }
+private:
+    AllocStats* stats_;
+    AllocT alloc_;
+};
+
+template < typename T, typename A, typename U, typename B >
+bool operator==(const InstrumentedAllocator< T, A >& a,
+                const InstrumentedAllocator< U, B >& b) {
+    return &a.Stats() == &b.Stats() && a.Inner() == b.Inner();
+}
+
+template < typename T, typename A, typename U, typename B >
+bool operator!=(const InstrumentedAllocator< T, A >& a,
+                const InstrumentedAllocator< U, B >& b) {
+    return !(a == b);
+}
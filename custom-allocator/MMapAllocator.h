@@ -0,0 +1,439 @@
+//
+// Author: Ugo Varetto
+//
+// File backed memory regions and allocator.
+//
+// MMapRegion maps a file and reserves a large range of address space up
+// front: the file grows inside the reservation (fallocate/ftruncate), the
+// mapping never moves and pointers into the region stay valid while the
+// region is open. The address of the mapping is stored in the file header
+// and requested again when the file is reopened, so that data structures
+// holding raw pointers (e.g. a std::vector allocated with MMapAllocator) are
+// valid across runs: the top level object is recovered with Root<T>().
+//
+// Layout: header, then blocks; each block starts with its size, free blocks
+// are kept in a list sorted by offset and merged with their neighbours when
+// released, the last block is returned to the free space at the end.
+//
+// Crash detection: the header is marked dirty while the file is open
+// read-write and clean by Close(); WasClean() tells whether the previous
+// session ended with Close(). Writes through the mapping reach the file even
+// if the process crashes (MAP_SHARED), Sync(MS_SYNC) is only needed to
+// survive an OS crash or a power loss.
+//
+// One process at a time can open a file read-write (exclusive flock), any
+// number read-only when no writer is active; within a process allocation is
+// serialized by a spin lock. Allocators find the region open read-write
+// from the address of its header in a per-process table, nothing process
+// local is stored in the file.
+//
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef> //std::size_t
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+//pre 4.17 kernels: the address is a hint, checked after mmap
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+class MMapRegion;
+
+//at offset 0 of the file
+struct MMapHeader {
+    std::uint64_t magic;
+    std::uint64_t version;
+    std::uint64_t base;      //address of the mapping
+    std::uint64_t reserved;  //bytes of address space reserved
+    std::uint64_t committed; //file size
+    std::uint64_t top;       //end of the last block
+    std::uint64_t freeList;  //offset of the first free block, 0 if none
+    std::uint64_t root;      //offset of the root object, 0 if none
+    std::uint64_t rootSize;  //sizeof root object
+    std::uint64_t clean;     //1 if closed by Close()
+    std::atomic< std::uint32_t > lock;
+};
+
+enum class MMapMode { CREATE, OPEN, READ_ONLY };
+
+class MMapRegion {
+public:
+    //address space reserved by default, the file grows up to this size
+    static const std::size_t DEFAULT_RESERVE = std::size_t(64) << 30;
+    static const std::size_t ALIGNMENT = 16;
+    //CREATE truncates an existing file, OPEN and READ_ONLY require a file
+    //created by MMapRegion; with fixedAddress the mapping must be at the
+    //address stored in the file, required when the region contains raw
+    //pointers
+    MMapRegion(const std::string& fpath, MMapMode mode = MMapMode::CREATE,
+               std::size_t reserve = DEFAULT_RESERVE,
+               bool fixedAddress = true)
+            : fpath_(fpath), mode_(mode) {
+        try {
+            if(mode == MMapMode::CREATE) Create(reserve);
+            else Open(fixedAddress);
+        } catch(...) {
+            Release();
+            throw;
+        }
+    }
+    MMapRegion(const MMapRegion&) = delete;
+    MMapRegion& operator=(const MMapRegion&) = delete;
+    ~MMapRegion() {
+        try {
+            Close();
+        } catch(...) {}
+    }
+    //flush the used part of the region to the file: MS_ASYNC schedules the
+    //writes, MS_SYNC waits for them to complete
+    void Sync(int flags = MS_SYNC) {
+        if(!header_ || ReadOnly()) return;
+        if(msync(base_, PageRound(header_->top), flags) != 0)
+            throw std::runtime_error("Cannot sync " + fpath_ + ": "
+                                     + std::strerror(errno));
+    }
+    //flush, mark clean and unmap; pointers into the region become invalid
+    void Close() {
+        if(!header_) return;
+        if(!ReadOnly()) {
+            Sync(MS_SYNC);
+            header_->clean = 1;
+            msync(base_, PageSize(), MS_SYNC);
+        }
+        Release();
+    }
+    bool WasClean() const { return wasClean_; }
+    //region open read-write in this process with header h, nullptr if none
+    static MMapRegion* Owner(const MMapHeader* h) {
+        Owners& o = GetOwners();
+        std::lock_guard< std::mutex > lock(o.mutex);
+        auto i = o.regions.find(h);
+        return i == o.regions.end() ? nullptr : i->second;
+    }
+    bool ReadOnly() const { return mode_ == MMapMode::READ_ONLY; }
+    char* Base() const { return base_; }
+    MMapHeader* Header() const { return header_; }
+    //file size and end of the last block, in bytes
+    std::size_t Size() const { return header_->committed; }
+    std::size_t Used() const { return header_->top; }
+    bool Contains(const void* p) const {
+        const char* c = static_cast< const char* >(p);
+        return c >= base_ && c < base_ + header_->top;
+    }
+    std::size_t Offset(const void* p) const {
+        return static_cast< const char* >(p) - base_;
+    }
+    //ALIGNMENT aligned; throws std::bad_alloc when the reservation or the
+    //disk is full
+    void* Allocate(std::size_t bytes) {
+        if(ReadOnly()) throw std::logic_error("Read-only region");
+        if(bytes > header_->reserved) throw std::bad_alloc();
+        const std::uint64_t need = std::max(Round(bytes) + BLOCK_HEADER,
+                                            std::uint64_t(MIN_BLOCK));
+        Guard guard(header_->lock);
+        //first fit
+        std::uint64_t prev = 0;
+        for(std::uint64_t b = header_->freeList; b; b = Block(b).next) {
+            BlockHeader& h = Block(b);
+            if(h.size >= need) {
+                if(h.size - need >= MIN_BLOCK) {
+                    const std::uint64_t rest = b + need;
+                    Block(rest).size = h.size - need;
+                    Block(rest).next = h.next;
+                    Link(prev, rest);
+                    h.size = need;
+                } else {
+                    Link(prev, h.next);
+                }
+                return base_ + b + BLOCK_HEADER;
+            }
+            prev = b;
+        }
+        const std::uint64_t b = header_->top;
+        Commit(b + need);
+        Block(b).size = need;
+        header_->top = b + need;
+        return base_ + b + BLOCK_HEADER;
+    }
+    void Deallocate(void* p, std::size_t bytes) {
+        if(!p) return;
+        if(ReadOnly()) throw std::logic_error("Read-only region");
+        Guard guard(header_->lock);
+        const std::uint64_t b = Offset(p) - BLOCK_HEADER;
+        const std::uint64_t size = std::max(Round(bytes) + BLOCK_HEADER,
+                                            std::uint64_t(MIN_BLOCK));
+        if(!Contains(p) || b < HeaderSize() || Block(b).size < size
+           || b + Block(b).size > header_->top) {
+            throw std::logic_error(
+                    "Deallocation of a block not allocated by the region");
+        }
+        std::uint64_t prev = 0, next = header_->freeList;
+        while(next && next < b) {
+            prev = next;
+            next = Block(next).next;
+        }
+        //merge with the following free block or the free space at the end
+        if(b + Block(b).size == header_->top) {
+            header_->top = b;
+            if(prev && prev + Block(prev).size == b) {
+                header_->top = prev;
+                Unlink(prev);
+            }
+            return;
+        }
+        if(next && b + Block(b).size == next) {
+            Block(b).size += Block(next).size;
+            Block(b).next = Block(next).next;
+        } else {
+            Block(b).next = next;
+        }
+        if(prev && prev + Block(prev).size == b) {
+            Block(prev).size += Block(b).size;
+            Block(prev).next = Block(b).next;
+        } else {
+            Link(prev, b);
+        }
+    }
+    //construct the root object, the previous one is not destroyed
+    template < typename T, typename... ArgsT >
+    T* MakeRoot(ArgsT&&... args) {
+        static_assert(alignof(T) <= ALIGNMENT, "Unsupported alignment");
+        T* p = new (Allocate(sizeof(T))) T(std::forward< ArgsT >(args)...);
+        header_->root = Offset(p);
+        header_->rootSize = sizeof(T);
+        return p;
+    }
+    //root object, nullptr if not set
+    template < typename T >
+    T* Root() const {
+        if(!header_->root) return nullptr;
+        if(header_->rootSize != sizeof(T))
+            throw std::logic_error("Root object of a different type");
+        return reinterpret_cast< T* >(base_ + header_->root);
+    }
+private:
+    struct BlockHeader {
+        std::uint64_t size; //bytes, including the header
+        std::uint64_t next; //next free block, free blocks only
+    };
+    struct Guard {
+        explicit Guard(std::atomic< std::uint32_t >& l) : lock(l) {
+            while(lock.exchange(1, std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+        ~Guard() { lock.store(0, std::memory_order_release); }
+        std::atomic< std::uint32_t >& lock;
+    };
+    struct Owners {
+        std::mutex mutex;
+        std::map< const MMapHeader*, MMapRegion* > regions;
+    };
+    //never destroyed: regions can be static
+    static Owners& GetOwners() {
+        static Owners* owners = new Owners();
+        return *owners;
+    }
+    void SetOwner(bool owner) {
+        Owners& o = GetOwners();
+        std::lock_guard< std::mutex > lock(o.mutex);
+        if(owner) o.regions[header_] = this;
+        else o.regions.erase(header_);
+    }
+    //static const members are passed by value: no definition required
+    static const std::uint64_t MAGIC = 0x50414d4d4e4f4f43ull;
+    static const std::uint64_t VERSION = 2;
+    static const std::uint64_t BLOCK_HEADER = sizeof(BlockHeader);
+    static const std::uint64_t MIN_BLOCK = 4 * BLOCK_HEADER;
+    //initial file size
+    static const std::uint64_t MIN_COMMIT = std::uint64_t(1) << 20;
+    static std::uint64_t Round(std::uint64_t n) {
+        return (n + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+    static std::uint64_t PageSize() {
+        static const std::uint64_t p = std::uint64_t(sysconf(_SC_PAGESIZE));
+        return p;
+    }
+    static std::uint64_t PageRound(std::uint64_t n) {
+        return (n + PageSize() - 1) / PageSize() * PageSize();
+    }
+    static std::uint64_t HeaderSize() { return Round(sizeof(MMapHeader)); }
+    BlockHeader& Block(std::uint64_t offset) const {
+        return *reinterpret_cast< BlockHeader* >(base_ + offset);
+    }
+    //prev.next = b, freeList if prev == 0
+    void Link(std::uint64_t prev, std::uint64_t b) {
+        if(prev) Block(prev).next = b;
+        else header_->freeList = b;
+    }
+    //remove the last free block
+    void Unlink(std::uint64_t b) {
+        std::uint64_t prev = 0;
+        for(std::uint64_t f = header_->freeList; f != b; f = Block(f).next)
+            prev = f;
+        Link(prev, 0);
+    }
+    //grow the file to at least bytes, doubling its size
+    void Commit(std::uint64_t bytes) {
+        if(bytes <= header_->committed) return;
+        if(bytes > header_->reserved) throw std::bad_alloc();
+        const std::uint64_t size =
+            std::min(PageRound(std::max(bytes, 2 * header_->committed)),
+                     header_->reserved);
+        Grow(header_->committed, size);
+        header_->committed = size;
+    }
+    //allocate the disk blocks, so that writing through the mapping never
+    //fails with SIGBUS on a full disk; ftruncate where not supported
+    void Grow(std::uint64_t from, std::uint64_t to) {
+        const int r = posix_fallocate(fd_, off_t(from), off_t(to - from));
+        if(r == 0) return;
+        if(r == ENOSPC || ftruncate(fd_, off_t(to)) != 0)
+            throw std::bad_alloc();
+    }
+    void Create(std::size_t reserve) {
+        //truncated only when locked: another process may have it mapped
+        fd_ = open(fpath_.c_str(), O_RDWR | O_CREAT, (mode_t)0600);
+        if(fd_ == -1) Fail("Cannot open file ");
+        if(flock(fd_, LOCK_EX | LOCK_NB) != 0) Fail("File in use ");
+        if(ftruncate(fd_, 0) != 0) Fail("Cannot truncate file ");
+        reserve = std::max(PageRound(reserve), std::uint64_t(MIN_COMMIT));
+        Grow(0, MIN_COMMIT);
+        Map(nullptr, reserve, PROT_READ | PROT_WRITE, false);
+        header_ = new (base_) MMapHeader();
+        header_->magic = MAGIC;
+        header_->version = VERSION;
+        header_->base = std::uint64_t(base_);
+        header_->reserved = reserve;
+        header_->committed = MIN_COMMIT;
+        header_->top = HeaderSize();
+        header_->lock.store(0);
+        SetOwner(true);
+        wasClean_ = true;
+        msync(base_, PageSize(), MS_SYNC);
+    }
+    void Open(bool fixedAddress) {
+        const bool rw = !ReadOnly();
+        fd_ = open(fpath_.c_str(), rw ? O_RDWR : O_RDONLY);
+        if(fd_ == -1) Fail("Cannot open file ");
+        if(flock(fd_, (rw ? LOCK_EX : LOCK_SH) | LOCK_NB) != 0)
+            Fail("File in use ");
+        MMapHeader h;
+        struct stat s;
+        if(pread(fd_, &h, sizeof(h), 0) != ssize_t(sizeof(h))
+           || h.magic != MAGIC || h.version != VERSION)
+            throw std::runtime_error("Invalid region file " + fpath_);
+        if(fstat(fd_, &s) != 0 || std::uint64_t(s.st_size) < h.committed)
+            throw std::runtime_error("Truncated region file " + fpath_);
+        //read-only regions cannot grow, map the file only
+        Map(fixedAddress ? reinterpret_cast< char* >(h.base) : nullptr,
+            rw ? h.reserved : h.committed,
+            rw ? PROT_READ | PROT_WRITE : PROT_READ, fixedAddress);
+        header_ = reinterpret_cast< MMapHeader* >(base_);
+        wasClean_ = header_->clean != 0;
+        if(rw) {
+            header_->clean = 0;
+            //a crashed process may have held it
+            header_->lock.store(0);
+            SetOwner(true);
+            msync(base_, PageSize(), MS_SYNC);
+        }
+    }
+    void Map(char* address, std::size_t bytes, int prot, bool fixed) {
+        void* p = mmap(address, bytes, prot,
+                       MAP_SHARED | MAP_NORESERVE
+                       | (fixed ? MAP_FIXED_NOREPLACE : 0), fd_, 0);
+        if(p == MAP_FAILED) Fail("Cannot map file ");
+        if(fixed && p != address) {
+            munmap(p, bytes);
+            throw std::runtime_error("Cannot map " + fpath_
+                                     + " at the address stored in the file");
+        }
+        base_ = static_cast< char* >(p);
+        mapped_ = bytes;
+    }
+    void Release() {
+        if(header_ && !ReadOnly()) SetOwner(false);
+        if(base_) munmap(base_, mapped_);
+        if(fd_ != -1) close(fd_); //releases the lock
+        base_ = nullptr;
+        header_ = nullptr;
+        fd_ = -1;
+    }
+    [[noreturn]] void Fail(const std::string& msg) const {
+        throw std::runtime_error(msg + fpath_ + ": " + std::strerror(errno));
+    }
+private:
+    std::string fpath_;
+    MMapMode mode_;
+    int fd_ = -1;
+    char* base_ = nullptr;
+    std::size_t mapped_ = 0;
+    MMapHeader* header_ = nullptr;
+    bool wasClean_ = false;
+};
+
+//stores the address of the region header, the same in every run: containers
+//using it can be stored in the region and recovered (MMapRegion::Root)
+//after reopening the file; not usable with read-only regions
+template < typename T >
+class MMapAllocator {
+    static_assert(alignof(T) <= MMapRegion::ALIGNMENT,
+                  "Unsupported alignment");
+public:
+    //required
+    using value_type = T;
+    T* allocate(std::size_t n) {
+        if(n > std::numeric_limits< std::size_t >::max() / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast< T* >(Region().Allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t n) {
+        Region().Deallocate(p, n * sizeof(T));
+    }
+    //optional
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    explicit MMapAllocator(const MMapRegion& region)
+        : header_(region.Header()) {}
+    template < typename U >
+    MMapAllocator(const MMapAllocator< U >& other)
+        : header_(other.Header()) {}
+    MMapHeader* Header() const { return header_; }
+    MMapRegion& Region() const {
+        MMapRegion* r = MMapRegion::Owner(header_);
+        if(!r) throw std::logic_error("Region not open read-write");
+        return *r;
+    }
+private:
+    MMapHeader* header_;
+};
+
+template < typename T, typename U >
+bool operator==(const MMapAllocator< T >& a, const MMapAllocator< U >& b) {
+    return a.Header() == b.Header();
+}
+
+template < typename T, typename U >
+bool operator!=(const MMapAllocator< T >& a, const MMapAllocator< U >& b) {
+    return !(a == b);
+}
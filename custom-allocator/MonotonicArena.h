@@ -0,0 +1,177 @@
+//
+// Author: Ugo Varetto
+//
+// Monotonic (bump pointer) arena.
+//
+// Memory is handed out from an initial buffer, optionally provided by the
+// caller (e.g. on the stack), then from chunks obtained from ::operator new,
+// each twice the size of the previous one. Deallocation is a no-op: all the
+// memory is released at once by Reset(), which frees the chunks and rewinds to
+// the initial buffer. Suited to build-then-discard workloads: the containers
+// of a request allocate from the arena and are freed in one shot at the end
+// of the request.
+//
+// Available as an allocator template (ArenaAllocator<T>) and, with C++17, as
+// a std::pmr::memory_resource (MonotonicResource) for pmr containers.
+// Not thread safe: one arena per thread or per request.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define MONOTONIC_ARENA_PMR
+#endif
+#endif
+
+class MonotonicArena {
+public:
+    static const std::size_t DEFAULT_CHUNK = 4096;
+    //buffer is not owned and must outlive the arena; the first chunk is
+    //firstChunk bytes, DEFAULT_CHUNK if 0, or twice the buffer size if
+    //larger
+    MonotonicArena(void* buffer, std::size_t size,
+                   std::size_t firstChunk = 0)
+        : buffer_(static_cast< char* >(buffer)), bufferSize_(size),
+          firstChunk_(std::max(firstChunk ? firstChunk
+                                          : std::size_t(DEFAULT_CHUNK),
+                               2 * size)) {
+        Reset();
+    }
+    explicit MonotonicArena(std::size_t firstChunk = DEFAULT_CHUNK)
+        : MonotonicArena(nullptr, 0, firstChunk) {}
+    MonotonicArena(const MonotonicArena&) = delete;
+    MonotonicArena& operator=(const MonotonicArena&) = delete;
+    ~MonotonicArena() { ReleaseChunks(); }
+    //alignment: power of two
+    void* Allocate(std::size_t bytes,
+                   std::size_t alignment = alignof(std::max_align_t)) {
+        const std::uintptr_t p = Align(current_, alignment);
+        //current_ is 0 before the first chunk if there is no buffer
+        if(current_ && p >= current_ && p <= end_ && bytes <= end_ - p) {
+            current_ = p + bytes;
+            return reinterpret_cast< void* >(p);
+        }
+        return AllocateChunk(bytes, alignment);
+    }
+    //release all the memory, objects allocated from the arena must have
+    //been destroyed
+    void Reset() {
+        ReleaseChunks();
+        current_ = reinterpret_cast< std::uintptr_t >(buffer_);
+        end_ = current_ + bufferSize_;
+        nextChunk_ = firstChunk_;
+    }
+    //bytes obtained from ::operator new
+    std::size_t ChunkBytes() const { return chunkBytes_; }
+    std::size_t Chunks() const { return chunks_; }
+private:
+    struct Chunk {
+        Chunk* next;
+        std::size_t size;
+    };
+    static std::uintptr_t Align(std::uintptr_t p, std::size_t alignment) {
+        return (p + alignment - 1) & ~std::uintptr_t(alignment - 1);
+    }
+    void* AllocateChunk(std::size_t bytes, std::size_t alignment) {
+        const std::size_t overhead = sizeof(Chunk) + alignment;
+        if(bytes > std::numeric_limits< std::size_t >::max() - overhead)
+            throw std::bad_alloc();
+        const std::size_t size = std::max(nextChunk_, bytes + overhead);
+        Chunk* c = static_cast< Chunk* >(::operator new(size));
+        c->next = chunk_;
+        c->size = size;
+        chunk_ = c;
+        ++chunks_;
+        chunkBytes_ += size;
+        nextChunk_ = 2 * size;
+        const std::uintptr_t p = Align(
+            reinterpret_cast< std::uintptr_t >(c + 1), alignment);
+        current_ = p + bytes;
+        end_ = reinterpret_cast< std::uintptr_t >(c) + size;
+        return reinterpret_cast< void* >(p);
+    }
+    void ReleaseChunks() {
+        while(chunk_) {
+            Chunk* next = chunk_->next;
+            ::operator delete(chunk_);
+            chunk_ = next;
+        }
+        chunks_ = 0;
+        chunkBytes_ = 0;
+    }
+private:
+    char* buffer_;
+    std::size_t bufferSize_;
+    std::size_t firstChunk_;
+    std::size_t nextChunk_ = 0;
+    std::uintptr_t current_ = 0;
+    std::uintptr_t end_ = 0;
+    Chunk* chunk_ = nullptr;
+    std::size_t chunks_ = 0;
+    std::size_t chunkBytes_ = 0;
+};
+
+template < typename T >
+class ArenaAllocator {
+public:
+    //required
+    using value_type = T;
+    T* allocate(std::size_t n) {
+        if(n > std::numeric_limits< std::size_t >::max() / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast< T* >(arena_->Allocate(n * sizeof(T),
+                                                  alignof(T)));
+    }
+    void deallocate(T*, std::size_t) noexcept {}
+    //optional
+    explicit ArenaAllocator(MonotonicArena& arena) noexcept
+        : arena_(&arena) {}
+    template < typename U >
+    ArenaAllocator(const ArenaAllocator< U >& other) noexcept
+        : arena_(other.Arena()) {}
+    MonotonicArena* Arena() const noexcept { return arena_; }
+private:
+    MonotonicArena* arena_;
+};
+
+template < typename T, typename U >
+bool operator==(const ArenaAllocator< T >& a, const ArenaAllocator< U >& b) {
+    return a.Arena() == b.Arena();
+}
+
+template < typename T, typename U >
+bool operator!=(const ArenaAllocator< T >& a, const ArenaAllocator< U >& b) {
+    return !(a == b);
+}
+
+#ifdef MONOTONIC_ARENA_PMR
+class MonotonicResource : public std::pmr::memory_resource {
+public:
+    MonotonicResource(void* buffer, std::size_t size,
+                      std::size_t firstChunk = 0)
+        : arena_(buffer, size, firstChunk) {}
+    explicit MonotonicResource(
+        std::size_t firstChunk = MonotonicArena::DEFAULT_CHUNK)
+        : arena_(firstChunk) {}
+    void Reset() { arena_.Reset(); }
+    MonotonicArena& Arena() { return arena_; }
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return arena_.Allocate(bytes, alignment);
+    }
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other)
+        const noexcept override {
+        return this == &other;
+    }
+private:
+    MonotonicArena arena_;
+};
+#endif
@@ -0,0 +1,221 @@
+//
+// Author: Ugo Varetto
+//
+// Position independent pointer and allocator for MMapRegion.
+//
+// OffsetPtr<T> stores the distance between its own address and the target:
+// a structure built of OffsetPtrs inside a region is valid wherever the
+// region is mapped, in any process and after reopening the file, unlike raw
+// pointers which require the region to be mapped at the same address.
+// OffsetPtr is the pointer type of OffsetAllocator, containers that use
+// allocator_traits< A >::pointer for their internal links (e.g. std::vector
+// with libstdc++) can be stored in a region and mapped read-only by many
+// processes at once (MMapMode::READ_ONLY, fixedAddress = false).
+//
+// Copying an OffsetPtr recomputes the distance from the new location; the
+// null value is 1 (a pointer to the second byte of the OffsetPtr itself).
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#include "MMapAllocator.h"
+
+template < typename T >
+class OffsetPtr {
+public:
+    using element_type = T;
+    using value_type = typename std::remove_cv< T >::type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = OffsetPtr;
+    using reference = typename std::add_lvalue_reference< T >::type;
+    using iterator_category = std::random_access_iterator_tag;
+    template < typename U >
+    using rebind = OffsetPtr< U >;
+    OffsetPtr() noexcept : offset_(NULL_OFFSET) {}
+    OffsetPtr(std::nullptr_t) noexcept : offset_(NULL_OFFSET) {}
+    OffsetPtr(T* p) noexcept { Set(p); }
+    OffsetPtr(const OffsetPtr& other) noexcept { Set(other.get()); }
+    template < typename U, typename std::enable_if<
+                   std::is_convertible< U*, T* >::value, int >::type = 0 >
+    OffsetPtr(const OffsetPtr< U >& other) noexcept { Set(other.get()); }
+    //static_cast< OffsetPtr< T > >(OffsetPtr< U >)
+    template < typename U, typename std::enable_if<
+                   !std::is_convertible< U*, T* >::value, int >::type = 0 >
+    explicit OffsetPtr(const OffsetPtr< U >& other) noexcept {
+        Set(static_cast< T* >(other.get()));
+    }
+    OffsetPtr& operator=(const OffsetPtr& other) noexcept {
+        Set(other.get());
+        return *this;
+    }
+    OffsetPtr& operator=(T* p) noexcept {
+        Set(p);
+        return *this;
+    }
+    T* get() const noexcept {
+        if(offset_ == NULL_OFFSET) return nullptr;
+        std::intptr_t a = reinterpret_cast< std::intptr_t >(this) + offset_;
+#ifdef __GNUC__
+        //hide the origin of the address: the points-to analysis would
+        //otherwise derive it from this and assume that the target is inside
+        //the OffsetPtr, reordering accesses to it under strict aliasing
+        __asm__("" : "+r"(a));
+#endif
+        return reinterpret_cast< T* >(a);
+    }
+    explicit operator bool() const noexcept {
+        return offset_ != NULL_OFFSET;
+    }
+    T* operator->() const noexcept { return get(); }
+    template < typename U = T >
+    typename std::enable_if< !std::is_void< U >::value, U& >::type
+    operator*() const noexcept { return *get(); }
+    template < typename U = T >
+    typename std::enable_if< !std::is_void< U >::value, U& >::type
+    operator[](difference_type i) const noexcept { return get()[i]; }
+    template < typename U = T >
+    static typename std::enable_if< !std::is_void< U >::value,
+                                    OffsetPtr >::type
+    pointer_to(U& r) noexcept { return OffsetPtr(&r); }
+    //random access iterator
+    OffsetPtr& operator+=(difference_type n) noexcept {
+        offset_ += n * difference_type(sizeof(T));
+        return *this;
+    }
+    OffsetPtr& operator-=(difference_type n) noexcept {
+        return *this += -n;
+    }
+    OffsetPtr& operator++() noexcept { return *this += 1; }
+    OffsetPtr& operator--() noexcept { return *this -= 1; }
+    OffsetPtr operator++(int) noexcept {
+        OffsetPtr p(*this);
+        ++*this;
+        return p;
+    }
+    OffsetPtr operator--(int) noexcept {
+        OffsetPtr p(*this);
+        --*this;
+        return p;
+    }
+    friend OffsetPtr operator+(OffsetPtr p, difference_type n) noexcept {
+        return p += n;
+    }
+    friend OffsetPtr operator+(difference_type n, OffsetPtr p) noexcept {
+        return p += n;
+    }
+    friend OffsetPtr operator-(OffsetPtr p, difference_type n) noexcept {
+        return p -= n;
+    }
+    friend difference_type operator-(const OffsetPtr& a,
+                                     const OffsetPtr& b) noexcept {
+        return a.get() - b.get();
+    }
+private:
+    static const std::ptrdiff_t NULL_OFFSET = 1;
+    void Set(T* p) noexcept {
+        offset_ = p ? reinterpret_cast< std::intptr_t >(p)
+                      - reinterpret_cast< std::intptr_t >(this)
+                    : NULL_OFFSET;
+    }
+private:
+    std::ptrdiff_t offset_;
+};
+
+template < typename T, typename U >
+bool operator==(const OffsetPtr< T >& a, const OffsetPtr< U >& b) {
+    return a.get() == b.get();
+}
+template < typename T, typename U >
+bool operator!=(const OffsetPtr< T >& a, const OffsetPtr< U >& b) {
+    return a.get() != b.get();
+}
+template < typename T, typename U >
+bool operator<(const OffsetPtr< T >& a, const OffsetPtr< U >& b) {
+    return a.get() < b.get();
+}
+template < typename T, typename U >
+bool operator>(const OffsetPtr< T >& a, const OffsetPtr< U >& b) {
+    return b < a;
+}
+template < typename T, typename U >
+bool operator<=(const OffsetPtr< T >& a, const OffsetPtr< U >& b) {
+    return !(b < a);
+}
+template < typename T, typename U >
+bool operator>=(const OffsetPtr< T >& a, const OffsetPtr< U >& b) {
+    return !(a < b);
+}
+template < typename T >
+bool operator==(const OffsetPtr< T >& p, std::nullptr_t) { return !p; }
+template < typename T >
+bool operator==(std::nullptr_t, const OffsetPtr< T >& p) { return !p; }
+template < typename T >
+bool operator!=(const OffsetPtr< T >& p, std::nullptr_t) { return bool(p); }
+template < typename T >
+bool operator!=(std::nullptr_t, const OffsetPtr< T >& p) { return bool(p); }
+
+//MMapAllocator with OffsetPtr pointers; stores an OffsetPtr to the region
+//header, position independent as well
+template < typename T >
+class OffsetAllocator {
+    static_assert(alignof(T) <= MMapRegion::ALIGNMENT,
+                  "Unsupported alignment");
+public:
+    //required
+    using value_type = T;
+    using pointer = OffsetPtr< T >;
+    pointer allocate(std::size_t n) {
+        if(n > std::numeric_limits< std::size_t >::max() / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast< T* >(Region().Allocate(n * sizeof(T)));
+    }
+    void deallocate(pointer p, std::size_t n) {
+        Region().Deallocate(p.get(), n * sizeof(T));
+    }
+    //optional
+    using const_pointer = OffsetPtr< const T >;
+    using void_pointer = OffsetPtr< void >;
+    using const_void_pointer = OffsetPtr< const void >;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    template < typename U >
+    struct rebind { using other = OffsetAllocator< U >; };
+    explicit OffsetAllocator(const MMapRegion& region)
+        : header_(region.Header()) {}
+    OffsetAllocator(const OffsetAllocator& other)
+        : header_(other.Header()) {}
+    template < typename U >
+    OffsetAllocator(const OffsetAllocator< U >& other)
+        : header_(other.Header()) {}
+    OffsetAllocator& operator=(const OffsetAllocator& other) {
+        header_ = other.Header();
+        return *this;
+    }
+    MMapHeader* Header() const { return header_.get(); }
+    MMapRegion& Region() const {
+        MMapRegion* r = MMapRegion::Owner(header_.get());
+        if(!r) throw std::logic_error("Region not open read-write");
+        return *r;
+    }
+private:
+    OffsetPtr< MMapHeader > header_;
+};
+
+template < typename T, typename U >
+bool operator==(const OffsetAllocator< T >& a,
+                const OffsetAllocator< U >& b) {
+    return a.Header() == b.Header();
+}
+
+template < typename T, typename U >
+bool operator!=(const OffsetAllocator< T >& a,
+                const OffsetAllocator< U >& b) {
+    return !(a == b);
+}
@@ -0,0 +1,167 @@
+//
+// Author: Ugo Varetto
+//
+// Position independent containers stored in an MMapRegion.
+//
+// Built by one process with the region open read-write, then mapped
+// read-only by any number of processes at once at any address (MMapMode::
+// READ_ONLY, fixedAddress = false): loading an index is a mmap call, pages
+// are read on first access and shared through the page cache.
+//
+// - PersistentVector<T>: std::vector with OffsetAllocator;
+// - PersistentHashMap<K, V>: open addressing with linear probing in
+//   a PersistentVector of slots, load factor <= 3/4, backward shift erase.
+//
+// Keys and values must be trivially copyable and must not contain pointers;
+// the hash function must give the same value in every process, which
+// std::hash does not guarantee: StableHash is the default.
+// Iterators of PersistentVector are OffsetPtrs, hot loops should iterate
+// over data() (raw pointer).
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "OffsetPtr.h"
+
+template < typename T >
+using PersistentVector = std::vector< T, OffsetAllocator< T > >;
+
+//FNV-1a on n bytes
+inline std::uint64_t Fnv1a(const void* p, std::size_t n) {
+    const unsigned char* b = static_cast< const unsigned char* >(p);
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for(std::size_t i = 0; i != n; ++i) h = (h ^ b[i]) * 0x100000001b3ull;
+    return h;
+}
+
+//splitmix64 finalizer for integers, FNV-1a on the normalised value for
+//floating point and on the object representation otherwise: keys that
+//compare equal must have the same bytes (padding bytes zeroed, no
+//floating point members)
+template < typename KeyT, typename E = void >
+struct StableHash {
+    std::uint64_t operator()(const KeyT& k) const {
+        return Fnv1a(&k, sizeof(KeyT));
+    }
+};
+
+//hashed as double (long double has padding bytes): -0.0 == 0.0, both
+//hashed as 0.0; all NaNs hashed as the same NaN
+template < typename KeyT >
+struct StableHash< KeyT, typename std::enable_if<
+                             std::is_floating_point< KeyT >::value >::type > {
+    std::uint64_t operator()(KeyT k) const {
+        const double d = k == KeyT(0) ? 0.0
+                         : k != k ? std::numeric_limits< double >::quiet_NaN()
+                         : double(k);
+        return Fnv1a(&d, sizeof(d));
+    }
+};
+
+template < typename KeyT >
+struct StableHash< KeyT, typename std::enable_if<
+                             std::is_integral< KeyT >::value >::type > {
+    std::uint64_t operator()(KeyT k) const {
+        std::uint64_t x = std::uint64_t(k);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+};
+
+template < typename KeyT, typename ValueT,
+           typename HashT = StableHash< KeyT > >
+class PersistentHashMap {
+    static_assert(std::is_trivially_copyable< KeyT >::value
+                  && std::is_trivially_copyable< ValueT >::value,
+                  "Keys and values must be trivially copyable");
+    struct Slot {
+        KeyT key;
+        ValueT value;
+        bool used;
+    };
+    using Table = PersistentVector< Slot >;
+public:
+    explicit PersistentHashMap(const MMapRegion& region)
+        : table_(OffsetAllocator< Slot >(region)), size_(0) {}
+    std::size_t Size() const { return size_; }
+    //capacity for n elements without rehashing
+    void Reserve(std::size_t n) {
+        std::size_t c = MIN_CAPACITY;
+        while(c * 3 / 4 < n) c *= 2;
+        if(c > table_.size()) Rehash(c);
+    }
+    //true if inserted, false if the value of an existing key was replaced
+    bool Insert(const KeyT& key, const ValueT& value) {
+        Reserve(size_ + 1);
+        Slot& s = table_[Probe(table_.data(), table_.size(), key)];
+        const bool inserted = !s.used;
+        s.key = key;
+        s.value = value;
+        s.used = true;
+        size_ += inserted;
+        return inserted;
+    }
+    //nullptr if not found
+    const ValueT* Find(const KeyT& key) const {
+        if(table_.empty()) return nullptr;
+        const Slot& s = table_[Probe(table_.data(), table_.size(), key)];
+        return s.used ? &s.value : nullptr;
+    }
+    ValueT* Find(const KeyT& key) {
+        return const_cast< ValueT* >(
+                   static_cast< const PersistentHashMap& >(*this).Find(key));
+    }
+    //the following elements of the probe sequence are moved back, no
+    //tombstones
+    bool Erase(const KeyT& key) {
+        if(table_.empty()) return false;
+        Slot* t = table_.data();
+        const std::size_t mask = table_.size() - 1;
+        std::size_t i = Probe(t, table_.size(), key);
+        if(!t[i].used) return false;
+        for(std::size_t j = (i + 1) & mask; t[j].used; j = (j + 1) & mask) {
+            const std::size_t home = HashT()(t[j].key) & mask;
+            //move j to i if its home is not in (i, j]
+            if(((j - home) & mask) >= ((j - i) & mask)) {
+                t[i] = t[j];
+                i = j;
+            }
+        }
+        t[i].used = false;
+        --size_;
+        return true;
+    }
+    //f(key, value) for each element, in table order
+    template < typename F >
+    void ForEach(F f) const {
+        for(const Slot& s: table_)
+            if(s.used) f(s.key, s.value);
+    }
+private:
+    enum : std::size_t { MIN_CAPACITY = 16 };
+    //slot of key or first empty slot of its probe sequence; capacity is
+    //a power of two, never full
+    static std::size_t Probe(const Slot* t, std::size_t capacity,
+                             const KeyT& key) {
+        const std::size_t mask = capacity - 1;
+        std::size_t i = HashT()(key) & mask;
+        while(t[i].used && !(t[i].key == key)) i = (i + 1) & mask;
+        return i;
+    }
+    void Rehash(std::size_t capacity) {
+        Table t(capacity, Slot(), table_.get_allocator());
+        for(const Slot& s: table_)
+            if(s.used) t[Probe(t.data(), capacity, s.key)] = s;
+        table_.swap(t);
+    }
+private:
+    Table table_;
+    std::size_t size_;
+};
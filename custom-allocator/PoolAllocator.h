@@ -0,0 +1,258 @@
+//
+// Author: Ugo Varetto
+//
+// Size class pool allocator for small objects: coroutine frames, nodes of
+// lists, maps and hash tables.
+//
+// Requests up to MAX_SMALL bytes are rounded up to one of NUM_CLASSES size
+// classes (multiples of 16 up to 128, then four classes per power of two)
+// and served from spans: SPAN_SIZE aligned memory blocks holding blocks of
+// a single class, preceded by a span header. Free blocks are kept in
+// intrusive singly linked lists, the link is stored in the free block:
+// allocation and deallocation pop and push the head of a list, O(1).
+//
+// Each thread has a cache with one free list per class. An empty list is
+// refilled with a batch of blocks from the global depot (one mutex per
+// class) or from a new span, a list longer than two batches returns one
+// batch to the depot; the lists of a thread are returned to the depot when
+// the thread exits. Blocks can be freed by any thread.
+//
+// The size class of a block is read from the span header at address &
+// ~(SPAN_SIZE - 1), no lookup table: deallocation does not need the size.
+// Larger requests are allocated from the system, SPAN_SIZE aligned and with
+// the same header. Spans are never returned to the system.
+// After the cache of a thread is destroyed (e.g. blocks freed by static
+// objects), its blocks go through the depot.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+class SizeClassPool {
+public:
+    static const std::size_t SPAN_SIZE = std::size_t(64) << 10;
+    static const std::size_t MAX_SMALL = 2048;
+    static const std::size_t ALIGNMENT = 16;
+    enum : int { NUM_CLASSES = 24 };
+    //never destroyed: used by thread caches until the last thread exits
+    static SizeClassPool& Instance() {
+        static SizeClassPool* pool = new SizeClassPool();
+        return *pool;
+    }
+    //ALIGNMENT aligned
+    void* Allocate(std::size_t bytes) {
+        if(bytes > MAX_SMALL) return AllocateLarge(bytes);
+        const int c = classOf_[(bytes + ALIGNMENT - 1) / ALIGNMENT];
+        FreeList* lists = Lists();
+        if(!lists) return AllocateUncached(c);
+        FreeList& l = lists[c];
+        if(!l.head) Refill(l, c);
+        Block* b = l.head;
+        l.head = b->next;
+        --l.count;
+        return b;
+    }
+    void Deallocate(void* p) {
+        if(!p) return;
+        const SpanHeader* s = Span(p);
+        if(s->sizeClass == LARGE) {
+            std::free(const_cast< SpanHeader* >(s));
+            return;
+        }
+        const int c = int(s->sizeClass);
+        Block* b = static_cast< Block* >(p);
+        FreeList* lists = Lists();
+        if(!lists) {
+            b->next = nullptr;
+            std::lock_guard< std::mutex > lock(depots_[c].mutex);
+            depots_[c].batches.push_back(Batch{b, 1});
+            return;
+        }
+        FreeList& l = lists[c];
+        b->next = l.head;
+        l.head = b;
+        if(++l.count > 2 * batch_[c]) Flush(l, c, batch_[c]);
+    }
+    //size of the blocks of class c
+    static std::size_t ClassSize(int c) {
+        if(c < 8) return ALIGNMENT * (c + 1);
+        const int g = (c - 8) / 4;
+        return (std::size_t(128) << g) + ((c - 8) % 4 + 1) * (32 << g);
+    }
+    //spans allocated so far
+    std::size_t Spans() const { return spans_.load(); }
+private:
+    struct Block {
+        Block* next;
+    };
+    struct SpanHeader {
+        std::uint32_t sizeClass;
+    };
+    struct FreeList {
+        Block* head = nullptr;
+        std::size_t count = 0;
+    };
+    struct Batch {
+        Block* head;
+        std::size_t count;
+    };
+    struct Depot {
+        std::mutex mutex;
+        std::vector< Batch > batches;
+    };
+    struct ThreadCache {
+        explicit ThreadCache(bool& exited) : exited(exited) {}
+        ~ThreadCache() {
+            for(int c = 0; c != NUM_CLASSES; ++c)
+                if(lists[c].count)
+                    Instance().Flush(lists[c], c, lists[c].count);
+            exited = true;
+        }
+        FreeList lists[NUM_CLASSES];
+        bool& exited;
+    };
+    static const std::uint32_t LARGE = std::numeric_limits<
+                                           std::uint32_t >::max();
+    //span header size, multiple of ALIGNMENT
+    static const std::size_t HEADER = 64;
+    SizeClassPool() {
+        int c = 0;
+        for(std::size_t i = 0; i != sizeof(classOf_); ++i) {
+            while(ClassSize(c) < i * ALIGNMENT) ++c;
+            classOf_[i] = std::uint8_t(c);
+        }
+        for(c = 0; c != NUM_CLASSES; ++c) {
+            const std::size_t b = 16384 / ClassSize(c);
+            batch_[c] = b < 4 ? 4 : b > 128 ? 128 : b;
+        }
+    }
+    //free lists of the calling thread, nullptr after its cache is destroyed
+    static FreeList* Lists() {
+        thread_local bool exited = false;
+        if(exited) return nullptr;
+        thread_local ThreadCache cache(exited);
+        return cache.lists;
+    }
+    static const SpanHeader* Span(const void* p) {
+        return reinterpret_cast< const SpanHeader* >(
+                   reinterpret_cast< std::uintptr_t >(p)
+                   & ~std::uintptr_t(SPAN_SIZE - 1));
+    }
+    static void* AllocateSpan(std::size_t bytes) {
+        void* p = nullptr;
+        if(posix_memalign(&p, SPAN_SIZE, bytes) != 0) throw std::bad_alloc();
+        return p;
+    }
+    void* AllocateLarge(std::size_t bytes) {
+        if(bytes > std::numeric_limits< std::size_t >::max() - HEADER)
+            throw std::bad_alloc();
+        char* s = static_cast< char* >(AllocateSpan(HEADER + bytes));
+        reinterpret_cast< SpanHeader* >(s)->sizeClass = LARGE;
+        return s + HEADER;
+    }
+    void* AllocateUncached(int c) {
+        FreeList l;
+        Refill(l, c);
+        Block* b = l.head;
+        l.head = b->next;
+        if(--l.count) Flush(l, c, l.count);
+        return b;
+    }
+    //l is empty: one batch from the depot, or a new span split into
+    //batches, the first one to l, the others to the depot
+    void Refill(FreeList& l, int c) {
+        Depot& d = depots_[c];
+        {
+            std::lock_guard< std::mutex > lock(d.mutex);
+            if(!d.batches.empty()) {
+                l.head = d.batches.back().head;
+                l.count = d.batches.back().count;
+                d.batches.pop_back();
+                return;
+            }
+        }
+        char* s = static_cast< char* >(AllocateSpan(SPAN_SIZE));
+        spans_.fetch_add(1, std::memory_order_relaxed);
+        reinterpret_cast< SpanHeader* >(s)->sizeClass = std::uint32_t(c);
+        const std::size_t size = ClassSize(c);
+        const std::size_t n = (SPAN_SIZE - HEADER) / size;
+        std::vector< Batch > batches;
+        for(std::size_t i = 0; i < n; i += batch_[c]) {
+            const std::size_t count = std::min(batch_[c], n - i);
+            Block* head = reinterpret_cast< Block* >(s + HEADER + i * size);
+            Block* b = head;
+            for(std::size_t j = 1; j != count; ++j) {
+                b->next = reinterpret_cast< Block* >(
+                              reinterpret_cast< char* >(b) + size);
+                b = b->next;
+            }
+            b->next = nullptr;
+            batches.push_back(Batch{head, count});
+        }
+        l.head = batches.front().head;
+        l.count = batches.front().count;
+        std::lock_guard< std::mutex > lock(d.mutex);
+        d.batches.insert(d.batches.end(), batches.begin() + 1,
+                         batches.end());
+    }
+    //move the first n blocks of l to the depot
+    void Flush(FreeList& l, int c, std::size_t n) {
+        Block* head = l.head;
+        Block* tail = head;
+        for(std::size_t i = 1; i != n; ++i) tail = tail->next;
+        l.head = tail->next;
+        l.count -= n;
+        tail->next = nullptr;
+        Depot& d = depots_[c];
+        std::lock_guard< std::mutex > lock(d.mutex);
+        d.batches.push_back(Batch{head, n});
+    }
+private:
+    std::uint8_t classOf_[MAX_SMALL / ALIGNMENT + 1];
+    std::size_t batch_[NUM_CLASSES];
+    Depot depots_[NUM_CLASSES];
+    std::atomic< std::size_t > spans_{0};
+};
+
+//stateless allocator on SizeClassPool::Instance()
+template < typename T >
+class PoolAllocator {
+    static_assert(alignof(T) <= SizeClassPool::ALIGNMENT,
+                  "Unsupported alignment");
+public:
+    //required
+    using value_type = T;
+    T* allocate(std::size_t n) {
+        if(n > std::numeric_limits< std::size_t >::max() / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast< T* >(
+                   SizeClassPool::Instance().Allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t) noexcept {
+        SizeClassPool::Instance().Deallocate(p);
+    }
+    //optional
+    using is_always_equal = std::true_type;
+    PoolAllocator() noexcept {}
+    template < typename U >
+    PoolAllocator(const PoolAllocator< U >&) noexcept {}
+};
+
+template < typename T, typename U >
+bool operator==(const PoolAllocator< T >&, const PoolAllocator< U >&) {
+    return true;
+}
+
+template < typename T, typename U >
+bool operator!=(const PoolAllocator< T >&, const PoolAllocator< U >&) {
+    return false;
+}
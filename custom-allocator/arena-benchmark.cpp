@@ -0,0 +1,106 @@
+//
+// Author: Ugo Varetto
+//
+// Build-then-discard workload: each request builds a vector, a map of
+// strings and a vector of strings, then discards them. std::allocator
+// against MonotonicArena as an allocator template and, with C++17, as
+// a std::pmr::memory_resource, and std::pmr::monotonic_buffer_resource.
+//
+// g++ -std=c++17 -O3 arena-benchmark.cpp
+// a.out [requests, default = 20000]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MonotonicArena.h"
+
+using namespace std;
+
+//containers of one request, all allocated through alloc rebound to the
+//element types; returns a checksum
+template < typename AllocT >
+size_t Request(const AllocT& alloc, int seed) {
+    using Traits = allocator_traits< AllocT >;
+    using IntAlloc = typename Traits::template rebind_alloc< int >;
+    using CharAlloc = typename Traits::template rebind_alloc< char >;
+    using String = basic_string< char, char_traits< char >, CharAlloc >;
+    using StringAlloc = typename Traits::template rebind_alloc< String >;
+    using PairAlloc = typename Traits::template rebind_alloc<
+                          pair< const int, String > >;
+    vector< int, IntAlloc > v((IntAlloc(alloc)));
+    for(int i = 0; i != 1000; ++i) v.push_back(i ^ seed);
+    map< int, String, less< int >, PairAlloc > m((less< int >()),
+                                                 PairAlloc(alloc));
+    vector< String, StringAlloc > s((StringAlloc(alloc)));
+    for(int i = 0; i != 100; ++i) {
+        String t("a string longer than the small buffer ",
+                 CharAlloc(alloc));
+        t += char('a' + v[i] % 26);
+        s.push_back(t);
+        m.emplace(v[i], std::move(t));
+    }
+    return v.back() + m.size() + s.back().size();
+}
+
+//printed, so that the requests are not optimized away
+size_t checksum_g = 0;
+
+//ns per request
+double Time(const function< size_t (int) >& request, int requests) {
+    const auto start = chrono::steady_clock::now();
+    for(int r = 0; r != requests; ++r) checksum_g += request(r);
+    const double t = chrono::duration< double, nano >(
+                         chrono::steady_clock::now() - start).count();
+    return t / requests;
+}
+
+int main(int argc, char** argv) {
+    const int requests = argc > 1 ? atoi(argv[1]) : 20000;
+    if(requests < 1) {
+        cout << "usage: " << argv[0] << " [requests]" << endl;
+        return EXIT_FAILURE;
+    }
+    //initial buffer of all the arenas, used by one benchmark at a time
+    alignas(alignof(max_align_t)) static char buffer[1 << 16];
+    MonotonicArena arena(buffer, sizeof(buffer));
+    const pair< const char*, double > results[] = {
+        {"std::allocator", Time([](int r) {
+            return Request(allocator< char >(), r);
+        }, requests)},
+        {"ArenaAllocator", Time([&arena](int r) {
+            const size_t c = Request(ArenaAllocator< char >(arena), r);
+            arena.Reset();
+            return c;
+        }, requests)},
+#ifdef MONOTONIC_ARENA_PMR
+        {"MonotonicResource", Time([](int r) {
+            static MonotonicResource resource(buffer, sizeof(buffer));
+            const size_t c = Request(
+                pmr::polymorphic_allocator< char >(&resource), r);
+            resource.Reset();
+            return c;
+        }, requests)},
+        {"pmr::monotonic", Time([](int r) {
+            static pmr::monotonic_buffer_resource resource(
+                buffer, sizeof(buffer));
+            const size_t c = Request(
+                pmr::polymorphic_allocator< char >(&resource), r);
+            resource.release();
+            return c;
+        }, requests)},
+#endif
+    };
+    cout << "ns per request (" << requests << " requests):\n";
+    for(auto& r: results)
+        cout << "  " << r.first << ": " << r.second << '\n';
+    cout << "checksum: " << checksum_g << endl;
+    return 0;
+}
@@ -6,6 +6,7 @@
 
 
 #include <cstddef> //std::size_t
+#include <limits>  //std::numeric_limits
 #include <memory>  //std::allocator
 #include <stdexcept>
 
@@ -97,10 +98,24 @@ struct MinimalAllocator {
     }
 };
 
+//required
+template < typename T, typename U >
+bool operator==(const MinimalAllocator< T >&, const MinimalAllocator< U >&) {
+    return true;
+}
+
+template < typename T, typename U >
+bool operator!=(const MinimalAllocator< T >&, const MinimalAllocator< U >&) {
+    return false;
+}
+
 
+#include <map>
 #include <string>
 #include <vector>
 
+#include "InstrumentedAllocator.h"
+
 using namespace std;
 
 int main(int, char **) {
@@ -186,6 +201,23 @@ int main(int, char **) {
 //            allocator::deallocate(4)
 //            allocator::deallocate(4)
 
+    //instrumented allocator: counters instead of tracing, wraps any
+    //allocator, the map samples one call stack every 10 allocations
+    {
+        AllocStats vstats("vector<int>");
+        AllocStats mstats("map<int, string>", 10);
+        using VAlloc = InstrumentedAllocator< int >;
+        using MAlloc = InstrumentedAllocator< pair< const int, string > >;
+        vector< int, VAlloc > v((VAlloc(vstats)));
+        map< int, string, less< int >, MAlloc > m((less< int >()),
+                                                  MAlloc(mstats));
+        for(int i = 0; i != 1000; ++i) {
+            v.push_back(i);
+            m[i] = to_string(i);
+        }
+        cout << "\n";
+        AllocStats::ReportAll(cout, 1);
+    }
 
     return 0;
 }
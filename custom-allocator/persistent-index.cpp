@@ -0,0 +1,128 @@
+//
+// Author: Ugo Varetto
+//
+// Prebuilt index in a memory mapped file: built once, then mapped read-only
+// by several worker processes at different addresses; the time to open the
+// index does not depend on its size.
+//
+// g++ -std=c++11 -O3 persistent-index.cpp
+// a.out [file, default = INDEX] [elements, default = 4Mi] [workers,
+// default = 4]
+//
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <sys/wait.h>
+
+#include "PersistentContainers.h"
+
+//root object: id -> position in values
+struct Index {
+    explicit Index(const MMapRegion& region)
+        : values(OffsetAllocator< double >(region)), ids(region) {}
+    PersistentVector< double > values;
+    PersistentHashMap< std::uint64_t, std::uint64_t > ids;
+};
+
+using namespace std;
+
+uint64_t Id(uint64_t i) { return StableHash< uint64_t >()(i + 1); }
+
+double Seconds(chrono::steady_clock::time_point start) {
+    return chrono::duration< double >(chrono::steady_clock::now() - start)
+           .count();
+}
+
+void Build(const string& fpath, size_t n) {
+    const auto start = chrono::steady_clock::now();
+    MMapRegion region(fpath);
+    Index* index = region.MakeRoot< Index >(region);
+    index->values.reserve(n);
+    index->ids.Reserve(n);
+    for(size_t i = 0; i != n; ++i) {
+        index->values.push_back(0.5 * double(i));
+        index->ids.Insert(Id(i), i);
+    }
+    //erase and re-insert a few ids
+    for(size_t i = 0; i < n; i += 97) index->ids.Erase(Id(i));
+    for(size_t i = 0; i < n; i += 97) index->ids.Insert(Id(i), i);
+    region.Close();
+    cout << "Built index of " << n << " elements in " << Seconds(start)
+         << " s" << endl;
+}
+
+//random lookups, verified; returns false on error
+bool Query(const string& fpath, size_t n, int worker) {
+    auto start = chrono::steady_clock::now();
+    const MMapRegion region(fpath, MMapMode::READ_ONLY, 0, false);
+    const Index* index = region.Root< Index >();
+    const double topen = Seconds(start);
+    if(index->ids.Size() != n || index->values.size() != n) return false;
+    //first pass: page faults, second pass: mapped pages
+    double tquery[2];
+    const size_t lookups = 1 << 20;
+    for(int pass = 0; pass != 2; ++pass) {
+        mt19937_64 rng(worker);
+        start = chrono::steady_clock::now();
+        for(size_t l = 0; l != lookups; ++l) {
+            const uint64_t i = rng() % n;
+            const uint64_t* p = index->ids.Find(Id(i));
+            if(!p || *p != i || index->values.data()[*p] != 0.5 * double(i))
+                return false;
+        }
+        tquery[pass] = Seconds(start);
+    }
+    cout << "Worker " << worker << ": mapped at "
+         << static_cast< void* >(region.Base()) << ", open "
+         << topen * 1E6 << " us, M lookups/s: cold "
+         << lookups / tquery[0] / 1E6 << ", warm "
+         << lookups / tquery[1] / 1E6 << endl;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const string fpath = argc > 1 ? argv[1] : "INDEX";
+    const size_t n = argc > 2 ? size_t(atoll(argv[2])) : size_t(1) << 22;
+    const int workers = argc > 3 ? atoi(argv[3]) : 4;
+    if(n < 1 || workers < 1) {
+        cout << "usage: " << argv[0] << " [file] [elements] [workers]"
+             << endl;
+        return EXIT_FAILURE;
+    }
+    try {
+        Build(fpath, n);
+        for(int w = 0; w != workers; ++w) {
+            if(fork() == 0) {
+                //different mapping addresses in each worker
+                volatile char* shift = new char[(w + 1) << 20];
+                shift[0] = 0;
+                bool ok = false;
+                try {
+                    ok = Query(fpath, n, w);
+                } catch(const exception& e) {
+                    cerr << "ERROR: " << e.what() << endl;
+                }
+                _exit(ok ? 0 : 1);
+            }
+        }
+        int failed = 0;
+        for(int w = 0; w != workers; ++w) {
+            int status = 0;
+            wait(&status);
+            failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+        if(failed) {
+            cerr << "ERROR: " << failed << " worker(s) failed" << endl;
+            return EXIT_FAILURE;
+        }
+    } catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
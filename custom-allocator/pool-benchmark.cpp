@@ -0,0 +1,106 @@
+//
+// Author: Ugo Varetto
+//
+// Node based containers (list, map, unordered_map) with std::allocator and
+// PoolAllocator, run by 1 to N threads at once; the nodes of each list are
+// freed by another thread.
+//
+// g++ -std=c++11 -O3 -pthread pool-benchmark.cpp
+// a.out [elements per thread, default = 200000] [max threads, default = 4]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "PoolAllocator.h"
+
+using namespace std;
+
+//containers allocated through alloc rebound to their node types, the list
+//is returned to be freed by the caller; returns a checksum
+template < typename AllocT >
+size_t Work(const AllocT& alloc, int n, int seed,
+            list< int, AllocT >& out) {
+    using PairAlloc = typename allocator_traits< AllocT >::
+                      template rebind_alloc< pair< const int, int > >;
+    map< int, int, less< int >, PairAlloc > m((less< int >()),
+                                               PairAlloc(alloc));
+    unordered_map< int, int, hash< int >, equal_to< int >, PairAlloc > h(
+        16, hash< int >(), equal_to< int >(), PairAlloc(alloc));
+    list< int, AllocT > l(alloc);
+    unsigned x = unsigned(seed) + 1;
+    for(int i = 0; i != n; ++i) {
+        x = x * 1664525u + 1013904223u;
+        const int k = int(x >> 8);
+        m[k] = i;
+        h[k] = i;
+        l.push_back(k);
+    }
+    size_t c = 0;
+    for(int k: l) {
+        if(k & 1) {
+            m.erase(k);
+            h.erase(k);
+        } else {
+            c += size_t(m[k] + h[k]);
+        }
+    }
+    out.swap(l);
+    return c + m.size() + h.size();
+}
+
+//printed, so that the work is not optimized away
+size_t checksum_g = 0;
+
+//ms, threads run f at once; thread t frees the list of thread t + 1
+template < typename AllocT >
+double Time(int n, int threads) {
+    vector< list< int, AllocT > > lists(threads);
+    vector< size_t > checksums(threads);
+    vector< thread > workers;
+    const auto start = chrono::steady_clock::now();
+    for(int t = 0; t != threads; ++t) {
+        workers.push_back(thread([&, t]() {
+            checksums[t] = Work(AllocT(), n, t, lists[t]);
+        }));
+    }
+    for(auto& w: workers) w.join();
+    workers.clear();
+    for(int t = 0; t != threads; ++t) {
+        workers.push_back(thread([&, t]() {
+            lists[(t + 1) % threads].clear();
+        }));
+    }
+    for(auto& w: workers) w.join();
+    const double ms = chrono::duration< double, milli >(
+                          chrono::steady_clock::now() - start).count();
+    for(size_t c: checksums) checksum_g += c;
+    return ms;
+}
+
+int main(int argc, char** argv) {
+    const int n = argc > 1 ? atoi(argv[1]) : 200000;
+    const int maxThreads = argc > 2 ? atoi(argv[2]) : 4;
+    if(n < 1 || maxThreads < 1) {
+        cout << "usage: " << argv[0] << " [elements] [max threads]" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "ms, " << n << " elements per thread:\n";
+    for(int t = 1; t <= maxThreads; t *= 2) {
+        cout << "  " << t << " thread(s): std::allocator "
+             << Time< allocator< int > >(n, t) << ", PoolAllocator "
+             << Time< PoolAllocator< int > >(n, t) << '\n';
+    }
+    cout << "spans: " << SizeClassPool::Instance().Spans()
+         << ", checksum: " << checksum_g << endl;
+    return 0;
+}
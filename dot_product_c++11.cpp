@@ -1,211 +1,1219 @@
 //Author: Ugo Varetto
 //dot product with C++11: faster than OpenCL! on SandyBridge Xeons
 //with g++4.8.1 -std=c++ -O3 -pthread
-//-DBLOCK enables block dot version (slower!),
-//-DUSE_AVX enables block+avx(fastest)
-//enable avx as needed by adding -mavx2 when -DUSE_AVX defined
-//launch with: 
-//a.out 268435456 64 (256 Mi doubles, 64 threads!) non-avx version
-//a.out 268435456 16 (256 Mi doubles, 32 threads!) avx version
+//
+//The kernels are in blas_kernels.h: SIMD kernels (SSE2, AVX2 + FMA, AVX-512)
+//are compiled through target attributes and the fastest one supported by the
+//CPU is selected at run-time: no -mavx/-mavx2 flag is required and the same
+//binary runs on any x86-64; set the DOT_ISA environment variable to scalar,
+//sse2, avx2 or avx512 to force a specific kernel (the detected instruction
+//set is an upper bound)
+//
+//g++ -std=c++11 -O3 -pthread dot_product_c++11.cpp
+//g++ -std=c++11 -O3 -pthread -DDOT_SINGLE_PRECISION dot_product_c++11.cpp
+//(real_t = float)
+//
+//launch with:
+//a.out 268435456 64 16384 stl (256 Mi doubles, 64 threads!) inner_product
+//a.out 268435456 16 (256 Mi doubles, 16 threads!) simd kernels
+//a.out 268435456 auto (settings from the auto-tuner, tuned on first use)
+//a.out tune (sweep methods, thread counts and block sizes, save the best)
+//a.out write x.bin 1073741824 (1 Gi random values, native binary format)
+//a.out files x.bin y.bin 16 (mmap and O_DIRECT input, see mapped_input.h)
+//a.out bench 1 (bandwidth of all methods from L1 to DRAM resident sizes)
+//a.out accuracy 4194304 1 (error and bandwidth of the summation modes)
+//a.out blas 1 (roofline: bandwidth and flop rate of the BLAS kernels)
+//a.out mixed 16777216 1 (float, fp16, bf16 inputs: error and throughput)
+//a.out batch 1 1048576 128 8 (8 queries against 1Mi candidates of 128)
+//a.out topk 1 1048576 128 10 (10 best of 1Mi candidates of 128)
+//
+//Methods: stl = std::inner_product; block = copy each block into a private
+//buffer then SIMD kernel (doubles the memory traffic); simd = SIMD kernel
+//reading the input in place; stream, stream_nt = simd + software prefetch,
+//regular or non-temporal
+//
+//dot() runs on a persistent thread pool (reduce_pool_t) through
+//parallel_reduce_chunks: the partial results are combined in a fixed tree
+//order, the result is the same at each call for a fixed number of threads;
+//dot_async is the original version launching threads with std::async
+//
+//dot(N, X, Y, nt, sum_mode_t) selects the summation mode: naive, pairwise,
+//kahan or dot2 (compensated), see sum_mode_t
+//
+//The best settings differ between machines and kernels (e.g. 64 threads for
+//the stl method vs 16 for the simd kernels above): "tune" measures them and
+//stores the best configuration in $HOME/.dot_config (DOT_CONFIG environment
+//variable), "auto" in place of the number of threads loads it
 //Note: with 256Mi doubles the avx code is also faster than the CUDA
 //version running on a K20x
 
-#if __cplusplus < 201103L
-#error "C++ 11 required"
-#endif
-#ifdef USE_AVX
-#include <immintrin.h>
-#include <mm_malloc.h>
-#endif
-#include <thread>
+#include "blas_kernels.h"
+#include "mapped_input.h"
 #include <future>
-#include <algorithm>
 #include <iostream>
 #include <chrono>
-#include <numeric>
-#include <cassert>
 #include <vector>
-#include <cstring> //memcpy
-#include <exception>
+#include <random>
+#include <string>
+#include <cmath>
+#include <iomanip>
+#include <fstream>
+#include <utility>
 
+#ifdef DOT_SINGLE_PRECISION
+typedef float real_t;
+#else
 typedef double real_t;
-const double EPS = 1E-10; //consider making this a relative error dependent
-                          //on the size of the input; it might happen
-                          //that you get errors in the order of 10-5 with
-                          //256Mi positive elements
+#endif
 
 //------------------------------------------------------------------------------
 real_t time_diff_ms(
     const std::chrono::time_point< std::chrono::steady_clock >& s,
     const std::chrono::time_point< std::chrono::steady_clock >& e) {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(e-s).count();  
+    return std::chrono::duration_cast<std::chrono::milliseconds>(e-s).count();
 }
 
-#ifndef USE_AVX
-//------------------------------------------------------------------------------
-std::function< real_t () > 
-make_dotblock(int N, const real_t* x, const real_t* y, int block) {
-    //in case the size is not evenly divisible by the block size
-    //we need to allocate additional bytes in the buffers in order
-    //to copy block + N % block elements
-    //
-    //Problem: if you declare the std::vector outside the lambda function
-    //and pass it by value to each closure through [=], declaring
-    //the lambda 'mutable', it is slower than declaring it inside the 
-    //body of the lambda; if you try to pass it by refreence
-    //through [&] you get a segfault
-    //Solution: declare empty vectors and issue a resize inside the lambda
-    //function: this does not make any difference in case the lamda is called
-    //only once as in this case, but when calling it multiple times with the
-    //same data size it does speed up operations because no reallocation is
-    //performed 
-    std::vector< real_t > b1(0);
-    std::vector< real_t > b2(0);
-    return [=]() mutable { 
-        b1.resize(2 * N);
-        b2.resize(2 * N); 
-        real_t d = real_t(0);
-        for(int b = 0; b < N; b += block) {
-             const int bsize = N - b < 2 * block ? N - b : block;
-             std::copy(x + b, x + b + bsize, b1.begin());
-             std::copy(y + b, y + b + bsize, b2.begin());
-             for(int i = 0; i != bsize; ++i) {
-                 d += b1[i] * b2[i];
-             }
-         }
-         return d;
-      }; 
+
+//original version: launches nt threads with std::async at each call
+real_t dot_async(int N, const real_t* X, const real_t* Y, int nt,
+                 int blocksize = 16384,
+                 dot_method_t method = dot_method_t::SIMD) {
+    std::vector< std::future< real_t > > futures;
+    for(int i = 0; i != nt; ++i) {
+        const int off = i * ( N / nt );
+        const int size = i == nt - 1 ? N / nt + N % nt : N / nt;
+        futures.push_back(
+            std::async(std::launch::async, [=]() {
+                           return dot_range(method, size, X + off, Y + off,
+                                            blocksize);
+                       }));
+    }
+    real_t d = real_t(0);
+    std::for_each(futures.begin(), futures.end(),
+                    [&d](std::future< real_t >& f) {
+                        d += f.get();
+                    });
+    return d;
 }
-#else
-#ifndef BLOCK
-#define BLOCK //AVX only supported through dotblock function
-#endif
+
+
 //------------------------------------------------------------------------------
-std::function< real_t () > 
-make_dotblock_avx(int sN, const real_t* x, const real_t* y, int sblock) {
-    //requirement: multiple of 4 doubles
-    assert(sN % 4 == 0);
-    assert(sblock % 4  == 0);
-    const int N = sN / 4;
-    const int block = sblock / 4;
-    //memory is allocated outside of the lambda function and released
-    //when the function is called with cleanup == true
-    //in case the size is not evenly divisible by the block size
-    //we need to allocate additional bytes in the buffers in order
-    //to copy block + N % block elements
-    __m256d* b1 = (__m256d*)_mm_malloc(2 * sN * sizeof(real_t), 32);
-    __m256d* b2 = (__m256d*)_mm_malloc(2 * sN * sizeof(real_t), 32);
-    //note that although we are not declaring the lambda 'mutable' we can
-    //still copy into the buffers since all we need is a pointer to memory
-    //passed by value
-    return [=](bool cleanup = true) { //call with true to release resources
-                                      //stored in closure;
-                                      //disable cleanup when lambda called
-                                      //multiple times with the same data size
-        __m256d d = {0, 0, 0, 0};
-        for(int b = 0; b < N; b += block) {
-            const int bsize = N - b < 2 * block ? N - b : block;
-            memcpy((__m256d*)b1, x + b, bsize * sizeof(real_t));
-            memcpy((__m256d*)b2, y + b, bsize * sizeof(real_t));
-            for(int i = 0; i != bsize; ++i) {
-                d = _mm256_add_pd(_mm256_mul_pd(b1[i], b2[i]), d);
+//check the kernels of all the supported instruction sets against the scalar
+//version for all the sizes and alignments up to 64 elements
+template < typename T >
+bool check_kernels() {
+    std::vector< T > x(200), y(200);
+    for(std::size_t i = 0; i != x.size(); ++i) {
+        x[i] = T(1) + T(i % 7) / T(8);
+        y[i] = T(2) - T(i % 5) / T(4);
+    }
+    const isa_t isas[] = {isa_t::SSE2, isa_t::AVX2, isa_t::AVX512};
+    for(isa_t isa: isas) {
+        if(isa > detect_isa()) break;
+        const dot_kernel_t< T > kernels[] = {
+            select_dot_kernel< T >(isa),
+            select_dot_kernel< T, PREFETCH_BYTES, 0 >(isa)
+        };
+        for(dot_kernel_t< T > k: kernels) {
+            for(std::size_t off = 0; off != 16; ++off) {
+                for(std::size_t n = 0; n != 64; ++n) {
+                    const T r = dot_scalar(n, &x[off], &y[off + 1]);
+                    const T d = k(n, &x[off], &y[off + 1]);
+                    if(std::abs(d - r) > T(1E-5) * std::abs(r)) return false;
+                }
             }
         }
-        if(cleanup) {
-          _mm_free(b1);
-          _mm_free(b2);
-          return real_t(0);
+    }
+    return true;
+}
+
+//parallel_reduce must match std::accumulate for any number of threads and
+//dot must return the same value when called twice with the same input
+bool check_reduce() {
+    std::vector< long > v(1000);
+    std::iota(v.begin(), v.end(), 1);
+    std::vector< real_t > x(100003, real_t(0.1));
+    for(int nt = 1; nt != 9; ++nt) {
+        for(std::size_t n: {std::size_t(0), std::size_t(1), std::size_t(5),
+                            v.size()}) {
+            if(parallel_reduce(v.begin(), v.begin() + n, 7L,
+                               std::plus< long >(), nt)
+               != std::accumulate(v.begin(), v.begin() + n, 7L))
+                return false;
+        }
+        if(dot(int(x.size()), &x[0], &x[0], nt)
+           != dot(int(x.size()), &x[0], &x[0], nt))
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+//bandwidth of each method for sizes from L1 resident to DRAM resident: each
+//dot product is repeated until at least 256 MiB have been read; with one
+//thread the methods are invoked directly, with more threads through dot()
+void benchmark(int nt, int maxsize, int blocksize) {
+    const dot_method_t methods[] = {dot_method_t::STL, dot_method_t::BLOCK,
+                                    dot_method_t::SIMD, dot_method_t::STREAM,
+                                    dot_method_t::STREAM_NT};
+    std::cout << "Bandwidth (GB/s), " << nt << " thread(s), "
+              << "last level cache " << (llc_size() >> 10) << " KiB\n"
+              << std::setw(10) << "size" << std::setw(10) << "KiB";
+    for(dot_method_t m: methods) std::cout << std::setw(10) << method_name(m);
+    std::cout << std::endl;
+    std::vector< real_t > a(maxsize, real_t(1));
+    std::vector< real_t > b(maxsize, real_t(2));
+    volatile real_t sink = real_t(0);
+    for(int n = 1024; n <= maxsize; n *= 4) {
+        const std::size_t bytes = 2 * std::size_t(n) * sizeof(real_t);
+        const std::size_t reps =
+            std::max(std::size_t(3), (std::size_t(256) << 20) / bytes);
+        std::cout << std::setw(10) << n << std::setw(10) << (bytes >> 10);
+        for(dot_method_t m: methods) {
+            auto run = [&]() {
+                return nt == 1 ? dot_range(m, n, &a[0], &b[0], blocksize)
+                               : dot(n, &a[0], &b[0], nt, blocksize, m);
+            };
+            sink = sink + run(); //warm up
+            const auto s = std::chrono::steady_clock::now();
+            for(std::size_t r = 0; r != reps; ++r) sink = sink + run();
+            const auto e = std::chrono::steady_clock::now();
+            const double secs = std::chrono::duration< double >(e - s).count();
+            std::cout << std::setw(10) << std::fixed << std::setprecision(2)
+                      << bytes * reps / secs / 1E9;
+        }
+        std::cout << std::endl;
+    }
+    if(nt == 1) return;
+    //per call overhead: thread creation with std::async vs persistent pool
+    std::cout << "\nTime per call (us), " << nt << " threads, simd\n"
+              << std::setw(10) << "size" << std::setw(10) << "async"
+              << std::setw(10) << "pool" << std::endl;
+    for(int n = 1024; n <= std::min(maxsize, 1 << 22); n *= 4) {
+        std::cout << std::setw(10) << n;
+        for(int p = 0; p != 2; ++p) {
+            const int reps = 200;
+            const auto s = std::chrono::steady_clock::now();
+            for(int r = 0; r != reps; ++r) {
+                sink = sink + (p ? dot(n, &a[0], &b[0], nt)
+                                 : dot_async(n, &a[0], &b[0], nt));
+            }
+            const auto e = std::chrono::steady_clock::now();
+            std::cout << std::setw(10) << std::fixed << std::setprecision(2)
+                      << std::chrono::duration< double, std::micro >(e - s)
+                         .count() / reps;
         }
-        return d[0] + d[1] + d[2] + d[3];
-    }; 
+        std::cout << std::endl;
+    }
 }
-#endif
+
 //------------------------------------------------------------------------------
-real_t dot(int N, const real_t* X, const real_t* Y, int nt,
-           int blocksize = 16384) {
-    std::vector< std::future< real_t > > futures;
-    for(int i = 0; i != nt; ++i) {
-        const int off = i * ( N / nt );
-        const int size = i == nt - 1 ? N / nt + N % nt : N / nt;
-        futures.push_back(
-            std::async(std::launch::async,
-#ifdef BLOCK 
-#ifdef USE_AVX                       
-                       make_dotblock_avx(size, X + off, Y + off, blocksize)));
+//accuracy: errors are measured against a reference computed in a wider type,
+//in which the products of two real_t values are exact
+#ifdef __SIZEOF_FLOAT128__
+typedef __float128 wide_t;
 #else
-                       make_dotblock(size, X + off, Y + off, blocksize)));
-#endif        
-#else           
-                       [X, Y, off, size]() {     
-                           return std::inner_product(X + off, X + off + size,
-                                                     Y + off, real_t(0));
-                       }));                                 
+typedef long double wide_t;
 #endif
-    }                
-    real_t d = real_t(0); 
-    std::for_each(futures.begin(), futures.end(),
-                    [&d](std::future< real_t >& f) {                   
-                        d += f.get();  
-                    });
+
+template < typename T >
+wide_t dot_reference(std::size_t n, const T* x, const T* y) {
+    wide_t d = 0;
+    for(std::size_t i = 0; i != n; ++i) d += wide_t(x[i]) * wide_t(y[i]);
     return d;
 }
+
+template < typename T >
+double relative_error(T d, wide_t ref) {
+    const wide_t e = (wide_t(d) - ref) / ref;
+    return double(e < 0 ? -e : e);
+}
+
+//positive values in [1, 2): condition number 1
+template < typename T >
+void well_conditioned(std::vector< T >& x, std::vector< T >& y,
+                      std::default_random_engine& rng) {
+    std::uniform_real_distribution< T > dist(1, 2);
+    for(auto& v: x) v = dist(rng);
+    for(auto& v: y) v = dist(rng);
+}
+
+//first half: random signs and magnitudes in [2^-20, 2^20); second half: same
+//x, y negated and perturbed by a relative amount < 2^-20, last element zero
+//for odd sizes: the products almost cancel, the exact result is many orders
+//of magnitude smaller than sum |x_i y_i|
+template < typename T >
+void ill_conditioned(std::vector< T >& x, std::vector< T >& y,
+                     std::default_random_engine& rng) {
+    std::uniform_real_distribution< T > mantissa(1, 2);
+    std::uniform_int_distribution< int > exponent(-20, 19);
+    std::uniform_int_distribution< int > sign(0, 1);
+    std::uniform_real_distribution< T > perturbation(-1, 1);
+    auto value = [&]() {
+        const T v = std::ldexp(mantissa(rng), exponent(rng));
+        return sign(rng) ? v : -v;
+    };
+    const std::size_t h = x.size() / 2;
+    for(std::size_t i = 0; i != h; ++i) {
+        x[i] = x[h + i] = value();
+        y[i] = value();
+        y[h + i] = -y[i] * (1 + std::ldexp(perturbation(rng), -20));
+    }
+    if(x.size() % 2) x.back() = y.back() = 0;
+}
+
+//sum |x_i y_i| / |x.y|
+template < typename T >
+double condition_number(const std::vector< T >& x, const std::vector< T >& y,
+                        wide_t ref) {
+    wide_t a = 0;
+    for(std::size_t i = 0; i != x.size(); ++i)
+        a += wide_t(std::abs(x[i])) * wide_t(std::abs(y[i]));
+    return double(a / (ref < 0 ? -ref : ref));
+}
+
+//relative error and bandwidth of each summation mode on well and
+//ill-conditioned data
+void accuracy_report(int nt, int n) {
+    const sum_mode_t modes[] = {sum_mode_t::NAIVE, sum_mode_t::PAIRWISE,
+                                sum_mode_t::KAHAN, sum_mode_t::DOT2};
+    std::vector< real_t > x(n), y(n);
+    std::default_random_engine rng(12345);
+    const std::size_t bytes = 2 * std::size_t(n) * sizeof(real_t);
+    const std::size_t reps =
+        std::max(std::size_t(3), (std::size_t(256) << 20) / bytes);
+    std::cout << "Summation modes, " << n << " elements, " << nt
+              << " thread(s), naive error bound "
+              << std::scientific << std::setprecision(2)
+              << dot_error_bound< real_t >(n) << " x cond\n";
+    volatile real_t sink = real_t(0);
+    for(int c = 0; c != 2; ++c) {
+        if(c) ill_conditioned(x, y, rng);
+        else well_conditioned(x, y, rng);
+        const wide_t ref = dot_reference(x.size(), &x[0], &y[0]);
+        std::cout << '\n' << (c ? "ill-conditioned" : "well-conditioned")
+                  << ", cond = " << std::scientific << std::setprecision(2)
+                  << condition_number(x, y, ref) << '\n'
+                  << std::setw(10) << "mode" << std::setw(14) << "rel. error"
+                  << std::setw(10) << "GB/s" << '\n';
+        for(sum_mode_t m: modes) {
+            const real_t d = dot(n, &x[0], &y[0], nt, m);
+            const auto s = std::chrono::steady_clock::now();
+            for(std::size_t r = 0; r != reps; ++r)
+                sink = sink + dot(n, &x[0], &y[0], nt, m);
+            const auto e = std::chrono::steady_clock::now();
+            const double secs = std::chrono::duration< double >(e - s).count();
+            std::cout << std::setw(10) << sum_mode_name(m)
+                      << std::setw(14) << std::scientific
+                      << std::setprecision(2) << relative_error(d, ref)
+                      << std::setw(10) << std::fixed << std::setprecision(2)
+                      << bytes * reps / secs / 1E9 << '\n';
+        }
+    }
+    std::cout << std::flush;
+}
+
+//the compensated kernels of all the supported instruction sets must be
+//accurate to a few ulps for all the sizes up to 100 and any alignment; in
+//parallel, dot2 must stay accurate on ill-conditioned data
+template < typename T >
+bool check_sum_modes() {
+    std::default_random_engine rng(7);
+    std::vector< T > x(120), y(120);
+    well_conditioned(x, y, rng);
+    const double tol = 8 * std::numeric_limits< T >::epsilon();
+    const isa_t isas[] = {isa_t::SCALAR, isa_t::SSE2, isa_t::AVX2,
+                          isa_t::AVX512};
+    for(isa_t isa: isas) {
+        if(isa > detect_isa()) break;
+        const sum_kernel_t< T > kernels[] = {
+            select_sum_kernel< T >(isa, sum_mode_t::KAHAN),
+            select_sum_kernel< T >(isa, sum_mode_t::DOT2)
+        };
+        for(sum_kernel_t< T > k: kernels) {
+            for(std::size_t off = 0; off != 8; ++off) {
+                for(std::size_t n = 1; n != 100; ++n) {
+                    const wide_t r = dot_reference(n, &x[off], &y[off + 1]);
+                    if(relative_error(k(n, &x[off], &y[off + 1]).value(), r)
+                       > tol)
+                        return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool check_sum_modes() {
+    if(!check_sum_modes< double >() || !check_sum_modes< float >())
+        return false;
+    std::default_random_engine rng(11);
+    std::vector< real_t > x(100003), y(100003);
+    ill_conditioned(x, y, rng);
+    const wide_t ref = dot_reference(x.size(), &x[0], &y[0]);
+    //dot2 bound: u + gamma_n^2 cond
+    const double g = dot_error_bound< real_t >(x.size());
+    const double tol = 8 * std::numeric_limits< real_t >::epsilon()
+                       + 2 * g * g * condition_number(x, y, ref);
+    for(int nt = 1; nt != 5; ++nt) {
+        if(relative_error(dot(int(x.size()), &x[0], &y[0], nt,
+                              sum_mode_t::DOT2), ref) > tol)
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+//BLAS kernels: the parallel versions of all the supported instruction sets
+//must match straightforward loops
+template < typename T >
+bool check_blas() {
+    std::default_random_engine rng(3);
+    std::uniform_real_distribution< T > dist(-1, 1);
+    const isa_t isas[] = {isa_t::SCALAR, isa_t::SSE2, isa_t::AVX2,
+                          isa_t::AVX512};
+    const double tol = 16 * std::numeric_limits< T >::epsilon();
+    auto close = [tol](double a, double b) {
+        return std::abs(a - b) <= tol * std::max(1., std::abs(b));
+    };
+    for(int n: {0, 1, 7, 33, 1000, 4099}) {
+        std::vector< T > x(n + 1), y(n + 1);
+        for(auto& v: x) v = dist(rng);
+        for(auto& v: y) v = dist(rng);
+        for(isa_t isa: isas) {
+            if(isa > detect_isa()) break;
+            double as = 0, ss = 0, am = 0;
+            for(int i = 0; i != n; ++i) {
+                as += std::abs(x[i + 1]);
+                ss += double(x[i + 1]) * x[i + 1];
+                am = std::max(am, double(std::abs(x[i + 1])));
+            }
+            //unaligned input
+            const T* px = &x[1];
+            if(!close(isa_kernel_t< asum_kernel_t< T > >::select(isa)(n, px),
+                      as)
+               || !close(isa_kernel_t< sumsq_kernel_t< T > >::select(isa)(
+                             n, T(1), px), ss)
+               || isa_kernel_t< amax_kernel_t< T > >::select(isa)(n, px)
+                  != T(am))
+                return false;
+            std::vector< T > z(y);
+            isa_kernel_t< axpy_kernel_t< T > >::select(isa)(n, T(2), px,
+                                                           &z[1]);
+            for(int i = 0; i != n; ++i)
+                if(z[i + 1] != y[i + 1] + T(2) * x[i + 1]) return false;
+            isa_kernel_t< scal_kernel_t< T > >::select(isa)(n, T(3), &z[1]);
+            for(int i = 0; i != n; ++i)
+                if(z[i + 1] != T(3) * (y[i + 1] + T(2) * x[i + 1]))
+                    return false;
+        }
+        for(int nt = 1; nt != 4; ++nt) {
+            std::vector< T > z(y);
+            axpy(n, T(-1), &x[0], &z[0], nt);
+            scal(n, T(0.5), &z[0], nt);
+            for(int i = 0; i != n; ++i)
+                if(z[i] != T(0.5) * (y[i] - x[i])) return false;
+            double as = 0, ss = 0;
+            for(int i = 0; i != n; ++i) {
+                as += std::abs(x[i]);
+                ss += double(x[i]) * x[i];
+            }
+            if(!close(asum(n, &x[0], nt), as)
+               || !close(nrm2(n, &x[0], nt), std::sqrt(ss)))
+                return false;
+        }
+    }
+    //nrm2 scaling: squares overflow or underflow
+    const T big = std::sqrt(std::numeric_limits< T >::max());
+    const T small = std::sqrt(std::numeric_limits< T >::min()) / 1024;
+    for(T s: {big, small}) {
+        std::vector< T > v(1000, s);
+        if(!close(nrm2(int(v.size()), &v[0], 2) / s, std::sqrt(1000.)))
+            return false;
+    }
+    //gemv: 37 x 29 in a 37 x 32 buffer, beta = 0 must ignore NaNs in y
+    const int m = 37, n = 29, lda = 32;
+    std::vector< T > A(m * lda), x(n), y(m), z(m);
+    for(auto& v: A) v = dist(rng);
+    for(auto& v: x) v = dist(rng);
+    for(auto& v: y) v = dist(rng);
+    for(int nt = 1; nt != 4; ++nt) {
+        for(T beta: {T(0), T(0.5)}) {
+            for(int r = 0; r != m; ++r)
+                z[r] = beta == T(0) ? std::numeric_limits< T >::quiet_NaN()
+                                    : y[r];
+            gemv(m, n, T(2), &A[0], lda, &x[0], beta, &z[0], nt);
+            for(int r = 0; r != m; ++r) {
+                double d = 0;
+                for(int c = 0; c != n; ++c) d += double(A[r * lda + c]) * x[c];
+                if(!close(z[r], 2 * d + (beta == T(0) ? 0 : beta * y[r])))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+//roofline: bytes moved, flops, arithmetic intensity, achieved bandwidth and
+//flop rate of each kernel; the memory ceiling is the best bandwidth achieved
+//by any kernel at the same size, a kernel far below it is not bandwidth bound
+void blas_benchmark(int nt, int n) {
+    std::vector< real_t > x(n, real_t(1)), y(n, real_t(2));
+    const int cols = std::min(n, 1024);
+    const int rows = n / cols;
+    std::vector< real_t > A(std::size_t(rows) * cols, real_t(1)), z(rows);
+    volatile real_t sink = real_t(0);
+    const std::size_t sz = sizeof(real_t);
+    struct kernel_result_t {
+        const char* name;
+        double bytes;
+        double flops;
+        double secs;
+    };
+    auto run = [&](const char* name, double bytes, double flops,
+                   const std::function< void () >& f) {
+        const std::size_t reps =
+            std::max(std::size_t(3), std::size_t((1 << 28) / bytes));
+        f(); //warm up
+        const auto s = std::chrono::steady_clock::now();
+        for(std::size_t r = 0; r != reps; ++r) f();
+        const auto e = std::chrono::steady_clock::now();
+        const double secs = std::chrono::duration< double >(e - s).count();
+        return kernel_result_t{name, bytes, flops, secs / reps};
+    };
+    //axpy and scal with factors that keep the values bounded
+    const kernel_result_t results[] = {
+        run("dot", 2. * n * sz, 2. * n,
+            [&]{ sink = sink + dot(n, &x[0], &y[0], nt); }),
+        run("axpy", 3. * n * sz, 2. * n,
+            [&]{ axpy(n, real_t(0), &x[0], &y[0], nt); }),
+        run("scal", 2. * n * sz, 1. * n,
+            [&]{ scal(n, real_t(1), &y[0], nt); }),
+        run("asum", 1. * n * sz, 1. * n,
+            [&]{ sink = sink + asum(n, &x[0], nt); }),
+        run("nrm2", 1. * n * sz, 2. * n,
+            [&]{ sink = sink + nrm2(n, &x[0], nt); }),
+        run("gemv", (double(rows) * cols + cols + rows) * sz,
+            2. * rows * cols,
+            [&]{ gemv(rows, cols, real_t(1), &A[0], cols, &x[0], real_t(0),
+                      &z[0], nt); })
+    };
+    double ceiling = 0;
+    for(auto& r: results) ceiling = std::max(ceiling, r.bytes / r.secs);
+    std::cout << "Roofline, " << n << " elements (gemv " << rows << " x "
+              << cols << "), " << nt << " thread(s), " << sizeof(real_t) * 8
+              << " bit, " << isa_name(active_isa()) << "\n"
+              << std::setw(8) << "kernel" << std::setw(12) << "flop/byte"
+              << std::setw(10) << "GB/s" << std::setw(10) << "GFLOP/s"
+              << std::setw(12) << "% ceiling" << '\n';
+    for(auto& r: results) {
+        std::cout << std::setw(8) << r.name << std::fixed
+                  << std::setw(12) << std::setprecision(3)
+                  << r.flops / r.bytes << std::setprecision(2)
+                  << std::setw(10) << r.bytes / r.secs / 1E9
+                  << std::setw(10) << r.flops / r.secs / 1E9
+                  << std::setw(12) << std::setprecision(1)
+                  << 100 * r.bytes / r.secs / ceiling << '\n';
+    }
+    std::cout << std::flush;
+}
+
+//------------------------------------------------------------------------------
+//batched dot products: tile kernels of all the supported instruction sets and
+//the parallel versions against the scalar kernel, for all the block
+//remainders and leading dimensions larger than the vector size
+template < typename T >
+bool check_batch() {
+    std::default_random_engine rng(9);
+    std::uniform_real_distribution< T > dist(0.5, 1);
+    const isa_t isas[] = {isa_t::SCALAR, isa_t::SSE2, isa_t::AVX2,
+                          isa_t::AVX512};
+    for(int n: {0, 1, 7, 8, 17, 64, 100}) {
+        const int ldq = n + 3, ldc = n + 5;
+        for(int nq: {1, 2, 3, 5}) {
+            for(int nc: {1, 2, 3, 4, 5, 9, 37}) {
+                const int lds = nc + 2;
+                std::vector< T > Q(nq * ldq), C(nc * ldc);
+                for(auto& v: Q) v = dist(rng);
+                for(auto& v: C) v = dist(rng);
+                auto ok = [&](const std::vector< T >& S) {
+                    for(int q = 0; q != nq; ++q) {
+                        for(int c = 0; c != nc; ++c) {
+                            const T r = dot_scalar(n, &Q[q * ldq],
+                                                   &C[c * ldc]);
+                            if(std::abs(S[q * lds + c] - r)
+                               > 2 * dot_error_bound< T >(n) * r)
+                                return false;
+                        }
+                    }
+                    return true;
+                };
+                for(isa_t isa: isas) {
+                    if(isa > detect_isa()) break;
+                    std::vector< T > S(nq * lds);
+                    select_tile_kernel< T >(isa)(nq, nc, n, &Q[0], ldq,
+                                                 &C[0], ldc, &S[0], lds);
+                    if(!ok(S)) return false;
+                }
+                for(int nt = 1; nt != 4; ++nt) {
+                    std::vector< T > S(nq * lds);
+                    dot_tile(nq, nc, n, &Q[0], ldq, &C[0], ldc, &S[0], lds,
+                             nt);
+                    if(!ok(S)) return false;
+                    for(int q = 0; q != nq; ++q)
+                        dot_batch(nc, n, &Q[q * ldq], &C[0], ldc,
+                                  &S[q * lds], nt);
+                    if(!ok(S)) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//seconds per call of f, repeated for at least half a second after a warm up
+//call
+double time_per_call(const std::function< void () >& f) {
+    f();
+    int reps = 0;
+    const auto s = std::chrono::steady_clock::now();
+    auto e = s;
+    do {
+        f();
+        ++reps;
+        e = std::chrono::steady_clock::now();
+    } while(std::chrono::duration< double >(e - s).count() < 0.5);
+    return std::chrono::duration< double >(e - s).count() / reps;
+}
+
+//one query or nq queries against nc candidates of n elements: dot() for
+//each candidate (one pool job per call), the SIMD kernel for each candidate
+//(single thread), dot_batch for each query and dot_tile for all the queries
+void batch_benchmark(int nt, int nc, int n, int nq) {
+    std::vector< real_t > C(std::size_t(nc) * n), Q(std::size_t(nq) * n);
+    std::vector< real_t > S(std::size_t(nq) * nc);
+    std::default_random_engine rng(21);
+    std::uniform_real_distribution< real_t > dist(0, 1);
+    for(auto& v: C) v = dist(rng);
+    for(auto& v: Q) v = dist(rng);
+    const dot_kernel_t< real_t > kernel = dot_kernel< real_t >();
+    //per call overhead: dot() on at most 16Ki candidates, then scaled
+    const int ncall = std::min(nc, 1 << 14);
+    const double tcall = time_per_call([&]{
+        for(int q = 0; q != nq; ++q)
+            for(int c = 0; c != ncall; ++c)
+                S[std::size_t(q) * nc + c] =
+                    dot(n, &Q[std::size_t(q) * n], &C[std::size_t(c) * n], nt);
+        }) * double(nc) / ncall;
+    const double tkernel = time_per_call([&]{
+        for(int q = 0; q != nq; ++q)
+            for(int c = 0; c != nc; ++c)
+                S[std::size_t(q) * nc + c] =
+                    kernel(n, &Q[std::size_t(q) * n], &C[std::size_t(c) * n]);
+        });
+    const double tbatch = time_per_call([&]{
+        for(int q = 0; q != nq; ++q)
+            dot_batch(nc, n, &Q[std::size_t(q) * n], &C[0], n,
+                      &S[std::size_t(q) * nc], nt);
+        });
+    const double ttile = time_per_call([&]{
+        dot_tile(nq, nc, n, &Q[0], n, &C[0], n, &S[0], nc, nt);
+        });
+    std::cout << "Batched dot, " << nq << " queries x " << nc
+              << " candidates of " << n << " elements, " << nt
+              << " thread(s), " << isa_name(active_isa()) << "\n"
+              << std::setw(16) << "method" << std::setw(14) << "Mscores/s"
+              << std::setw(10) << "GFLOP/s" << '\n';
+    const double scores = double(nq) * nc;
+    const std::pair< const char*, double > rows[] = {
+        {"dot() per cand.", tcall}, {"kernel per cand.", tkernel},
+        {"dot_batch", tbatch}, {"dot_tile", ttile}
+    };
+    for(auto& r: rows) {
+        std::cout << std::setw(16) << r.first << std::fixed
+                  << std::setprecision(2) << std::setw(14)
+                  << scores / r.second / 1E6 << std::setw(10)
+                  << 2 * scores * n / r.second / 1E9 << '\n';
+    }
+    std::cout << std::flush;
+}
+
+//------------------------------------------------------------------------------
+//top-k: top_k with and without row norms against sorting all the scores
+//computed by dot_batch, which are the same values: ids and scores must match
+//exactly, for any number of threads, including ties (duplicate rows) and
+//k larger than the number of candidates
+template < typename T >
+bool check_topk() {
+    std::default_random_engine rng(13);
+    std::uniform_real_distribution< T > dist(-1, 1);
+    std::uniform_real_distribution< T > scale(0, 1);
+    for(int n: {1, 8, 33}) {
+        for(int rows: {1, 5, 300, 1000}) {
+            const int ldc = n + 1;
+            std::vector< T > C(rows * ldc), q(n), norms(rows), S(rows);
+            for(int r = 0; r != rows; ++r) {
+                const T s = scale(rng);
+                for(int i = 0; i != n; ++i) C[r * ldc + i] = s * dist(rng);
+            }
+            for(int r = 7; r < rows; r += 7)
+                std::copy(&C[0], &C[n], &C[r * ldc]);
+            for(auto& v: q) v = dist(rng);
+            row_norms(rows, n, &C[0], ldc, &norms[0], 1);
+            dot_batch(rows, n, &q[0], &C[0], ldc, &S[0], 1);
+            std::vector< scored_id_t< T > > ref;
+            for(int r = 0; r != rows; ++r)
+                ref.push_back(scored_id_t< T >{S[r], std::size_t(r)});
+            std::sort(ref.begin(), ref.end(), better< T >);
+            for(int k: {0, 1, 3, 10, rows, rows + 3}) {
+                for(int nt = 1; nt != 5; ++nt) {
+                    const T* with_norms[] = {nullptr, &norms[0]};
+                    for(const T* nr: with_norms) {
+                        const std::vector< scored_id_t< T > > t =
+                            top_k(rows, n, &q[0], &C[0], ldc, k, nt, nr);
+                        if(t.size() != std::min(std::size_t(k), ref.size()))
+                            return false;
+                        for(std::size_t i = 0; i != t.size(); ++i) {
+                            if(t[i].id != ref[i].id
+                               || t[i].score != ref[i].score) return false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//k best of nc candidates of n elements scaled by a random factor in [0, 1):
+//dot_batch into a score array followed by sort or partial_sort, top_k
+//without and with row norms (computed once, not included in the time)
+void topk_benchmark(int nt, int nc, int n, int k) {
+    std::vector< real_t > C(std::size_t(nc) * n), q(n), norms(nc), S(nc);
+    std::default_random_engine rng(23);
+    std::uniform_real_distribution< real_t > dist(-1, 1);
+    std::uniform_real_distribution< real_t > scale(0, 1);
+    for(int r = 0; r != nc; ++r) {
+        const real_t s = scale(rng);
+        for(int i = 0; i != n; ++i) C[std::size_t(r) * n + i] = s * dist(rng);
+    }
+    for(auto& v: q) v = dist(rng);
+    row_norms(nc, n, &C[0], n, &norms[0], nt);
+    std::vector< scored_id_t< real_t > > all(nc), best;
+    auto materialize = [&]() {
+        dot_batch(nc, n, &q[0], &C[0], n, &S[0], nt);
+        for(int r = 0; r != nc; ++r)
+            all[r] = scored_id_t< real_t >{S[r], std::size_t(r)};
+    };
+    const double tsort = time_per_call([&]{
+        materialize();
+        std::sort(all.begin(), all.end(), better< real_t >);
+        });
+    const double tpartial = time_per_call([&]{
+        materialize();
+        std::partial_sort(all.begin(), all.begin() + std::min(k, nc),
+                          all.end(), better< real_t >);
+        });
+    const double ttopk = time_per_call([&]{
+        best = top_k(nc, n, &q[0], &C[0], n, k, nt);
+        });
+    const double tnorms = time_per_call([&]{
+        best = top_k(nc, n, &q[0], &C[0], n, k, nt, &norms[0]);
+        });
+    std::cout << "Top-" << k << " of " << nc << " candidates of " << n
+              << " elements, " << nt << " thread(s), "
+              << isa_name(active_isa()) << "\n"
+              << std::setw(22) << "method" << std::setw(14)
+              << "Mcand./s" << '\n';
+    const std::pair< const char*, double > rows[] = {
+        {"scores + sort", tsort}, {"scores + partial_sort", tpartial},
+        {"top_k", ttopk}, {"top_k + norms", tnorms}
+    };
+    for(auto& r: rows) {
+        std::cout << std::setw(22) << r.first << std::fixed
+                  << std::setprecision(2) << std::setw(14)
+                  << nc / r.second / 1E6 << '\n';
+    }
+    std::cout << "best: id " << best[0].id << ", score " << best[0].score
+              << std::endl;
+}
+
+//------------------------------------------------------------------------------
+//mixed precision
+
+const char* type_name(float) { return "float"; }
+const char* type_name(double) { return "double"; }
+const char* type_name(fp16_t) { return "fp16"; }
+const char* type_name(bf16_t) { return "bf16"; }
+
+//kernels of all the supported instruction sets against a reference computed
+//on the converted values, positive data: error within the naive bound
+template < typename In, typename Acc >
+bool check_mixed_kernels() {
+    std::default_random_engine rng(5);
+    std::uniform_real_distribution< float > dist(0.5f, 1);
+    std::vector< In > x(200), y(200);
+    for(auto& v: x) v = from_float< In >(dist(rng));
+    for(auto& v: y) v = from_float< In >(dist(rng));
+    const isa_t isas[] = {isa_t::SCALAR, isa_t::SSE2, isa_t::AVX2,
+                          isa_t::AVX512};
+    for(isa_t isa: isas) {
+        if(isa > detect_isa()) break;
+        const mixed_kernel_t< In, Acc > k = select_mixed_kernel< In, Acc >(isa);
+        for(std::size_t off = 0; off != 8; ++off) {
+            for(std::size_t n = 1; n != 150; ++n) {
+                wide_t r = 0;
+                for(std::size_t i = 0; i != n; ++i)
+                    r += wide_t(to_float(x[off + i]))
+                         * wide_t(to_float(y[off + i + 1]));
+                if(relative_error(k(n, &x[off], &y[off + 1]), r)
+                   > 2 * dot_error_bound< Acc >(n))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+//conversions: round to nearest even, overflow, subnormals; the vector
+//conversions (F16C, AVX-512) must match the scalar ones for all the 2^16
+//values, and float -> 16 bit -> float must be exact for all of them
+bool check_mixed() {
+    if(to_fp16(1 + std::ldexp(1.f, -11)).bits != 0x3c00
+       || to_fp16(1 + 3 * std::ldexp(1.f, -11)).bits != 0x3c02
+       || to_fp16(65519.f).bits != 0x7bff || to_fp16(65520.f).bits != 0x7c00
+       || to_fp16(std::ldexp(1.f, -25)).bits != 0
+       || to_fp16(3 * std::ldexp(1.f, -25)).bits != 0x0002
+       || to_fp16(-std::numeric_limits< float >::infinity()).bits != 0xfc00
+       || to_bf16(1 + std::ldexp(1.f, -8)).bits != 0x3f80
+       || to_bf16(1 + 3 * std::ldexp(1.f, -8)).bits != 0x3f82)
+        return false;
+    std::vector< fp16_t > h(64, fp16_t{0});
+    std::vector< bf16_t > b(64, bf16_t{0});
+    const std::vector< fp16_t > hone(64, to_fp16(1));
+    const std::vector< bf16_t > bone(64, to_bf16(1));
+    const isa_t isas[] = {isa_t::AVX2, isa_t::AVX512};
+    for(std::uint32_t u = 0; u != 0x10000; ++u) {
+        h[0].bits = b[0].bits = std::uint16_t(u);
+        const float fh = to_float(h[0]);
+        const float fb = to_float(b[0]);
+        if(fh == fh && to_fp16(fh).bits != u) return false;
+        if(fb == fb && to_bf16(fb).bits != u) return false;
+        for(isa_t isa: isas) {
+            if(isa > detect_isa()) break;
+            const float vh =
+                select_mixed_kernel< fp16_t, float >(isa)(64, &h[0], &hone[0]);
+            const float vb =
+                select_mixed_kernel< bf16_t, float >(isa)(64, &b[0], &bone[0]);
+            if((vh != fh && (fh == fh || vh == vh))
+               || (vb != fb && (fb == fb || vb == vb)))
+                return false;
+        }
+    }
+    return check_mixed_kernels< float, float >()
+           && check_mixed_kernels< float, double >()
+           && check_mixed_kernels< fp16_t, float >()
+           && check_mixed_kernels< fp16_t, double >()
+           && check_mixed_kernels< bf16_t, float >()
+           && check_mixed_kernels< bf16_t, double >();
+}
+
+//double precision data to storage type and back
+template < typename T >
+T to_storage(double v) { return from_float< T >(float(v)); }
+
+template <>
+double to_storage< double >(double v) { return v; }
+
+template < typename T >
+double stored_value(T v) { return to_float(v); }
+
+double stored_value(double v) { return v; }
+
+//double < double > is the regular dot product, the baseline
+template < typename In, typename Acc >
+Acc mixed_dot(int n, const In* x, const In* y, int nt) {
+    return dot< In, Acc >(n, x, y, nt);
+}
+
+template <>
+double mixed_dot< double, double >(int n, const double* x, const double* y,
+                                   int nt) {
+    return dot(n, x, y, nt);
+}
+
+//accumulation error: against the exact dot product of the stored values;
+//total error: against the exact dot product of the double precision data,
+//includes the rounding of the data to the storage type
+template < typename In, typename Acc >
+void mixed_report_row(int nt, const std::vector< double >& a,
+                      const std::vector< double >& b, wide_t exact) {
+    const int n = int(a.size());
+    std::vector< In > x(n), y(n);
+    wide_t stored = 0;
+    for(int i = 0; i != n; ++i) {
+        x[i] = to_storage< In >(a[i]);
+        y[i] = to_storage< In >(b[i]);
+        stored += wide_t(stored_value(x[i])) * wide_t(stored_value(y[i]));
+    }
+    const Acc d = mixed_dot< In, Acc >(n, &x[0], &y[0], nt);
+    const std::size_t bytes = 2 * std::size_t(n) * sizeof(In);
+    const std::size_t reps =
+        std::max(std::size_t(3), (std::size_t(256) << 20) / bytes);
+    volatile Acc sink = Acc(0);
+    const auto s = std::chrono::steady_clock::now();
+    for(std::size_t r = 0; r != reps; ++r)
+        sink = sink + mixed_dot< In, Acc >(n, &x[0], &y[0], nt);
+    const auto e = std::chrono::steady_clock::now();
+    const double secs = std::chrono::duration< double >(e - s).count();
+    std::cout << std::setw(8) << type_name(In()) << std::setw(8)
+              << type_name(Acc()) << std::setw(8) << sizeof(In)
+              << std::scientific << std::setprecision(2)
+              << std::setw(12) << relative_error(d, stored)
+              << std::setw(12) << relative_error(d, exact)
+              << std::fixed << std::setw(10) << bytes * reps / secs / 1E9
+              << std::setw(10) << n * reps / secs / 1E9 << '\n';
+}
+
+void mixed_report(int nt, int n) {
+    std::vector< double > a(n), b(n);
+    std::default_random_engine rng(17);
+    std::uniform_real_distribution< double > dist(0, 1);
+    for(auto& v: a) v = dist(rng);
+    for(auto& v: b) v = dist(rng);
+    const wide_t exact = dot_reference(a.size(), &a[0], &b[0]);
+    std::cout << "Mixed precision dot, " << n << " elements, " << nt
+              << " thread(s), " << isa_name(active_isa()) << "\n"
+              << std::setw(8) << "input" << std::setw(8) << "acc"
+              << std::setw(8) << "bytes" << std::setw(12) << "acc. error"
+              << std::setw(12) << "total error" << std::setw(10) << "GB/s"
+              << std::setw(10) << "Gelem/s" << '\n';
+    mixed_report_row< double, double >(nt, a, b, exact);
+    mixed_report_row< float, float >(nt, a, b, exact);
+    mixed_report_row< float, double >(nt, a, b, exact);
+    mixed_report_row< fp16_t, float >(nt, a, b, exact);
+    mixed_report_row< fp16_t, double >(nt, a, b, exact);
+    mixed_report_row< bf16_t, float >(nt, a, b, exact);
+    mixed_report_row< bf16_t, double >(nt, a, b, exact);
+    std::cout << std::flush;
+}
+
+//------------------------------------------------------------------------------
+//file input: binary files of real_t values, larger than memory
+
+//n values in [1, 2) written in blocks of 1Mi
+void write_values(const std::string& path, std::size_t n, unsigned seed) {
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    std::default_random_engine rng(seed);
+    std::uniform_real_distribution< real_t > dist(1, 2);
+    std::vector< real_t > block(1 << 20);
+    for(std::size_t i = 0; i < n && os; i += block.size()) {
+        const std::size_t count = std::min(block.size(), n - i);
+        for(std::size_t j = 0; j != count; ++j) block[j] = dist(rng);
+        os.write(reinterpret_cast< const char* >(block.data()),
+                 std::streamsize(count * sizeof(real_t)));
+    }
+    if(!os.flush()) throw std::runtime_error("Cannot write " + path);
+}
+
+//dot_mapped and dot_direct on the same files; the first pass over the
+//mapped files may be served from the page cache if the files were written
+//or read recently, O_DIRECT always reads from the device
+void file_report(const std::string& xpath, const std::string& ypath,
+                 int nt) {
+    typedef std::chrono::steady_clock clock_type;
+    auto seconds = [](clock_type::time_point s) {
+        return std::chrono::duration< double >(clock_type::now() - s)
+               .count();
+    };
+    const mapped_file_t x(xpath), y(ypath);
+    const double bytes = double(x.size()) + double(y.size());
+    auto s = clock_type::now();
+    const real_t dm = dot_mapped< real_t >(x, y, nt);
+    const double tm = seconds(s);
+    bool direct = false;
+    s = clock_type::now();
+    const real_t dd = dot_direct< real_t >(xpath, ypath, nt, direct);
+    const double td = seconds(s);
+    std::cout << "Dot product of " << x.size() / sizeof(real_t)
+              << " values, " << nt << " thread(s)\n" << std::setw(10)
+              << "input" << std::setw(24) << "result" << std::setw(10)
+              << "GB/s" << '\n' << std::setprecision(16)
+              << std::setw(10) << "mmap" << std::setw(24) << dm
+              << std::fixed << std::setprecision(2) << std::setw(10)
+              << bytes / tm / 1E9 << '\n' << std::defaultfloat
+              << std::setprecision(16) << std::setw(10)
+              << (direct ? "O_DIRECT" : "read") << std::setw(24) << dd
+              << std::fixed << std::setprecision(2) << std::setw(10)
+              << bytes / td / 1E9 << std::endl;
+    if(!direct)
+        std::cout << "O_DIRECT not supported, files read through the page"
+                  << " cache" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+//auto-tuning: bandwidth of each configuration, best one saved to path
+void tune(std::size_t n, double seconds, const std::string& path) {
+    std::cout << "Auto-tuning dot(), " << isa_name(active_isa()) << ", "
+              << std::thread::hardware_concurrency() << " core(s), L1/L2/L3 "
+              << cache_size(1) / 1024 << '/' << cache_size(2) / 1024 << '/'
+              << cache_size(3) / 1024 << " KiB\n"
+              << std::setw(10) << "method" << std::setw(9) << "threads"
+              << std::setw(11) << "block" << std::setw(9) << "GB/s"
+              << std::endl;
+    const dot_config_t best = autotune_dot< real_t >(n, seconds,
+        [](const dot_config_t& c) {
+            std::cout << std::setw(10) << method_name(c.method)
+                      << std::setw(9) << c.nt << std::setw(11);
+            if(c.method == dot_method_t::BLOCK) std::cout << c.blocksize;
+            else std::cout << '-';
+            std::cout << std::fixed << std::setprecision(2) << std::setw(9)
+                      << c.gbs << std::endl;
+        });
+    save_dot_config< real_t >(best, path);
+    std::cout << "Best: " << method_name(best.method) << ", " << best.nt
+              << " thread(s), block size " << best.blocksize << ", "
+              << best.gbs << " GB/s, saved to " << path << std::endl;
+}
+
 //------------------------------------------------------------------------------
 int main (int argc, char** argv) {
 
-  if(argc < 3 || atoi(argv[1]) < 1 || atoi(argv[2]) < 1) {
-      std::cout << "usage: " << argv[0] 
-                << " <size> <number of threads>"
-#ifndef BLOCK     
-                << " [block size, default = 16384]"               
-#endif
+  if(argc > 1 && std::string(argv[1]) == "bench") {
+      const int nt = argc > 2 ? atoi(argv[2]) : 1;
+      const int maxsize = argc > 3 ? atoi(argv[3]) : 1 << 24;
+      const int blocksize = argc > 4 ? atoi(argv[4]) : 16384;
+      if(nt < 1 || maxsize < 1 || blocksize < 1) {
+          std::cout << "Invalid benchmark parameters" << std::endl;
+          return 0;
+      }
+      benchmark(nt, maxsize, blocksize);
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "blas") {
+      const int nt = argc > 2 ? atoi(argv[2]) : 1;
+      const int n = argc > 3 ? atoi(argv[3]) : 1 << 24;
+      if(nt < 1 || n < 1) {
+          std::cout << "Invalid benchmark parameters" << std::endl;
+          return 0;
+      }
+      //cache resident, then the requested size
+      blas_benchmark(nt, std::min(n, 1 << 12));
+      std::cout << '\n';
+      blas_benchmark(nt, n);
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "batch") {
+      const int nt = argc > 2 ? atoi(argv[2]) : 1;
+      const int nc = argc > 3 ? atoi(argv[3]) : 1 << 20;
+      const int n = argc > 4 ? atoi(argv[4]) : 128;
+      const int nq = argc > 5 ? atoi(argv[5]) : 8;
+      if(nt < 1 || nc < 1 || n < 1 || nq < 1) {
+          std::cout << "Invalid batch parameters" << std::endl;
+          return 0;
+      }
+      batch_benchmark(nt, nc, n, nq);
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "topk") {
+      const int nt = argc > 2 ? atoi(argv[2]) : 1;
+      const int nc = argc > 3 ? atoi(argv[3]) : 1 << 20;
+      const int n = argc > 4 ? atoi(argv[4]) : 128;
+      const int k = argc > 5 ? atoi(argv[5]) : 10;
+      if(nt < 1 || nc < 1 || n < 1 || k < 1) {
+          std::cout << "Invalid top-k parameters" << std::endl;
+          return 0;
+      }
+      topk_benchmark(nt, nc, n, k);
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "mixed") {
+      const int n = argc > 2 ? atoi(argv[2]) : 1 << 24;
+      const int nt = argc > 3 ? atoi(argv[3]) : 1;
+      if(n < 1 || nt < 1) {
+          std::cout << "Invalid mixed precision parameters" << std::endl;
+          return 0;
+      }
+      mixed_report(nt, n);
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "write") {
+      const long long n = argc > 3 ? atoll(argv[3]) : 0;
+      if(n < 1) {
+          std::cout << "Invalid write parameters" << std::endl;
+          return 0;
+      }
+      try {
+          write_values(argv[2], std::size_t(n),
+                       argc > 4 ? unsigned(atoi(argv[4])) : 1);
+      } catch(const std::exception& e) {
+          std::cerr << "ERROR: " << e.what() << std::endl;
+          return EXIT_FAILURE;
+      }
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "files") {
+      const int nt = argc > 4 ? atoi(argv[4]) : 1;
+      if(argc < 4 || nt < 1) {
+          std::cout << "Invalid file parameters" << std::endl;
+          return 0;
+      }
+      try {
+          file_report(argv[2], argv[3], nt);
+      } catch(const std::exception& e) {
+          std::cerr << "ERROR: " << e.what() << std::endl;
+          return EXIT_FAILURE;
+      }
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "tune") {
+      const long n = argc > 2 ? atol(argv[2]) : 0;
+      const double seconds = argc > 3 ? atof(argv[3]) : 0.05;
+      if(n < 0 || seconds <= 0) {
+          std::cout << "Invalid tuning parameters" << std::endl;
+          return 0;
+      }
+      try {
+          tune(std::size_t(n), seconds,
+               argc > 4 ? argv[4] : dot_config_path());
+      } catch(const std::exception& e) {
+          std::cerr << "ERROR: " << e.what() << std::endl;
+          return EXIT_FAILURE;
+      }
+      return 0;
+  }
+
+  if(argc > 1 && std::string(argv[1]) == "accuracy") {
+      const int n = argc > 2 ? atoi(argv[2]) : 1 << 22;
+      const int nt = argc > 3 ? atoi(argv[3]) : 1;
+      if(n < 2 || nt < 1) {
+          std::cout << "Invalid accuracy parameters" << std::endl;
+          return 0;
+      }
+      accuracy_report(nt, n);
+      return 0;
+  }
+
+  const bool tuned = argc > 2 && std::string(argv[2]) == "auto";
+  if(argc < 3 || atoi(argv[1]) < 1 || (!tuned && atoi(argv[2]) < 1)) {
+      std::cout << "usage: " << argv[0]
+                << " <size> <number of threads | auto>"
+                << " [block size, default = 16384]"
+                << " [method: simd (default), stream, stream_nt, block,"
+                << " stl]\n"
+                << "       " << argv[0] << " bench [number of threads,"
+                << " default = 1] [max size, default = 16Mi]"
+                << " [block size, default = 16384]\n"
+                << "       " << argv[0] << " accuracy [size, default = 4Mi]"
+                << " [number of threads, default = 1]\n"
+                << "       " << argv[0] << " blas [number of threads,"
+                << " default = 1] [size, default = 16Mi]\n"
+                << "       " << argv[0] << " mixed [size, default = 16Mi]"
+                << " [number of threads, default = 1]\n"
+                << "       " << argv[0] << " batch [number of threads,"
+                << " default = 1] [candidates, default = 1Mi]"
+                << " [size, default = 128] [queries, default = 8]\n"
+                << "       " << argv[0] << " topk [number of threads,"
+                << " default = 1] [candidates, default = 1Mi]"
+                << " [size, default = 128] [k, default = 10]\n"
+                << "       " << argv[0] << " tune [size, default = 2 x"
+                << " LLC] [seconds per configuration, default = 0.05]"
+                << " [file, default = $HOME/.dot_config]\n"
+                << "       " << argv[0] << " write <file> <size> [seed,"
+                << " default = 1]\n"
+                << "       " << argv[0] << " files <file x> <file y>"
+                << " [number of threads, default = 1]"
                 << std::endl;
       return 0;
   }
-  
-  std::cout << std::thread::hardware_concurrency() 
-            << " concurrent threads are supported.\n\n";
+
+  std::cout << std::thread::hardware_concurrency()
+            << " concurrent threads are supported.\n"
+            << "Instruction set: " << isa_name(active_isa()) << " (detected "
+            << isa_name(detect_isa()) << ")\n\n";
+
+  if(!check_kernels< double >() || !check_kernels< float >()) {
+      std::cerr << "ERROR: SIMD kernel check failed" << std::endl;
+      return EXIT_FAILURE;
+  }
+  if(!check_reduce()) {
+      std::cerr << "ERROR: parallel reduction check failed" << std::endl;
+      return EXIT_FAILURE;
+  }
+  if(!check_sum_modes()) {
+      std::cerr << "ERROR: summation mode check failed" << std::endl;
+      return EXIT_FAILURE;
+  }
+  if(!check_blas< double >() || !check_blas< float >()) {
+      std::cerr << "ERROR: BLAS kernel check failed" << std::endl;
+      return EXIT_FAILURE;
+  }
+  if(!check_batch< double >() || !check_batch< float >()) {
+      std::cerr << "ERROR: batched dot check failed" << std::endl;
+      return EXIT_FAILURE;
+  }
+  if(!check_topk< double >() || !check_topk< float >()) {
+      std::cerr << "ERROR: top-k check failed" << std::endl;
+      return EXIT_FAILURE;
+  }
+  if(!check_mixed()) {
+      std::cerr << "ERROR: mixed precision check failed" << std::endl;
+      return EXIT_FAILURE;
+  }
 
   const int N = atoi(argv[1]);//e.g. 1024 * 1024 * 256;
-  int blocksize = 16384;
-  if(argc > 3) blocksize = atoi(argv[3]);
-#ifdef USE_AVX
-  if(sizeof(real_t) != sizeof(double)) {
-      std::cout << "real_t must be declared as 'double' when "
-                   "-DUSE_AVX specified" << std::endl;
-      return 0;               
-  }
-  if(N % 4 != 0) {
-      std::cout << "Invalid input:\n"
-                "\tsize must be evenly divisible by 4 When compiled "
-                "with -DUSE_AVX"
-                << std::endl;
+  //auto: tuned configuration, block size and method can be overridden
+  dot_config_t config;
+  if(tuned) config = dot_config< real_t >();
+  else config.nt = atoi(argv[2]);
+  if(argc > 3) config.blocksize = atoi(argv[3]);
+  if(config.blocksize < 1) {
+      std::cout << "Invalid block size" << std::endl;
       return 0;
   }
-#endif
-  try {            
+  if(argc > 4 && !parse_method(argv[4], config.method)) {
+      std::cout << "Invalid method " << argv[4] << std::endl;
+      return 0;
+  }
+  if(tuned) {
+      std::cout << "Configuration: " << method_name(config.method) << ", "
+                << config.nt << " thread(s), block size "
+                << config.blocksize << std::endl;
+  }
+  try {
       std::vector< real_t > a(N);
       std::vector< real_t > b(N);
-      std::default_random_engine rng(std::random_device{}()); 
+      std::default_random_engine rng(std::random_device{}());
       std::uniform_real_distribution< real_t > dist(1, 2);
       std::generate(a.begin(), a.end(), [&dist, &rng]{return dist(rng);});
       std::generate(b.begin(), b.end(), [&dist, &rng]{return dist(rng);});
       //result falls in [256Mi, 4 x 256Mi]
-      const real_t result = 
+      const real_t result =
         std::inner_product(a.begin(), a.end(), b.begin(), real_t(0));
       std::chrono::time_point< std::chrono::steady_clock > s, e;
       s = std::chrono::steady_clock::now();
-      const real_t dotres = dot(N, &a[0], &b[0], atoi(argv[2]), blocksize);
+      const real_t dotres = dot(N, &a[0], &b[0], config);
       e = std::chrono::steady_clock::now();
-      if(std::abs(dotres - result > EPS))
-          std::cerr << "ERROR: " << "got " << dotres << " instead of " 
-                    << result << " difference = " << (dotres - result) 
+      //positive data: both results are within the naive error bound
+      if(std::abs(dotres - result)
+         > 2 * dot_error_bound< real_t >(N) * std::abs(result))
+          std::cerr << "ERROR: " << "got " << dotres << " instead of "
+                    << result << " difference = " << (dotres - result)
                     << std::endl;
       else
           std::cout << "PASSED" << std::endl;
       std::cout << "Time: " << time_diff_ms(s, e) << "ms" << std::endl;
   } catch(const std::exception& e) {
       std::cerr << "ERROR: " << e.what() << std::endl;
-      return EXIT_FAILURE;  
-  }    
+      return EXIT_FAILURE;
+  }
   return 0;
 }
@@ -0,0 +1,378 @@
+//Author: Ugo Varetto
+//Adaptive thread pool: the number of workers grows when the queue depth or
+//the time spent by tasks in the queue crosses a threshold and shrinks when
+//workers stay idle longer than a timeout; no stop-the-world Restart needed.
+//Idle workers spin for a while before parking on a condition variable to
+//reduce the wake-up latency of bursty loads
+//gcc >= 4.8 or clang llvm >= 3.2 with libc++ required
+//
+//do specify -pthread when compiling if not you'll get a run-time error
+//g++ executor-adaptive.cpp -std=c++11 -pthread -O3
+//
+//the program submits bursts of tasks separated by idle periods and reports
+//the number of workers and the enqueue to start latency with and without
+//spinning;
+//run with -h for info on usage options
+//
+//Worker states:
+// running -> spinning: queue empty, poll the queue spincount times
+// spinning -> parked: still no work, wait on the condition variable with
+//                     timeout = idle timeout
+// parked -> retired: timeout expired and number of workers > min threads
+
+#include <iostream>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <list>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cstdlib> //EXIT_*
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> //_mm_pause
+#endif
+#include "RingQueue.h"
+
+typedef std::chrono::steady_clock Clock;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+//------------------------------------------------------------------------------
+//interface and base class for callable objects
+struct ICaller {
+    virtual void Invoke() = 0;
+    virtual ~ICaller() {}
+};
+
+template < typename ResultType >
+class Caller : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F&& f, Args...args) :
+        f_(std::bind(std::forward<F>(f),
+                     std::forward<Args>(args)...)) {}
+    std::future< ResultType > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            ResultType r = ResultType(f_());
+            p_.set_value(r);
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+private:
+    std::promise< ResultType > p_;
+    std::function< ResultType () > f_;
+};
+
+template <>
+class Caller<void> : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F f, Args...args) : f_(std::bind(f, args...)) {}
+    std::future< void > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            f_();
+            p_.set_value();
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+private:
+    std::promise< void > p_;
+    std::function< void () > f_;
+};
+
+//------------------------------------------------------------------------------
+//pool configuration
+struct PoolConfig {
+    int minThreads = 1;
+    int maxThreads = int(std::thread::hardware_concurrency());
+    //number of empty queue polls before parking, 0 = park immediately
+    int spinCount = 2000;
+    //parked workers exit after being idle for this long
+    Clock::duration idleTimeout = std::chrono::milliseconds(200);
+    //add a worker when the queue holds more than this number of tasks and
+    //no worker is idle
+    std::size_t depthThreshold = 16;
+    //add a worker when a task waited longer than this in the queue
+    Clock::duration waitThreshold = std::chrono::milliseconds(1);
+    std::size_t queueCapacity = 1 << 16;
+};
+
+struct PoolStats {
+    int threads;      //current number of workers
+    int peakThreads;
+    long spawned;     //workers started
+    long retired;     //workers exited because of idle timeout
+    long tasks;       //tasks executed
+    double avgLatencyUs; //average enqueue to start latency
+};
+
+//------------------------------------------------------------------------------
+class AdaptiveExecutor {
+    struct Task {
+        ICaller* caller;
+        Clock::time_point enqueued;
+    };
+    struct Worker {
+        std::thread thread;
+        std::atomic< bool > done{false};
+    };
+    typedef RingQueue< Task > Queue;
+public:
+    AdaptiveExecutor(const PoolConfig& config = PoolConfig())
+        : config_(config), queue_(config.queueCapacity) {
+        if(config_.minThreads < 1 || config_.maxThreads < config_.minThreads)
+            throw std::range_error("Invalid number of threads");
+        for(int t = 0; t != config_.minThreads; ++t) Grow();
+    }
+    AdaptiveExecutor(const AdaptiveExecutor&) = delete;
+    AdaptiveExecutor& operator=(const AdaptiveExecutor&) = delete;
+    //deferred call to f with args parameters
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        if(stop_) throw std::logic_error("No active threads");
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        Caller< ResultType >* c =
+            new Caller< ResultType >(std::forward< F >(f),
+                                     std::forward< Args >(args)...);
+        std::future< ResultType > ft = c->GetFuture();
+        Submit(c);
+        return ft;
+    }
+    int NumThreads() const { return active_.load(); }
+    PoolStats Stats() const {
+        const long tasks = tasks_.load();
+        PoolStats s = {active_.load(), peak_.load(), spawned_.load(),
+                       retired_.load(), tasks,
+                       tasks ? double(latencyNs_.load()) / tasks / 1000 : 0};
+        return s;
+    }
+    //stop and join all threads after all the queued tasks have been
+    //executed
+    void Stop() { //blocking
+        {
+            std::lock_guard< std::mutex > guard(parkMutex_);
+            stop_ = true;
+        }
+        parkCond_.notify_all();
+        while(true) {
+            Workers workers;
+            {
+                std::lock_guard< std::mutex > guard(workersMutex_);
+                workers.swap(workers_);
+            }
+            if(workers.empty()) break;
+            for(auto& w: workers) w->thread.join();
+        }
+    }
+    ~AdaptiveExecutor() { Stop(); }
+private:
+    typedef std::list< std::unique_ptr< Worker > > Workers;
+    void Submit(ICaller* c) {
+        Task t = {c, Clock::now()};
+        queue_.Push(t);
+        //pairs with the fence in Park: either this thread sees the parked
+        //worker or the worker sees the new task
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(parked_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard< std::mutex > guard(parkMutex_);
+            ++signals_;
+            parkCond_.notify_one();
+        } else if(spinning_.load(std::memory_order_relaxed) == 0
+                  && queue_.Size() > config_.depthThreshold) {
+            Grow();
+        }
+    }
+    //add a worker if below the maximum; exited workers are joined here
+    void Grow() {
+        std::lock_guard< std::mutex > guard(workersMutex_);
+        for(auto i = workers_.begin(); i != workers_.end();) {
+            if((*i)->done.load()) {
+                (*i)->thread.join();
+                i = workers_.erase(i);
+            } else ++i;
+        }
+        if(stop_) return;
+        int n = active_.load();
+        do {
+            if(n >= config_.maxThreads) return;
+        } while(!active_.compare_exchange_weak(n, n + 1));
+        int p = peak_.load();
+        while(p < n + 1 && !peak_.compare_exchange_weak(p, n + 1));
+        ++spawned_;
+        workers_.push_back(std::unique_ptr< Worker >(new Worker));
+        Worker* w = workers_.back().get();
+        w->thread = std::thread([this, w]{ Run(w); });
+    }
+    //retire the calling worker if above the minimum
+    bool TryRetire() {
+        int n = active_.load();
+        do {
+            if(n <= config_.minThreads) return false;
+        } while(!active_.compare_exchange_weak(n, n - 1));
+        ++retired_;
+        return true;
+    }
+    void Execute(const Task& t) {
+        const Clock::duration wait = Clock::now() - t.enqueued;
+        latencyNs_ += std::chrono::duration_cast<
+                        std::chrono::nanoseconds >(wait).count();
+        ++tasks_;
+        if(wait > config_.waitThreshold && !queue_.Empty()) Grow();
+        t.caller->Invoke();
+        delete t.caller;
+    }
+    //poll the queue spinCount times
+    bool Spin(Task& t) {
+        spinning_.fetch_add(1, std::memory_order_relaxed);
+        bool found = false;
+        for(int i = 0; i != config_.spinCount && !found; ++i) {
+            found = queue_.TryPop(t);
+            if(!found) cpu_relax();
+        }
+        spinning_.fetch_sub(1, std::memory_order_relaxed);
+        return found;
+    }
+    enum ParkResult { TASK, SIGNALLED, TIMEOUT, STOP };
+    //wait on the condition variable until signalled or idle timeout
+    ParkResult Park(Task& t) {
+        std::unique_lock< std::mutex > lock(parkMutex_);
+        parked_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ParkResult r = TASK;
+        if(!queue_.TryPop(t)) {
+            if(stop_) r = STOP;
+            else if(parkCond_.wait_for(lock, config_.idleTimeout, [this]{
+                        return signals_ > 0 || stop_; })) {
+                if(signals_ > 0) --signals_;
+                r = SIGNALLED;
+            } else r = TIMEOUT;
+        }
+        parked_.fetch_sub(1, std::memory_order_relaxed);
+        return r;
+    }
+    void Run(Worker* w) {
+        Task t;
+        while(true) {
+            if(queue_.TryPop(t) || Spin(t)) {
+                Execute(t);
+                continue;
+            }
+            const ParkResult r = Park(t);
+            if(r == TASK) Execute(t);
+            else if(r == TIMEOUT && TryRetire()) break;
+            else if(r == STOP) {
+                --active_;
+                break;
+            }
+        }
+        w->done = true;
+    }
+private:
+    PoolConfig config_;
+    Queue queue_;
+    Workers workers_;
+    std::mutex workersMutex_;
+    std::mutex parkMutex_;
+    std::condition_variable parkCond_;
+    int signals_ = 0; //pending wake-up signals, guarded by parkMutex_
+    std::atomic< bool > stop_{false};
+    std::atomic< int > parked_{0};
+    std::atomic< int > spinning_{0};
+    std::atomic< int > active_{0};
+    std::atomic< int > peak_{0};
+    std::atomic< long > spawned_{0};
+    std::atomic< long > retired_{0};
+    std::atomic< long > tasks_{0};
+    std::atomic< long > latencyNs_{0};
+};
+
+//------------------------------------------------------------------------------
+void busy_wait_us(int us) {
+    const Clock::time_point end = Clock::now() + std::chrono::microseconds(us);
+    while(Clock::now() < end);
+}
+
+void print_stats(const char* label, const AdaptiveExecutor& exec) {
+    const PoolStats s = exec.Stats();
+    std::cout << "  " << label << ": " << s.threads << " workers (peak "
+              << s.peakThreads << ", " << s.spawned << " spawned, "
+              << s.retired << " retired), " << s.tasks << " tasks, "
+              << s.avgLatencyUs << " us average latency\n";
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    try {
+        if(argc > 1 && std::string(argv[1]) == "-h") {
+            std::cout << argv[0] << " [tasks per burst] "
+                                 << "[number of bursts] "
+                                 << "[pause between bursts (ms)] "
+                                 << "[max threads]\n"
+                                 << "default is (200,50,2,"
+                                 << std::thread::hardware_concurrency()
+                                 << ")\n";
+            return 0;
+        }
+        const int burst = argc > 1 ? atoi(argv[1]) : 200;
+        const int bursts = argc > 2 ? atoi(argv[2]) : 50;
+        const int pause_ms = argc > 3 ? atoi(argv[3]) : 2;
+        const int maxthreads = argc > 4 ? atoi(argv[4])
+                               : std::thread::hardware_concurrency();
+        std::cout << "\nRun-time configuration:\n"
+                  << "  " << burst    << " tasks per burst\n"
+                  << "  " << bursts   << " bursts\n"
+                  << "  " << pause_ms << " ms pause\n"
+                  << "  " << maxthreads << " max threads\n"
+                  << std::endl;
+        for(int spin = 0; spin != 2; ++spin) {
+            PoolConfig config;
+            config.maxThreads = maxthreads;
+            config.spinCount = spin ? 20000 : 0;
+            config.idleTimeout = std::chrono::milliseconds(100);
+            AdaptiveExecutor exec(config);
+            std::cout << (spin ? "Spin then park:\n" : "Park immediately:\n");
+            std::vector< std::future< void > > futures;
+            for(int b = 0; b != bursts; ++b) {
+                for(int t = 0; t != burst; ++t)
+                    futures.push_back(exec(busy_wait_us, 10));
+                for(auto& f: futures) f.get();
+                futures.clear();
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(pause_ms));
+            }
+            print_stats("after bursts", exec);
+            //idle: workers retire down to min threads
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            print_stats("after idle  ", exec);
+        }
+        std::cout << std::endl;
+        return 0;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
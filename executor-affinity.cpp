@@ -0,0 +1,484 @@
+//Author: Ugo Varetto
+//NUMA and core affinity aware task executor (Linux only): worker threads are
+//pinned to cores according to an affinity policy and each NUMA node has
+//its own task queue; tasks submitted with a node hint are executed by
+//the workers running on that node
+//gcc >= 4.8 or clang llvm >= 3.2 with libc++ required
+//
+//do specify -pthread when compiling if not you'll get a run-time error
+//g++ executor-affinity.cpp -std=c++11 -pthread -O3
+//
+//the NUMA topology is read from /sys/devices/system/node, no libnuma
+//required; on systems without NUMA information all the cores available to
+//the process are assigned to node 0
+//
+//the program measures the bandwidth of a reduction over buffers allocated
+//on each node when executed by workers on the same node (local) and on a
+//different node (remote); memory is placed through the default first-touch
+//policy by initializing each buffer from a worker pinned on the target node
+//
+//Run with -h for info on usage options
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <deque>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <cctype>
+#include <cstdlib> //EXIT_*
+
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+
+//------------------------------------------------------------------------------
+//synchronized queue, same as the one in executor.cpp
+template < typename T >
+class SyncQueue {
+public:
+    void Push(const T& e) {
+        std::lock_guard< std::mutex > guard(mutex_);
+        queue_.push_front(e);
+        cond_.notify_one();
+    }
+    T Pop() {
+        std::unique_lock< std::mutex > lock(mutex_);
+        cond_.wait(lock, [this]{ return !queue_.empty();});
+        T e = queue_.back();
+        queue_.pop_back();
+        return e;
+    }
+private:
+    std::deque< T > queue_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+//------------------------------------------------------------------------------
+//interface and base class for callable objects
+struct ICaller {
+    virtual bool Empty() const = 0;
+    virtual void Invoke() = 0;
+    virtual ~ICaller() {}
+};
+
+template < typename ResultType >
+class Caller : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F&& f, Args...args) :
+        f_(std::bind(std::forward<F>(f),
+                     std::forward<Args>(args)...)),
+        empty_(false) {}
+    Caller() : empty_(true) {}
+    std::future< ResultType > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            ResultType r = ResultType(f_());
+            p_.set_value(r);
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+    bool Empty() const { return empty_; }
+private:
+    std::promise< ResultType > p_;
+    std::function< ResultType () > f_;
+    bool empty_;
+};
+
+template <>
+class Caller<void> : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F f, Args...args) : f_(std::bind(f, args...)), empty_(false) {}
+    Caller() : empty_(true) {}
+    std::future< void > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            f_();
+            p_.set_value();
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+    bool Empty() const { return empty_; }
+private:
+    std::promise< void > p_;
+    std::function< void () > f_;
+    bool empty_;
+};
+
+//------------------------------------------------------------------------------
+//parse a Linux cpu list e.g. "0-3,8,10-11"
+std::vector< int > parse_cpu_list(const std::string& list) {
+    std::vector< int > cpus;
+    std::istringstream is(list);
+    std::string range;
+    while(std::getline(is, range, ',')) {
+        if(range.empty() || range == "\n") continue;
+        const size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = dash == std::string::npos
+                         ? first : std::stoi(range.substr(dash + 1));
+        for(int c = first; c <= last; ++c) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+//cpus of each NUMA node, restricted to the cpus the process can run on
+class Topology {
+public:
+    Topology() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            throw std::runtime_error("sched_getaffinity failed");
+        std::map< int, std::vector< int > > nodes;
+        if(DIR* d = opendir("/sys/devices/system/node")) {
+            while(dirent* e = readdir(d)) {
+                const std::string name(e->d_name);
+                if(name.compare(0, 4, "node") != 0
+                   || name.size() == 4
+                   || !std::isdigit(name[4])) continue;
+                std::ifstream is("/sys/devices/system/node/" + name
+                                 + "/cpulist");
+                std::string list;
+                std::getline(is, list);
+                std::vector< int > cpus;
+                for(int c: parse_cpu_list(list))
+                    if(CPU_ISSET(c, &allowed)) cpus.push_back(c);
+                if(!cpus.empty()) nodes[std::stoi(name.substr(4))] = cpus;
+            }
+            closedir(d);
+        }
+        if(nodes.empty()) {
+            for(int c = 0; c != CPU_SETSIZE; ++c)
+                if(CPU_ISSET(c, &allowed)) nodes[0].push_back(c);
+        }
+        for(auto& n: nodes) {
+            for(int c: n.second) cpuNode_[c] = int(nodes_.size());
+            nodes_.push_back(n.second);
+        }
+    }
+    int NumNodes() const { return int(nodes_.size()); }
+    const std::vector< int >& NodeCpus(int n) const { return nodes_.at(n); }
+    int CpuNode(int cpu) const {
+        auto i = cpuNode_.find(cpu);
+        if(i == cpuNode_.end())
+            throw std::range_error("CPU " + std::to_string(cpu)
+                                   + " not available");
+        return i->second;
+    }
+private:
+    std::vector< std::vector< int > > nodes_; //node index -> cpus
+    std::map< int, int > cpuNode_;            //cpu -> node index
+};
+
+//------------------------------------------------------------------------------
+//worker placement:
+// - COMPACT: fill all the cores of a node before moving to the next one
+// - SCATTER: round robin across nodes
+// - EXPLICIT: user provided list of cpus, worker i runs on cpus[i % size]
+// - NONE: no pinning, all the workers share the node 0 queue
+struct AffinityPolicy {
+    enum Type { NONE, COMPACT, SCATTER, EXPLICIT };
+    AffinityPolicy(Type t = COMPACT) : type(t) {}
+    AffinityPolicy(const std::vector< int >& c) : type(EXPLICIT), cpus(c) {}
+    Type type;
+    std::vector< int > cpus;
+};
+
+//cpu assigned to each worker according to policy; -1 = not pinned
+std::vector< int > place_workers(const Topology& topo, int numthreads,
+                                 const AffinityPolicy& policy) {
+    std::vector< int > order;
+    switch(policy.type) {
+    case AffinityPolicy::NONE:
+        return std::vector< int >(numthreads, -1);
+    case AffinityPolicy::COMPACT:
+        for(int n = 0; n != topo.NumNodes(); ++n)
+            for(int c: topo.NodeCpus(n)) order.push_back(c);
+        break;
+    case AffinityPolicy::SCATTER: {
+        size_t maxcpus = 0;
+        for(int n = 0; n != topo.NumNodes(); ++n)
+            maxcpus = std::max(maxcpus, topo.NodeCpus(n).size());
+        for(size_t i = 0; i != maxcpus; ++i)
+            for(int n = 0; n != topo.NumNodes(); ++n)
+                if(i < topo.NodeCpus(n).size())
+                    order.push_back(topo.NodeCpus(n)[i]);
+        break;
+    }
+    case AffinityPolicy::EXPLICIT:
+        if(policy.cpus.empty()) throw std::invalid_argument("Empty CPU list");
+        for(int c: policy.cpus) topo.CpuNode(c); //throws if not available
+        order = policy.cpus;
+        break;
+    }
+    std::vector< int > cpus(numthreads);
+    for(int t = 0; t != numthreads; ++t) cpus[t] = order[t % order.size()];
+    return cpus;
+}
+
+void pin_thread(std::thread& t, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const int r = pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+    if(r != 0) throw std::runtime_error("pthread_setaffinity_np failed");
+}
+
+//------------------------------------------------------------------------------
+//node hint passed as the first argument of operator()
+struct NodeHint {
+    explicit NodeHint(int n) : node(n) {}
+    int node;
+};
+
+//task executor with one queue per NUMA node
+class NumaExecutor {
+    typedef SyncQueue< ICaller* > Queue;
+    typedef std::vector< std::thread > Threads;
+public:
+    NumaExecutor(int numthreads = std::thread::hardware_concurrency(),
+                 const AffinityPolicy& policy = AffinityPolicy())
+        : nthreads_(numthreads), policy_(policy) {
+        StartThreads();
+    }
+    NumaExecutor(const NumaExecutor&) = delete;
+    NumaExecutor& operator=(const NumaExecutor&) = delete;
+    //deferred call to f with args parameters, tasks are distributed
+    //round robin among the nodes with at least one worker
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        if(activeNodes_.empty()) throw std::logic_error("No active threads");
+        const int n = activeNodes_[next_++ % activeNodes_.size()];
+        return Submit(n, std::forward< F >(f), args...);
+    }
+    //deferred call to f with args parameters executed by a worker running
+    //on the hinted node
+    template < typename F, typename... Args >
+    auto operator()(NodeHint h, F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        if(h.node < 0 || h.node >= int(queues_.size())
+           || nodeThreads_[h.node] == 0)
+            throw std::range_error("No workers on node "
+                                   + std::to_string(h.node));
+        return Submit(h.node, std::forward< F >(f), args...);
+    }
+    int NumNodes() const { return int(queues_.size()); }
+    //number of workers pinned to a node
+    int NodeThreads(int n) const { return nodeThreads_.at(n); }
+    const Topology& GetTopology() const { return topology_; }
+    //stop and join all threads after all the queued tasks have been executed
+    void Stop() { //blocking
+        for(size_t t = 0; t != threads_.size(); ++t)
+            queues_[workerNode_[t]]->Push(new Caller<void>);
+        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
+                                                            {t.join();});
+        threads_.clear();
+        workerNode_.clear();
+        nodeThreads_.clear();
+        activeNodes_.clear();
+        queues_.clear();
+    }
+    ~NumaExecutor() { Stop(); }
+private:
+    template < typename F, typename... Args >
+    auto Submit(int node, F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        Caller< ResultType >* c =
+            new Caller< ResultType >(std::forward< F >(f),
+                                     std::forward< Args >(args)...);
+        std::future< ResultType > ft = c->GetFuture();
+        queues_[node]->Push(c);
+        return ft;
+    }
+    //one queue per node; with policy NONE a single queue is used
+    void StartThreads() {
+        const std::vector< int > cpus =
+            place_workers(topology_, nthreads_, policy_);
+        const bool pinned = policy_.type != AffinityPolicy::NONE;
+        const int numnodes = pinned ? topology_.NumNodes() : 1;
+        for(int n = 0; n != numnodes; ++n)
+            queues_.push_back(std::unique_ptr< Queue >(new Queue));
+        nodeThreads_.assign(numnodes, 0);
+        //push_back must not throw with a joinable thread
+        threads_.reserve(nthreads_);
+        //on failure join the threads already started: the constructor
+        //throws, the destructor is not called
+        try {
+            StartWorkers(cpus, pinned);
+        } catch(...) {
+            Stop();
+            throw;
+        }
+        for(int n = 0; n != numnodes; ++n)
+            if(nodeThreads_[n] > 0) activeNodes_.push_back(n);
+    }
+    void StartWorkers(const std::vector< int >& cpus, bool pinned) {
+        for(int t = 0; t != nthreads_; ++t) {
+            const int node = pinned ? topology_.CpuNode(cpus[t]) : 0;
+            workerNode_.push_back(node);
+            ++nodeThreads_[node];
+            Queue* q = queues_[node].get();
+            threads_.push_back(std::thread([q] {
+                while(true) {
+                    ICaller* c = q->Pop();
+                    if(c->Empty()) {
+                        delete c;
+                        break;
+                    }
+                    c->Invoke();
+                    delete c;
+                }
+            }));
+            if(pinned) pin_thread(threads_.back(), cpus[t]);
+        }
+    }
+private:
+    int nthreads_;
+    AffinityPolicy policy_;
+    Topology topology_;
+    std::vector< std::unique_ptr< Queue > > queues_; //one per node
+    std::vector< int > workerNode_;
+    std::vector< int > nodeThreads_;
+    std::vector< int > activeNodes_; //nodes with at least one worker
+    std::atomic< unsigned > next_{0};
+    Threads threads_;
+};
+
+//------------------------------------------------------------------------------
+//benchmark: sum a buffer split into one chunk per worker of the executing
+//node; buffer allocated and initialized by the workers of the owning node
+double time_diff_ms(
+    const std::chrono::time_point< std::chrono::steady_clock >& s,
+    const std::chrono::time_point< std::chrono::steady_clock >& e) {
+    return std::chrono::duration< double, std::milli >(e - s).count();
+}
+
+template < typename F >
+void run_on_node(NumaExecutor& exec, int node, size_t size, F f) {
+    const int nt = exec.NodeThreads(node);
+    std::vector< std::future< void > > futures;
+    for(int i = 0; i != nt; ++i) {
+        const size_t b = i * (size / nt);
+        const size_t e = i == nt - 1 ? size : b + size / nt;
+        futures.push_back(exec(NodeHint(node), f, b, e));
+    }
+    for(auto& f: futures) f.get();
+}
+
+double reduce_gbs(NumaExecutor& exec, int node, const double* v, size_t size,
+                  int repetitions) {
+    std::atomic< long > dummy(0);
+    const auto s = std::chrono::steady_clock::now();
+    for(int r = 0; r != repetitions; ++r) {
+        run_on_node(exec, node, size, [v, &dummy](size_t b, size_t e) {
+            dummy += long(std::accumulate(v + b, v + e, 0.));
+        });
+    }
+    const auto e = std::chrono::steady_clock::now();
+    return double(size * sizeof(double)) * repetitions
+           / (time_diff_ms(s, e) * 1E6);
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    try {
+        if(argc > 1 && std::string(argv[1]) == "-h") {
+            std::cout << argv[0] << " [buffer size (doubles)] "
+                                 << "[number of threads] "
+                                 << "[policy: compact|scatter|cpu list] "
+                                 << "[repetitions]\n"
+                                 << "default is (33554432,"
+                                 << std::thread::hardware_concurrency()
+                                 << ",scatter,10)\n";
+            return 0;
+        }
+        const size_t size = argc > 1 ? std::stoul(argv[1]) : 33554432;
+        const int numthreads = argc > 2 ? atoi(argv[2])
+                               : std::thread::hardware_concurrency();
+        AffinityPolicy policy(AffinityPolicy::SCATTER);
+        const std::string p = argc > 3 ? argv[3] : "scatter";
+        if(p == "compact") policy = AffinityPolicy(AffinityPolicy::COMPACT);
+        else if(p != "scatter") policy = AffinityPolicy(parse_cpu_list(p));
+        const int repetitions = argc > 4 ? atoi(argv[4]) : 10;
+        NumaExecutor exec(numthreads, policy);
+        const Topology& topo = exec.GetTopology();
+        std::cout << "\nTopology:\n";
+        for(int n = 0; n != topo.NumNodes(); ++n) {
+            std::cout << "  node " << n << ": " << topo.NodeCpus(n).size()
+                      << " cpus, " << exec.NodeThreads(n) << " workers\n";
+        }
+        std::cout << "\nTesting NumaExecutor...";
+        for(int n = 0; n != exec.NumNodes(); ++n) {
+            if(exec.NodeThreads(n) == 0) continue;
+            const int cpu = exec(NodeHint(n), []{ return sched_getcpu(); })
+                            .get();
+            if(topo.CpuNode(cpu) != n) {
+                std::cerr << "FAILED\n";
+                return EXIT_FAILURE;
+            }
+        }
+        std::cout << "OK\n\n";
+        std::cout << "Reduction bandwidth (GB/s), "
+                  << size * sizeof(double) / (1 << 20) << " MiB per node\n";
+        //first touch: pages are placed on the node of the initializing
+        //thread, new double[] does not initialize the elements and large
+        //blocks are mapped on demand, do not use std::vector
+        std::vector< int > nodes; //nodes with workers
+        for(int n = 0; n != exec.NumNodes(); ++n)
+            if(exec.NodeThreads(n) > 0) nodes.push_back(n);
+        std::vector< std::unique_ptr< double[] > > buffers;
+        for(int n: nodes) {
+            buffers.push_back(std::unique_ptr< double[] >(new double[size]));
+            double* d = buffers.back().get();
+            run_on_node(exec, n, size, [d](size_t b, size_t e) {
+                std::fill(d + b, d + e, 1.);
+            });
+        }
+        for(size_t i = 0; i != nodes.size(); ++i) {
+            const int local = nodes[i];
+            const int remote = nodes[(i + 1) % nodes.size()];
+            std::cout << "  node " << local << " memory - local: "
+                      << reduce_gbs(exec, local, buffers[i].get(), size,
+                                    repetitions);
+            if(remote != local) {
+                std::cout << "  remote (node " << remote << "): "
+                          << reduce_gbs(exec, remote, buffers[i].get(), size,
+                                        repetitions);
+            }
+            std::cout << "\n";
+        }
+        if(nodes.size() == 1)
+            std::cout << "  single node: no remote access\n";
+        std::cout << std::endl;
+        return 0;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
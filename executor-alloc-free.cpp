@@ -0,0 +1,607 @@
+//Author: Ugo Varetto
+//Allocation-free task submission: each call to Executor::operator() in
+//executor.cpp allocates a Caller with new, a std::function holding the
+//std::bind object and the shared state of a std::promise; SlabExecutor
+//constructs the task in place inside a fixed size slot taken from a
+//per-thread slab and the future shares the same slot, in steady state
+//no memory is allocated per task
+//gcc >= 4.8 or clang llvm >= 3.2 with libc++ required
+//
+//do specify -pthread when compiling if not you'll get a run-time error
+//g++ executor-alloc-free.cpp -std=c++11 -pthread -O3
+//
+//the program counts the number of heap allocations per task for the
+//Executor and the SlabExecutor by replacing the global operator new;
+//run with -h for info on usage options
+//
+//Slot layout (SLOT_SIZE bytes):
+// | vtable | ref count | state | slab | result | exception | callable | args |
+// - reference count is 2 at construction: one reference is owned by the
+//   queue/worker and released after the task is invoked, the other is
+//   owned by the Future; the slot is returned to the slab when both have
+//   been released
+// - the slot can be released by any thread: slots released by threads other
+//   than the owner are pushed into a lock-free list which the owner grabs
+//   in one shot when its local free list is empty
+// - tasks that do not fit into a slot are allocated on the heap
+
+#include <iostream>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <deque>
+#include <vector>
+#include <tuple>
+#include <atomic>
+#include <new>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cstddef>
+#include <cstdlib> //EXIT_*
+#include "RingQueue.h"
+
+//------------------------------------------------------------------------------
+//allocation counter: replace global new/delete to count heap allocations
+std::atomic< long > allocationsG{0};
+
+void* operator new(std::size_t size) {
+    allocationsG.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+//------------------------------------------------------------------------------
+//synchronized queue, same as the one in executor.cpp
+template < typename T >
+class SyncQueue {
+public:
+    void Push(const T& e) {
+        std::lock_guard< std::mutex > guard(mutex_);
+        queue_.push_front(e);
+        cond_.notify_one();
+    }
+    T Pop() {
+        std::unique_lock< std::mutex > lock(mutex_);
+        cond_.wait(lock, [this]{ return !queue_.empty();});
+        T e = queue_.back();
+        queue_.pop_back();
+        return e;
+    }
+private:
+    std::deque< T > queue_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+//------------------------------------------------------------------------------
+//interface and base class for callable objects
+struct ICaller {
+    virtual bool Empty() const = 0;
+    virtual void Invoke() = 0;
+    virtual ~ICaller() {}
+};
+
+template < typename ResultType >
+class Caller : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F&& f, Args...args) :
+        f_(std::bind(std::forward<F>(f),
+                     std::forward<Args>(args)...)),
+        empty_(false) {}
+    Caller() : empty_(true) {}
+    std::future< ResultType > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            ResultType r = ResultType(f_());
+            p_.set_value(r);
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+    bool Empty() const { return empty_; }
+private:
+    std::promise< ResultType > p_;
+    std::function< ResultType () > f_;
+    bool empty_;
+};
+
+//------------------------------------------------------------------------------
+//shared queue executor from executor.cpp, used as the benchmark baseline
+class Executor {
+    typedef SyncQueue< ICaller* > Queue;
+    typedef std::vector< std::thread > Threads;
+public:
+    Executor(int numthreads = std::thread::hardware_concurrency())
+        : nthreads_(numthreads) {
+        StartThreads();
+    }
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        if(threads_.empty()) throw std::logic_error("No active threads");
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        Caller< ResultType >* c =
+            new Caller< ResultType >(std::forward< F >(f),
+                                     std::forward< Args >(args)...);
+        std::future< ResultType > ft = c->GetFuture();
+        queue_.Push(c);
+        return ft;
+    }
+    void Stop() { //blocking
+        for(size_t t = 0; t != threads_.size(); ++t)
+            queue_.Push(new Caller<int>);
+        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
+                                                            {t.join();});
+        threads_.clear();
+    }
+    ~Executor() { Stop(); }
+private:
+    void StartThreads() {
+        for(int t = 0; t != nthreads_; ++t) {
+            threads_.push_back(std::move(std::thread( [this] {
+                while(true) {
+                    ICaller* c = queue_.Pop();
+                    if(c->Empty()) {
+                        delete c;
+                        break;
+                    }
+                    c->Invoke();
+                    delete c;
+                }
+            })));
+        }
+    }
+private:
+    int nthreads_;
+    Queue queue_;
+    Threads threads_;
+};
+
+//------------------------------------------------------------------------------
+//per-thread slab of fixed size slots
+class Slab {
+public:
+    enum : std::size_t { SLOT_SIZE = 128, SLOTS_PER_CHUNK = 256 };
+    //slab of the calling thread
+    static Slab& Local() {
+        static thread_local Owner owner;
+        return *owner.slab;
+    }
+    //owner thread only
+    void* Alloc() {
+        if(!free_) free_ = remote_.exchange(nullptr, std::memory_order_acquire);
+        if(!free_) Grow();
+        FreeSlot* s = free_;
+        free_ = s->next;
+        refs_.fetch_add(1, std::memory_order_relaxed);
+        return s;
+    }
+    //any thread
+    void Free(void* p) {
+        FreeSlot* s = static_cast< FreeSlot* >(p);
+        if(Current() == this) {
+            s->next = free_;
+            free_ = s;
+        } else {
+            s->next = remote_.load(std::memory_order_relaxed);
+            while(!remote_.compare_exchange_weak(s->next, s,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+        }
+        Release();
+    }
+    ~Slab() {
+        for(auto c: chunks_) ::operator delete(c);
+    }
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+    //the slab is deleted when the owner thread has exited and all the slots
+    //have been released
+    struct Owner {
+        Owner() : slab(new Slab) { Current() = slab; }
+        ~Owner() {
+            Current() = nullptr;
+            slab->Release();
+        }
+        Slab* slab;
+    };
+    //raw pointer, still valid while thread_local objects are destroyed
+    static Slab*& Current() {
+        static thread_local Slab* slab = nullptr;
+        return slab;
+    }
+    Slab() : free_(nullptr), remote_(nullptr), refs_(1) {}
+    void Release() {
+        if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+    void Grow() {
+        char* c = static_cast< char* >(
+                    ::operator new(SLOT_SIZE * SLOTS_PER_CHUNK));
+        chunks_.push_back(c);
+        for(std::size_t i = 0; i != SLOTS_PER_CHUNK; ++i) {
+            FreeSlot* s = reinterpret_cast< FreeSlot* >(c + i * SLOT_SIZE);
+            s->next = free_;
+            free_ = s;
+        }
+    }
+private:
+    FreeSlot* free_; //owner only
+    std::atomic< FreeSlot* > remote_; //slots released by other threads
+    std::atomic< int > refs_; //owner + allocated slots
+    std::vector< char* > chunks_;
+};
+
+//------------------------------------------------------------------------------
+//wait/notify without allocating per-future synchronization objects:
+//futures waiting for a result block on one of a fixed set of condition
+//variables selected by address
+struct WaitStripe {
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+inline WaitStripe& wait_stripe(const void* p) {
+    enum : std::size_t { NUM_STRIPES = 64 };
+    static WaitStripe stripes[NUM_STRIPES];
+    return stripes[(reinterpret_cast< std::size_t >(p) >> 7) % NUM_STRIPES];
+}
+
+//------------------------------------------------------------------------------
+//task and shared state, constructed in a single slot
+class TaskBase {
+public:
+    virtual void Invoke() = 0;
+    //release one reference, the last one destroys the task and returns
+    //its memory
+    void Release() {
+        if(refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        Slab* slab = slab_;
+        this->~TaskBase();
+        if(slab) slab->Free(this);
+        else ::operator delete(this);
+    }
+    void Wait() {
+        for(int i = 0; i != 64; ++i) {
+            if(state_.load(std::memory_order_acquire) & READY) return;
+            std::this_thread::yield();
+        }
+        WaitStripe& ws = wait_stripe(this);
+        std::unique_lock< std::mutex > lock(ws.mutex);
+        //after setting WAITING either SetReady has already been called or
+        //it will see the flag and notify, it cannot notify before this
+        //thread waits because it needs to acquire the same lock
+        if(state_.fetch_or(WAITING, std::memory_order_acq_rel) & READY) return;
+        ws.cond.wait(lock, [this]{
+            return (state_.load(std::memory_order_acquire) & READY) != 0; });
+    }
+    bool Ready() const {
+        return (state_.load(std::memory_order_acquire) & READY) != 0;
+    }
+    void SetSlab(Slab* s) { slab_ = s; }
+protected:
+    TaskBase() : refs_(2), state_(0), slab_(nullptr) {}
+    virtual ~TaskBase() {}
+    void SetReady() {
+        if(state_.fetch_or(READY, std::memory_order_acq_rel) & WAITING) {
+            WaitStripe& ws = wait_stripe(this);
+            std::lock_guard< std::mutex > guard(ws.mutex);
+            ws.cond.notify_all();
+        }
+    }
+private:
+    enum : int { READY = 1, WAITING = 2 };
+    std::atomic< int > refs_;
+    std::atomic< int > state_;
+    Slab* slab_;
+};
+
+//result storage
+template < typename R >
+class State : public TaskBase {
+public:
+    R Get() {
+        Wait();
+        if(error_) std::rethrow_exception(error_);
+        return std::move(*reinterpret_cast< R* >(&value_));
+    }
+protected:
+    ~State() {
+        if(Ready() && !error_) reinterpret_cast< R* >(&value_)->~R();
+    }
+    template < typename T >
+    void SetValue(T&& v) {
+        new (&value_) R(std::forward< T >(v));
+        SetReady();
+    }
+    void SetException(std::exception_ptr e) {
+        error_ = e;
+        SetReady();
+    }
+private:
+    typename std::aligned_storage< sizeof(R), alignof(R) >::type value_;
+    std::exception_ptr error_;
+};
+
+template <>
+class State< void > : public TaskBase {
+public:
+    void Get() {
+        Wait();
+        if(error_) std::rethrow_exception(error_);
+    }
+protected:
+    void SetValue() { SetReady(); }
+    void SetException(std::exception_ptr e) {
+        error_ = e;
+        SetReady();
+    }
+private:
+    std::exception_ptr error_;
+};
+
+//compile time list of indices used to expand the argument tuple
+template < std::size_t... I >
+struct Indices {};
+
+template < std::size_t N, std::size_t... I >
+struct MakeIndices : MakeIndices< N - 1, N - 1, I... > {};
+
+template < std::size_t... I >
+struct MakeIndices< 0, I... > {
+    typedef Indices< I... > type;
+};
+
+//callable and arguments stored by value, no std::bind/std::function
+template < typename R, typename F, typename... Args >
+class Task : public State< R > {
+public:
+    template < typename FwdF >
+    Task(FwdF&& f, Args&&... args)
+        : f_(std::forward< FwdF >(f)), args_(std::forward< Args >(args)...) {}
+    void Invoke() {
+        try {
+            Run(std::is_void< R >(),
+                typename MakeIndices< sizeof...(Args) >::type());
+        } catch(...) {
+            this->SetException(std::current_exception());
+        }
+    }
+private:
+    template < std::size_t... I >
+    void Run(std::false_type, Indices< I... >) {
+        this->SetValue(f_(std::move(std::get< I >(args_))...));
+    }
+    template < std::size_t... I >
+    void Run(std::true_type, Indices< I... >) {
+        f_(std::move(std::get< I >(args_))...);
+        this->SetValue();
+    }
+private:
+    F f_;
+    std::tuple< Args... > args_;
+};
+
+//------------------------------------------------------------------------------
+//future sharing the slot with the task: move only, get() can be called once
+template < typename R >
+class Future {
+public:
+    Future() : state_(nullptr) {}
+    explicit Future(State< R >* s) : state_(s) {}
+    Future(Future&& f) : state_(f.state_) { f.state_ = nullptr; }
+    Future& operator=(Future&& f) {
+        if(this != &f) {
+            Reset();
+            state_ = f.state_;
+            f.state_ = nullptr;
+        }
+        return *this;
+    }
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+    ~Future() { Reset(); }
+    bool valid() const { return state_ != nullptr; }
+    void wait() const {
+        if(state_) state_->Wait();
+    }
+    R get() {
+        if(!state_) throw std::future_error(std::future_errc::no_state);
+        State< R >* s = state_;
+        state_ = nullptr;
+        //release the slot also when Get throws
+        struct Guard {
+            ~Guard() { s->Release(); }
+            State< R >* s;
+        } guard{s};
+        return s->Get();
+    }
+private:
+    void Reset() {
+        if(state_) state_->Release();
+        state_ = nullptr;
+    }
+private:
+    State< R >* state_;
+};
+
+//------------------------------------------------------------------------------
+//executor with allocation-free submission path; same interface as Executor
+//except that a Future is returned instead of a std::future
+class SlabExecutor {
+    typedef RingQueue< TaskBase* > Queue;
+    typedef std::vector< std::thread > Threads;
+public:
+    SlabExecutor(int numthreads = std::thread::hardware_concurrency(),
+                 std::size_t queuecapacity = 4096)
+        : nthreads_(numthreads), queue_(queuecapacity) {
+        StartThreads();
+    }
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> Future< typename std::result_of< F (Args...) >::type > {
+        if(threads_.empty()) throw std::logic_error("No active threads");
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        typedef Task< ResultType, typename std::decay< F >::type, Args... >
+            TaskType;
+        TaskType* t = nullptr;
+        if(sizeof(TaskType) <= Slab::SLOT_SIZE
+           && alignof(TaskType) <= alignof(std::max_align_t)) {
+            Slab& slab = Slab::Local();
+            void* p = slab.Alloc();
+            try {
+                t = new (p) TaskType(std::forward< F >(f), std::move(args)...);
+            } catch(...) {
+                slab.Free(p);
+                throw;
+            }
+            t->SetSlab(&slab);
+        } else {
+            t = new TaskType(std::forward< F >(f), std::move(args)...);
+        }
+        Future< ResultType > ft(t);
+        try {
+            queue_.Push(t);
+        } catch(...) {
+            t->Release(); //reference held by the queue; ft releases its own
+            throw;
+        }
+        return ft;
+    }
+    //stop and join all threads; a null task is a 'terminate' message
+    void Stop() { //blocking
+        for(size_t t = 0; t != threads_.size(); ++t) queue_.Push(nullptr);
+        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
+                                                            {t.join();});
+        threads_.clear();
+    }
+    ~SlabExecutor() { Stop(); }
+private:
+    void StartThreads() {
+        for(int t = 0; t != nthreads_; ++t) {
+            threads_.push_back(std::move(std::thread( [this] {
+                while(true) {
+                    TaskBase* t = queue_.Pop();
+                    if(!t) break;
+                    t->Invoke();
+                    t->Release();
+                }
+            })));
+        }
+    }
+private:
+    int nthreads_;
+    Queue queue_;
+    Threads threads_;
+};
+
+//------------------------------------------------------------------------------
+//benchmark
+int work(int a, int b) { return a + b; }
+
+double time_diff_ms(
+    const std::chrono::time_point< std::chrono::steady_clock >& s,
+    const std::chrono::time_point< std::chrono::steady_clock >& e) {
+    return std::chrono::duration< double, std::milli >(e - s).count();
+}
+
+//submit 'rounds' batches of 'batch' tasks waiting on each batch, return
+//number of allocations and time; one warm-up round is run before starting
+//the counter to let queues and slabs reach their steady state size
+template < typename ExecT, typename FutureT >
+std::pair< long, double > run(ExecT& exec, int batch, int rounds) {
+    std::vector< FutureT > futures;
+    futures.reserve(batch);
+    long allocs = 0;
+    std::chrono::time_point< std::chrono::steady_clock > s;
+    for(int r = 0; r != rounds + 1; ++r) {
+        if(r == 1) {
+            allocs = allocationsG.load();
+            s = std::chrono::steady_clock::now();
+        }
+        for(int t = 0; t != batch; ++t) futures.push_back(exec(work, t, 1));
+        for(int t = 0; t != batch; ++t) {
+            if(futures[t].get() != t + 1)
+                throw std::logic_error("Wrong result");
+        }
+        futures.clear();
+    }
+    const auto e = std::chrono::steady_clock::now();
+    return std::make_pair(allocationsG.load() - allocs, time_diff_ms(s, e));
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    try {
+        if(argc > 1 && std::string(argv[1]) == "-h") {
+            std::cout << argv[0] << " [tasks per round] "
+                                 << "[number of rounds] "
+                                 << "[number of threads]\n"
+                                 << "default is (1000,100,4)\n";
+            return 0;
+        }
+        std::cout << "\nTesting SlabExecutor...";
+        {
+            SlabExecutor exec(2);
+            auto f1 = exec(work, 1, 2);
+            auto f2 = exec([]{ throw std::runtime_error("error"); });
+            auto f3 = exec([](const std::string& s) { return s + "!"; },
+                           std::string("hello"));
+            bool ok = f1.get() == 3 && f3.get() == "hello!";
+            try {
+                f2.get();
+                ok = false;
+            } catch(const std::runtime_error&) {}
+            if(!ok) {
+                std::cerr << "FAILED\n";
+                return EXIT_FAILURE;
+            }
+        }
+        std::cout << "OK\n\n";
+        const int batch = argc > 1 ? atoi(argv[1]) : 1000;
+        const int rounds = argc > 2 ? atoi(argv[2]) : 100;
+        const int numthreads = argc > 3 ? atoi(argv[3]) : 4;
+        const long numtasks = long(batch) * rounds;
+        std::cout << "Run-time configuration:\n"
+                  << "  " << batch      << " tasks per round\n"
+                  << "  " << rounds     << " rounds\n"
+                  << "  " << numthreads << " threads\n"
+                  << std::endl;
+        std::pair< long, double > before, after;
+        {
+            Executor exec(numthreads);
+            before = run< Executor, std::future< int > >(exec, batch, rounds);
+        }
+        {
+            SlabExecutor exec(numthreads);
+            after = run< SlabExecutor, Future< int > >(exec, batch, rounds);
+        }
+        auto report = [numtasks](const char* name,
+                                 const std::pair< long, double >& r) {
+            std::cout << "  " << name << ": "
+                      << double(r.first) / numtasks << " allocations/task - "
+                      << r.second << " ms - "
+                      << long(numtasks / (r.second / 1000)) << " tasks/s\n";
+        };
+        report("Executor    ", before);
+        report("SlabExecutor", after);
+        std::cout << std::endl;
+        return 0;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
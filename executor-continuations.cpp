@@ -0,0 +1,508 @@
+//Author: Ugo Varetto
+//Task executor with composable futures: then, when_all and when_any
+//continuations are scheduled onto the executor when their inputs complete,
+//dependent tasks never block a worker thread waiting on a std::future
+//gcc >= 4.8 or clang llvm >= 3.2 with libc++ required
+//
+//do specify -pthread when compiling if not you'll get a run-time error
+//g++ executor-continuations.cpp -std=c++11 -pthread
+//
+//The ConcurrentAccess wrapper in training/task-based-executor-concurrent.cpp
+//runs a loop popping from a queue inside a task, which keeps one worker busy
+//forever and deadlocks a single threaded executor; the version in this file
+//serializes accesses by chaining continuations and works with any number of
+//threads
+//
+//Future semantics follow the C++ Concurrency TS (std::experimental::future):
+// - f.then(c) returns a future for the result of c(f), c is invoked with the
+//   ready future so that it can handle both values and exceptions
+// - when_all(futures) returns a future holding the input futures, ready when
+//   all the inputs are ready
+// - when_any(futures) returns a future holding the input futures and the
+//   index of the first ready one
+//Futures are copyable and get() can be called multiple times, as with
+//std::shared_future
+//
+//Run with -h for info on usage options
+
+#include <iostream>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cstdlib> //EXIT_*
+
+//------------------------------------------------------------------------------
+//synchronized queue, same as the one in executor.cpp
+template < typename T >
+class SyncQueue {
+public:
+    void Push(T e) {
+        std::lock_guard< std::mutex > guard(mutex_);
+        queue_.push_front(std::move(e));
+        cond_.notify_one();
+    }
+    T Pop() {
+        std::unique_lock< std::mutex > lock(mutex_);
+        cond_.wait(lock, [this]{ return !queue_.empty();});
+        T e = std::move(queue_.back());
+        queue_.pop_back();
+        return e;
+    }
+private:
+    std::deque< T > queue_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+class Executor;
+
+//------------------------------------------------------------------------------
+//value stored in shared states: void results are stored as Unit
+struct Unit {};
+
+template < typename T >
+struct Stored {
+    typedef T type;
+};
+
+template <>
+struct Stored< void > {
+    typedef Unit type;
+};
+
+//invoke f and return its result as a stored value
+template < typename R >
+struct CallAndStore {
+    template < typename F >
+    static R Call(F&& f) { return f(); }
+};
+
+template <>
+struct CallAndStore< void > {
+    template < typename F >
+    static Unit Call(F&& f) {
+        f();
+        return Unit();
+    }
+};
+
+//------------------------------------------------------------------------------
+//state shared by a future and the task or continuation producing its value;
+//callbacks registered with OnReady are invoked by the thread that sets the
+//value, or immediately if the value is already available
+template < typename T >
+class SharedState {
+public:
+    typedef typename Stored< T >::type ValueType;
+    typedef std::function< void () > Callback;
+    SharedState(Executor* exec) : exec_(exec) {}
+    void SetValue(ValueType v) {
+        std::vector< Callback > callbacks;
+        {
+            std::lock_guard< std::mutex > guard(mutex_);
+            if(ready_) throw std::logic_error("Value already set");
+            value_.reset(new ValueType(std::move(v)));
+            ready_ = true;
+            callbacks.swap(callbacks_);
+        }
+        cond_.notify_all();
+        for(auto& c: callbacks) c();
+    }
+    void SetException(std::exception_ptr e) {
+        std::vector< Callback > callbacks;
+        {
+            std::lock_guard< std::mutex > guard(mutex_);
+            if(ready_) throw std::logic_error("Value already set");
+            error_ = e;
+            ready_ = true;
+            callbacks.swap(callbacks_);
+        }
+        cond_.notify_all();
+        for(auto& c: callbacks) c();
+    }
+    void OnReady(Callback c) {
+        {
+            std::lock_guard< std::mutex > guard(mutex_);
+            if(!ready_) {
+                callbacks_.push_back(std::move(c));
+                return;
+            }
+        }
+        c();
+    }
+    void Wait() {
+        std::unique_lock< std::mutex > lock(mutex_);
+        cond_.wait(lock, [this]{ return ready_; });
+    }
+    bool Ready() const {
+        std::lock_guard< std::mutex > guard(mutex_);
+        return ready_;
+    }
+    const ValueType& Get() {
+        Wait();
+        if(error_) std::rethrow_exception(error_);
+        return *value_;
+    }
+    Executor* GetExecutor() const { return exec_; }
+private:
+    Executor* exec_; //executor running the continuations
+    std::unique_ptr< ValueType > value_;
+    std::exception_ptr error_;
+    bool ready_ = false;
+    std::vector< Callback > callbacks_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+template < typename T > class Future;
+
+template < typename F, typename T >
+struct ContinuationResult {
+    typedef typename std::result_of< F (Future< T >) >::type type;
+};
+
+//get() returns a const reference for non-void types and void for void
+template < typename T >
+struct FutureGet {
+    typedef const T& type;
+    static type Get(SharedState< T >& s) { return s.Get(); }
+};
+
+template <>
+struct FutureGet< void > {
+    typedef void type;
+    static type Get(SharedState< void >& s) { s.Get(); }
+};
+
+//------------------------------------------------------------------------------
+//executor-native future
+template < typename T >
+class Future {
+public:
+    typedef SharedState< T > State;
+    Future() {}
+    explicit Future(const std::shared_ptr< State >& s) : state_(s) {}
+    bool valid() const { return bool(state_); }
+    bool ready() const { return state_->Ready(); }
+    //blocking: never call from a worker thread on a future which is not
+    //ready, use then instead
+    void wait() const { state_->Wait(); }
+    typename FutureGet< T >::type get() const {
+        return FutureGet< T >::Get(*state_);
+    }
+    //schedule c(*this) onto the executor when this future is ready and
+    //return a future for the result of c
+    template < typename F >
+    Future< typename ContinuationResult< F, T >::type > then(F c) const;
+    //register a callback invoked inline by the thread completing the
+    //future; used internally for bookkeeping, callbacks must be short
+    void OnReady(std::function< void () > c) const {
+        state_->OnReady(std::move(c));
+    }
+    Executor* GetExecutor() const { return state_->GetExecutor(); }
+private:
+    std::shared_ptr< State > state_;
+};
+
+template < typename T >
+Future< T > make_ready_future(Executor& exec, T value) {
+    auto s = std::make_shared< SharedState< T > >(&exec);
+    s->SetValue(std::move(value));
+    return Future< T >(s);
+}
+
+inline Future< void > make_ready_future(Executor& exec) {
+    auto s = std::make_shared< SharedState< void > >(&exec);
+    s->SetValue(Unit());
+    return Future< void >(s);
+}
+
+//------------------------------------------------------------------------------
+//task executor: same as Executor in executor.cpp but returning Futures;
+//tasks are stored as std::function<void ()> objects, an empty function is
+//interpreted as a 'terminate' message; Stop waits until no task is queued or
+//running before sending it, so that continuations posted by running tasks
+//are executed
+class Executor {
+    typedef SyncQueue< std::function< void () > > Queue;
+    typedef std::vector< std::thread > Threads;
+public:
+    Executor(int numthreads = std::thread::hardware_concurrency())
+        : nthreads_(numthreads) {
+        StartThreads();
+    }
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+    //deferred call to f with args parameters
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> Future< typename std::result_of< F (Args...) >::type > {
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        auto state = std::make_shared< SharedState< ResultType > >(this);
+        auto bound = std::bind(std::forward< F >(f),
+                               std::forward< Args >(args)...);
+        Post([state, bound]() mutable {
+            try {
+                state->SetValue(CallAndStore< ResultType >::Call(bound));
+            } catch(...) {
+                state->SetException(std::current_exception());
+            }
+        });
+        return Future< ResultType >(state);
+    }
+    //enqueue a task with no result; throws after Stop
+    void Post(std::function< void () > f) {
+        if(!f) throw std::invalid_argument("Empty task");
+        {
+            std::lock_guard< std::mutex > guard(mutex_);
+            if(stopped_) throw std::logic_error("No active threads");
+            ++pending_;
+        }
+        queue_.Push(std::move(f));
+    }
+    //stop and join all threads after all the queued tasks and the tasks
+    //they post have been executed
+    void Stop() { //blocking
+        if(threads_.empty()) return;
+        {
+            std::unique_lock< std::mutex > lock(mutex_);
+            drained_.wait(lock, [this]{ return pending_ == 0; });
+            stopped_ = true;
+        }
+        for(size_t t = 0; t != threads_.size(); ++t)
+            queue_.Push(std::function< void () >());
+        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
+                                                            {t.join();});
+        threads_.clear();
+    }
+    ~Executor() { Stop(); }
+private:
+    void StartThreads() {
+        for(int t = 0; t != nthreads_; ++t) {
+            threads_.push_back(std::move(std::thread( [this] {
+                while(true) {
+                    std::function< void () > f = queue_.Pop();
+                    if(!f) break;
+                    f();
+                    //after f: tasks posted by f are already counted
+                    std::lock_guard< std::mutex > guard(mutex_);
+                    if(--pending_ == 0) drained_.notify_all();
+                }
+            })));
+        }
+    }
+private:
+    int nthreads_; //number of OS threads requested
+    Queue queue_;  //command queue
+    Threads threads_; //std::thread array; size == nthreads_
+    std::mutex mutex_; //protects pending_ and stopped_
+    std::condition_variable drained_; //pending_ == 0
+    size_t pending_ = 0; //queued or running tasks
+    bool stopped_ = false;
+};
+
+//------------------------------------------------------------------------------
+template < typename T >
+template < typename F >
+Future< typename ContinuationResult< F, T >::type >
+Future< T >::then(F c) const {
+    typedef typename ContinuationResult< F, T >::type R;
+    if(!state_) throw std::logic_error("Invalid future");
+    Executor* exec = state_->GetExecutor();
+    auto next = std::make_shared< SharedState< R > >(exec);
+    const Future< T > self = *this;
+    state_->OnReady([exec, next, self, c]() {
+        exec->Post([next, self, c]() mutable {
+            try {
+                next->SetValue(CallAndStore< R >::Call([&]{ return c(self); }));
+            } catch(...) {
+                next->SetException(std::current_exception());
+            }
+        });
+    });
+    return Future< R >(next);
+}
+
+//ready when all the input futures are ready; the continuations of the
+//returned future are executed by the executor of the first input future
+template < typename T >
+Future< std::vector< Future< T > > >
+when_all(const std::vector< Future< T > >& futures) {
+    typedef std::vector< Future< T > > Futures;
+    if(futures.empty()) throw std::invalid_argument("Empty future sequence");
+    auto next = std::make_shared< SharedState< Futures > >(
+                    futures.front().GetExecutor());
+    auto remaining = std::make_shared< std::atomic< size_t > >(futures.size());
+    auto inputs = std::make_shared< Futures >(futures);
+    for(auto& f: futures) {
+        f.OnReady([next, remaining, inputs]() {
+            if(remaining->fetch_sub(1) == 1) next->SetValue(*inputs);
+        });
+    }
+    return Future< Futures >(next);
+}
+
+template < typename T >
+struct WhenAnyResult {
+    size_t index; //index of the first ready future
+    std::vector< Future< T > > futures;
+};
+
+//ready when the first of the input futures is ready
+template < typename T >
+Future< WhenAnyResult< T > >
+when_any(const std::vector< Future< T > >& futures) {
+    if(futures.empty()) throw std::invalid_argument("Empty future sequence");
+    auto next = std::make_shared< SharedState< WhenAnyResult< T > > >(
+                    futures.front().GetExecutor());
+    auto done = std::make_shared< std::atomic< bool > >(false);
+    auto inputs = std::make_shared< std::vector< Future< T > > >(futures);
+    for(size_t i = 0; i != futures.size(); ++i) {
+        futures[i].OnReady([next, done, inputs, i]() {
+            if(done->exchange(true)) return;
+            WhenAnyResult< T > r = {i, *inputs};
+            next->SetValue(r);
+        });
+    }
+    return Future< WhenAnyResult< T > >(next);
+}
+
+//------------------------------------------------------------------------------
+//Safe concurrent access to data: each access is a continuation of the
+//previous one, no worker thread is dedicated to the wrapped resource
+template < typename T >
+class ConcurrentAccess {
+public:
+    ConcurrentAccess(T data, Executor& e)
+        : data_(data), tail_(make_ready_future(e)) {}
+    ConcurrentAccess(const ConcurrentAccess&) = delete;
+    template < typename F >
+    auto operator()(F f)
+    -> Future< typename std::result_of< F (T) >::type > {
+        typedef typename std::result_of< F (T) >::type R;
+        std::lock_guard< std::mutex > guard(mutex_);
+        Future< R > r = tail_.then([this, f](const Future< void >&) {
+            return f(data_);
+        });
+        //the next access waits for this one whether it succeeds or not
+        tail_ = r.then([](const Future< R >&) {});
+        return r;
+    }
+    //wait for all the pending accesses: do not call from a worker thread
+    ~ConcurrentAccess() {
+        Future< void > tail;
+        {
+            std::lock_guard< std::mutex > guard(mutex_);
+            tail = tail_;
+        }
+        tail.wait();
+    }
+private:
+    T data_;
+    Future< void > tail_;
+    std::mutex mutex_;
+};
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    try {
+        if(argc > 1 && std::string(argv[1]) == "-h") {
+            std::cout << argv[0] << " [number of tasks] "
+                                 << "[number of threads]\n"
+                                 << "default is (4,1)\n";
+            return 0;
+        }
+        const int numtasks = argc > 1 ? atoi(argv[1]) : 4;
+        const int numthreads = argc > 2 ? atoi(argv[2]) : 1;
+        std::cout << "\nTesting Future::then...";
+        {
+            Executor exec(1);
+            //pipeline: each stage is scheduled when the previous one is done
+            Future< int > f = exec([](int a) { return a * 2; }, 20)
+                .then([](const Future< int >& p) { return p.get() + 2; });
+            Future< std::string > s = f.then([](const Future< int >& p) {
+                return std::to_string(p.get());
+            });
+            //errors propagate to the continuations through get()
+            Future< int > e = exec([]() -> int {
+                throw std::runtime_error("error");
+            }).then([](const Future< int >& p) { return p.get() + 1; });
+            Future< bool > handled = e.then([](const Future< int >& p) {
+                try {
+                    p.get();
+                } catch(const std::runtime_error&) {
+                    return true;
+                }
+                return false;
+            });
+            if(s.get() != "42" || !handled.get()) {
+                std::cerr << "FAILED\n";
+                return EXIT_FAILURE;
+            }
+        }
+        std::cout << "OK\n";
+        std::cout << "Testing when_all/when_any...";
+        {
+            Executor exec(1);
+            std::vector< Future< int > > parts;
+            for(int i = 0; i != 10; ++i)
+                parts.push_back(exec([](int i) { return i; }, i));
+            Future< int > total = when_all(parts).then(
+                [](const Future< std::vector< Future< int > > >& all) {
+                    int t = 0;
+                    for(auto& f: all.get()) t += f.get();
+                    return t;
+                });
+            Future< size_t > first = when_any(parts).then(
+                [](const Future< WhenAnyResult< int > >& any) {
+                    return any.get().index;
+                });
+            if(total.get() != 45 || first.get() >= parts.size()) {
+                std::cerr << "FAILED\n";
+                return EXIT_FAILURE;
+            }
+        }
+        std::cout << "OK\n\n";
+        std::cout << "Running tasks...\n";
+        std::cout << "Run-time configuration:\n"
+                  << "  " << numtasks   << " tasks\n"
+                  << "  " << numthreads << " threads\n"
+                  << std::endl;
+        using namespace std;
+        Executor exec(numthreads);
+        string msg = "start\n";
+        {
+            //works with a single thread: no task blocks waiting for the
+            //wrapped resource
+            ConcurrentAccess< string& > text(msg, exec);
+            vector< Future< void > > v;
+            for(int i = 0; i != numtasks; ++i)
+                v.push_back(exec([&text, i]{
+                    text([=](string& s) {
+                        s += to_string(i) + " " + to_string(i);
+                        s += "\n";
+                    });
+                }));
+            //wait for submissions to complete without blocking a worker
+            when_all(v).wait();
+        }
+        cout << msg;
+        std::cout << "Done\n";
+        return 0;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,464 @@
+//Author: Ugo Varetto
+//Task executor with priorities and deadlines: same interface as the
+//Executor in executor.cpp plus an operator() overload taking a
+//TaskDescriptor with the priority level and an optional deadline
+//gcc >= 4.8 or clang llvm >= 3.2 with libc++ required
+//
+//do specify -pthread when compiling if not you'll get a run-time error
+//g++ executor-priority.cpp -std=c++11 -pthread -O3
+//
+//the program floods the executor with background tasks while submitting
+//latency critical tasks and prints the queueing delay percentiles of
+//each priority level;
+//run with -h for info on usage options
+//
+//Scheduling order:
+// 1. starvation protection: the oldest task which has been waiting longer
+//    than the aging limit, whatever its priority
+// 2. highest priority level first
+// 3. within a level, tasks with a deadline in earliest-deadline-first order
+//    then tasks without a deadline in FIFO order
+
+#include <iostream>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <deque>
+#include <map>
+#include <queue>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <cstdlib> //EXIT_*
+
+typedef std::chrono::steady_clock Clock;
+
+//------------------------------------------------------------------------------
+enum Priority {
+    CRITICAL = 0,
+    HIGH,
+    NORMAL,
+    BACKGROUND,
+    NUM_PRIORITIES
+};
+
+const char* priority_name(int p) {
+    static const char* names[] = {"critical", "high", "normal", "background"};
+    return names[p];
+}
+
+//scheduling parameters of a single task; no deadline by default
+struct TaskDescriptor {
+    TaskDescriptor(Priority p = NORMAL,
+                   Clock::time_point d = Clock::time_point::max())
+        : priority(p), deadline(d) {}
+    //deadline relative to the current time
+    template < typename Rep, typename Period >
+    TaskDescriptor(Priority p, std::chrono::duration< Rep, Period > timeout)
+        : priority(p),
+          deadline(Clock::now()
+                   + std::chrono::duration_cast< Clock::duration >(timeout)) {}
+    Priority priority;
+    Clock::time_point deadline;
+};
+
+//------------------------------------------------------------------------------
+//log2 histogram of durations in microseconds: bucket i counts the samples
+//in the [2^(i-1), 2^i) us range, bucket 0 counts the samples < 1us
+struct Histogram {
+    enum : int { NUM_BUCKETS = 40 };
+    Histogram() { buckets.fill(0); }
+    void Add(Clock::duration d) {
+        const std::uint64_t us = std::chrono::duration_cast<
+                                   std::chrono::microseconds >(d).count();
+        int b = 0;
+        while(b < NUM_BUCKETS - 1 && (std::uint64_t(1) << b) <= us) ++b;
+        ++buckets[b];
+        ++count;
+    }
+    //upper bound (us) of the bucket containing the p-th percentile
+    std::uint64_t Percentile(double p) const {
+        if(count == 0) return 0;
+        const std::uint64_t target = std::uint64_t(p / 100. * count);
+        std::uint64_t c = 0;
+        for(int b = 0; b != NUM_BUCKETS; ++b) {
+            c += buckets[b];
+            if(c > target) return std::uint64_t(1) << b;
+        }
+        return std::uint64_t(1) << (NUM_BUCKETS - 1);
+    }
+    std::array< std::uint64_t, NUM_BUCKETS > buckets;
+    std::uint64_t count = 0;
+    std::uint64_t missedDeadlines = 0; //tasks started after their deadline
+};
+
+//------------------------------------------------------------------------------
+//synchronized priority queue: same locking scheme as SyncQueue, one FIFO
+//and one deadline-ordered heap per priority level
+template < typename T >
+class PrioritySyncQueue {
+    struct Entry {
+        T value;
+        Clock::time_point enqueued;
+        Clock::time_point deadline;
+        std::uint64_t seq; //tie breaker: FIFO among equal deadlines
+    };
+    struct Key {
+        Clock::time_point deadline;
+        std::uint64_t seq;
+    };
+    struct LaterDeadline {
+        bool operator()(const Key& a, const Key& b) const {
+            return a.deadline != b.deadline ? a.deadline > b.deadline
+                                            : a.seq > b.seq;
+        }
+    };
+    typedef std::priority_queue< Key, std::vector< Key >, LaterDeadline >
+        DeadlineHeap;
+    //tasks with a deadline are stored by sequence number, i.e. in enqueue
+    //order, and their keys in a heap; the keys of the tasks removed by
+    //aging are discarded when they reach the top of the heap
+    struct Level {
+        std::deque< Entry > fifo;
+        std::map< std::uint64_t, Entry > edf;
+        DeadlineHeap deadlines;
+        bool Empty() const { return fifo.empty() && edf.empty(); }
+    };
+    enum Source { FIFO, EARLIEST_DEADLINE, OLDEST_DEADLINE };
+public:
+    PrioritySyncQueue(Clock::duration aginglimit) : agingLimit_(aginglimit) {}
+    void Push(const T& e, const TaskDescriptor& d) {
+        if(d.priority < 0 || d.priority >= NUM_PRIORITIES)
+            throw std::range_error("Invalid priority");
+        std::lock_guard< std::mutex > guard(mutex_);
+        Entry entry = {e, Clock::now(), d.deadline, seq_++};
+        Level& l = levels_[d.priority];
+        if(d.deadline == Clock::time_point::max()) {
+            l.fifo.push_back(entry);
+        } else {
+            l.edf.insert(std::make_pair(entry.seq, entry));
+            l.deadlines.push(Key{entry.deadline, entry.seq});
+        }
+        ++size_;
+        cond_.notify_one();
+    }
+    //blocks until an element is available or the queue is closed; returns
+    //false if the queue is closed and empty
+    bool Pop(T& e) {
+        std::unique_lock< std::mutex > lock(mutex_);
+        cond_.wait(lock, [this]{ return size_ > 0 || closed_;});
+        if(size_ == 0) return false;
+        const Clock::time_point now = Clock::now();
+        int level = -1;
+        Source source = FIFO;
+        SelectStarved(now, level, source);
+        if(level < 0) {
+            for(level = 0; levels_[level].Empty(); ++level);
+            source = levels_[level].edf.empty() ? FIFO : EARLIEST_DEADLINE;
+        }
+        Level& l = levels_[level];
+        Entry entry;
+        if(source == FIFO) {
+            entry = l.fifo.front();
+            l.fifo.pop_front();
+        } else {
+            if(source == EARLIEST_DEADLINE) {
+                while(!l.edf.count(l.deadlines.top().seq))
+                    l.deadlines.pop();
+            }
+            auto i = source == OLDEST_DEADLINE
+                     ? l.edf.begin() : l.edf.find(l.deadlines.top().seq);
+            entry = i->second;
+            l.edf.erase(i);
+        }
+        --size_;
+        Histogram& h = delays_[level];
+        h.Add(now - entry.enqueued);
+        if(now > entry.deadline) ++h.missedDeadlines;
+        e = entry.value;
+        return true;
+    }
+    //wake up all the consumers: Pop returns false once the queue is empty
+    void Close() {
+        std::lock_guard< std::mutex > guard(mutex_);
+        closed_ = true;
+        cond_.notify_all();
+    }
+    void Open() {
+        std::lock_guard< std::mutex > guard(mutex_);
+        closed_ = false;
+    }
+    //copy of queueing delay histogram
+    Histogram QueueingDelay(Priority p) const {
+        std::lock_guard< std::mutex > guard(mutex_);
+        return delays_[p];
+    }
+    void ResetStatistics() {
+        std::lock_guard< std::mutex > guard(mutex_);
+        for(auto& h: delays_) h = Histogram();
+    }
+private:
+    //find the oldest task waiting for more than the aging limit; only the
+    //head of each FIFO and the first task with a deadline of each level
+    //are checked, they are the oldest tasks of the level
+    void SelectStarved(Clock::time_point now, int& level, Source& source) {
+        Clock::time_point oldest = now - agingLimit_;
+        for(int i = 0; i != NUM_PRIORITIES; ++i) {
+            const Level& l = levels_[i];
+            if(!l.fifo.empty() && l.fifo.front().enqueued < oldest) {
+                oldest = l.fifo.front().enqueued;
+                level = i;
+                source = FIFO;
+            }
+            if(!l.edf.empty()
+               && l.edf.begin()->second.enqueued < oldest) {
+                oldest = l.edf.begin()->second.enqueued;
+                level = i;
+                source = OLDEST_DEADLINE;
+            }
+        }
+    }
+private:
+    std::array< Level, NUM_PRIORITIES > levels_;
+    std::array< Histogram, NUM_PRIORITIES > delays_;
+    Clock::duration agingLimit_;
+    std::size_t size_ = 0;
+    std::uint64_t seq_ = 0;
+    bool closed_ = false;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+//------------------------------------------------------------------------------
+//interface and base class for callable objects
+struct ICaller {
+    virtual void Invoke() = 0;
+    virtual ~ICaller() {}
+};
+
+//callable object stored in queue shared among threads: parameters are
+//bound at object construction time
+template < typename ResultType >
+class Caller : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F&& f, Args...args) :
+        f_(std::bind(std::forward<F>(f),
+                     std::forward<Args>(args)...)) {}
+    std::future< ResultType > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            ResultType r = ResultType(f_());
+            p_.set_value(r);
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+private:
+    std::promise< ResultType > p_;
+    std::function< ResultType () > f_;
+};
+
+//specialization for void return type
+template <>
+class Caller<void> : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F f, Args...args) : f_(std::bind(f, args...)) {}
+    std::future< void > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            f_();
+            p_.set_value();
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+private:
+    std::promise< void > p_;
+    std::function< void () > f_;
+};
+
+//------------------------------------------------------------------------------
+//task executor with priority and deadline aware scheduling
+class PriorityExecutor {
+    typedef PrioritySyncQueue< ICaller* > Queue;
+    typedef std::vector< std::thread > Threads;
+public:
+    //tasks waiting for more than 'aginglimit' are executed first regardless
+    //of their priority
+    PriorityExecutor(int numthreads = std::thread::hardware_concurrency(),
+                     Clock::duration aginglimit = std::chrono::milliseconds(100))
+        : nthreads_(numthreads), queue_(aginglimit) {
+        StartThreads();
+    }
+    //deferred call to f with args parameters, NORMAL priority and no deadline
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        return operator()(TaskDescriptor(), std::forward< F >(f), args...);
+    }
+    //deferred call to f with args parameters, scheduled according to the
+    //priority and deadline in the descriptor
+    template < typename F, typename... Args >
+    auto operator()(const TaskDescriptor& d, F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        if(threads_.empty()) throw std::logic_error("No active threads");
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        Caller< ResultType >* c =
+            new Caller< ResultType >(std::forward< F >(f),
+                                     std::forward< Args >(args)...);
+        std::future< ResultType > ft = c->GetFuture();
+        try {
+            queue_.Push(c, d);
+        } catch(...) {
+            delete c;
+            throw;
+        }
+        return ft;
+    }
+    //queueing delay histogram of a priority level: time between submission
+    //and start of execution
+    Histogram QueueingDelay(Priority p) const {
+        return queue_.QueueingDelay(p);
+    }
+    void ResetStatistics() { queue_.ResetStatistics(); }
+    //stop and join all threads after all the queued tasks have been executed
+    void Stop() { //blocking
+        queue_.Close();
+        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
+                                                            {t.join();});
+        threads_.clear();
+        queue_.Open();
+    }
+    ~PriorityExecutor() { Stop(); }
+private:
+    void StartThreads() {
+        for(int t = 0; t != nthreads_; ++t) {
+            threads_.push_back(std::move(std::thread( [this] {
+                ICaller* c = nullptr;
+                while(queue_.Pop(c)) {
+                    c->Invoke();
+                    delete c;
+                }
+            })));
+        }
+    }
+private:
+    int nthreads_; //number of OS threads requested
+    Queue queue_;  //command queue
+    Threads threads_; //std::thread array; size == nthreads_
+};
+
+//------------------------------------------------------------------------------
+void busy_wait_us(int us) {
+    const Clock::time_point end = Clock::now() + std::chrono::microseconds(us);
+    while(Clock::now() < end);
+}
+
+void print_delays(const PriorityExecutor& exec) {
+    for(int p = 0; p != NUM_PRIORITIES; ++p) {
+        const Histogram h = exec.QueueingDelay(Priority(p));
+        if(h.count == 0) continue;
+        std::cout << "  " << priority_name(p) << ":\t"
+                  << h.count << " tasks, queueing delay (us) p50 <= "
+                  << h.Percentile(50) << ", p99 <= " << h.Percentile(99)
+                  << ", p99.9 <= " << h.Percentile(99.9)
+                  << ", missed deadlines: " << h.missedDeadlines << "\n";
+    }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    try {
+        if(argc > 1 && std::string(argv[1]) == "-h") {
+            std::cout << argv[0] << " [number of background tasks] "
+                                 << "[critical task every N background tasks] "
+                                 << "[task duration (us)] "
+                                 << "[number of threads]\n"
+                                 << "default is (20000,100,20,4)\n";
+            return 0;
+        }
+        std::cout << "\nTesting PriorityExecutor...";
+        {
+            //single thread: a blocked worker lets the queue fill up, the
+            //execution order must follow priority, then deadline
+            PriorityExecutor exec(1);
+            std::promise< void > gate;
+            std::shared_future< void > open = gate.get_future().share();
+            exec([open]{ open.wait(); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            std::vector< int > order;
+            std::mutex m;
+            auto record = [&order, &m](int i) {
+                std::lock_guard< std::mutex > guard(m);
+                order.push_back(i);
+            };
+            const Clock::time_point now = Clock::now();
+            exec(TaskDescriptor(BACKGROUND), record, 4);
+            exec(TaskDescriptor(NORMAL), record, 3);
+            exec(TaskDescriptor(HIGH, now + std::chrono::seconds(2)),
+                 record, 2);
+            exec(TaskDescriptor(HIGH, now + std::chrono::seconds(1)),
+                 record, 1);
+            exec(TaskDescriptor(CRITICAL), record, 0);
+            gate.set_value();
+            exec.Stop();
+            const std::vector< int > expected = {0, 1, 2, 3, 4};
+            if(order != expected) {
+                std::cerr << "FAILED\n";
+                return EXIT_FAILURE;
+            }
+        }
+        std::cout << "OK\n\n";
+        const int numtasks = argc > 1 ? atoi(argv[1]) : 20000;
+        const int every = argc > 2 ? atoi(argv[2]) : 100;
+        const int duration_us = argc > 3 ? atoi(argv[3]) : 20;
+        const int numthreads = argc > 4 ? atoi(argv[4]) : 4;
+        std::cout << "Run-time configuration:\n"
+                  << "  " << numtasks    << " background tasks\n"
+                  << "  1 critical task every " << every
+                  << " background tasks\n"
+                  << "  " << duration_us << " us task duration\n"
+                  << "  " << numthreads  << " threads\n"
+                  << std::endl;
+        //all tasks submitted with the same priority: FIFO behavior
+        //latency critical tasks submitted with CRITICAL priority and a
+        //deadline
+        for(int prioritized = 0; prioritized != 2; ++prioritized) {
+            PriorityExecutor exec(numthreads, std::chrono::seconds(1));
+            for(int t = 0; t != numtasks; ++t) {
+                exec(TaskDescriptor(prioritized ? BACKGROUND : NORMAL),
+                     busy_wait_us, duration_us);
+                if(t % every == 0) {
+                    const TaskDescriptor d = prioritized
+                        ? TaskDescriptor(CRITICAL,
+                                         std::chrono::microseconds(1000))
+                        : TaskDescriptor(NORMAL);
+                    exec(d, busy_wait_us, duration_us);
+                }
+            }
+            exec.Stop();
+            std::cout << (prioritized ? "Prioritized:\n" : "FIFO:\n");
+            print_delays(exec);
+        }
+        std::cout << std::endl;
+        return 0;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
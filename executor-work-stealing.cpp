@@ -0,0 +1,619 @@
+//Author: Ugo Varetto
+//Work-stealing task executor: same interface as the Executor in executor.cpp
+//but each worker owns a Chase-Lev deque instead of all the workers contending
+//for a single mutex protected queue
+//gcc >= 4.8 or clang llvm >= 3.2 with libc++ required
+//
+//do specify -pthread when compiling if not you'll get a run-time error
+//g++ executor-work-stealing.cpp -std=c++11 -pthread -O3
+//
+//the program runs a throughput benchmark comparing the shared queue Executor
+//with the WorkStealingExecutor;
+//run with -h for info on usage options
+//
+//Scheduling:
+// - tasks submitted from outside the executor go into an injection queue
+// - tasks submitted from inside a running task go into the bottom of the
+//   current worker's deque
+// - a worker pops from the bottom of its own deque (LIFO, cache friendly),
+//   when empty it takes from the injection queue and then tries to steal
+//   from the top of the other workers' deques (FIFO)
+// - workers which do not find any work spin for a while and then park on
+//   a condition variable
+//
+//Stats() returns the per-worker task, steal, idle and busy time counters and
+//latency histograms recorded by the WorkStealingExecutor (ExecutorStats.h)
+
+#include <iostream>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cstdlib> //EXIT_*
+#include "ExecutorStats.h"
+
+//------------------------------------------------------------------------------
+//synchronized queue, same as the one in executor.cpp; used by the shared
+//queue Executor and as the injection queue of the WorkStealingExecutor
+template < typename T >
+class SyncQueue {
+public:
+    void Push(const T& e) {
+        std::lock_guard< std::mutex > guard(mutex_);
+        queue_.push_front(e);
+        cond_.notify_one();
+    }
+    T Pop() {
+        std::unique_lock< std::mutex > lock(mutex_);
+        cond_.wait(lock, [this]{ return !queue_.empty();});
+        T e = queue_.back();
+        queue_.pop_back();
+        return e;
+    }
+    //non-blocking version of Pop: returns false if queue empty
+    bool TryPop(T& e) {
+        std::lock_guard< std::mutex > guard(mutex_);
+        if(queue_.empty()) return false;
+        e = queue_.back();
+        queue_.pop_back();
+        return true;
+    }
+    bool Empty() const {
+        std::lock_guard< std::mutex > guard(mutex_);
+        return queue_.empty();
+    }
+    void Clear() { queue_.clear(); }
+private:
+    std::deque< T > queue_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+//------------------------------------------------------------------------------
+//Chase-Lev work-stealing deque
+//("Correct and Efficient Work-Stealing for Weak Memory Models",
+// Le, Pop, Cohen, Zappa Nardelli - PPoPP 2013)
+//The owner thread pushes and pops at the bottom, any other thread can steal
+//from the top; the only synchronization between owner and thieves is a CAS
+//on 'top_' when the deque contains a single element.
+//T must be trivially copyable (pointers are what the executor stores).
+//The circular buffer grows when full; old buffers cannot be deleted while
+//thieves might still be reading from them and are therefore kept alive
+//until the deque is destroyed: the total memory is bounded by twice the
+//size of the largest buffer
+template < typename T >
+class WorkStealingDeque {
+    struct Buffer {
+        Buffer(std::int64_t cap) : capacity(cap), mask(cap - 1),
+                                   data(new std::atomic< T >[cap]) {}
+        T Get(std::int64_t i) const {
+            return data[i & mask].load(std::memory_order_relaxed);
+        }
+        void Put(std::int64_t i, T e) {
+            data[i & mask].store(e, std::memory_order_relaxed);
+        }
+        Buffer* Grow(std::int64_t b, std::int64_t t) const {
+            Buffer* nb = new Buffer(2 * capacity);
+            for(std::int64_t i = t; i != b; ++i) nb->Put(i, Get(i));
+            return nb;
+        }
+        const std::int64_t capacity; //power of two
+        const std::int64_t mask;
+        std::unique_ptr< std::atomic< T >[] > data;
+    };
+public:
+    WorkStealingDeque(std::int64_t capacity = 1024)
+        : top_(0), bottom_(0), buffer_(new Buffer(capacity)) {
+        if(capacity < 1 || (capacity & (capacity - 1)) != 0)
+            throw std::invalid_argument("Capacity must be a power of two");
+        garbage_.push_back(std::unique_ptr< Buffer >(buffer_.load()));
+    }
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+    //owner only
+    void Push(T e) {
+        const std::int64_t b = bottom_.load(std::memory_order_relaxed);
+        const std::int64_t t = top_.load(std::memory_order_acquire);
+        Buffer* a = buffer_.load(std::memory_order_relaxed);
+        if(b - t > a->capacity - 1) {
+            a = a->Grow(b, t);
+            garbage_.push_back(std::unique_ptr< Buffer >(a));
+            buffer_.store(a, std::memory_order_release);
+        }
+        a->Put(b, e);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    //owner only: returns false if empty
+    bool Pop(T& e) {
+        const std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Buffer* a = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top_.load(std::memory_order_relaxed);
+        if(t > b) { //empty
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        e = a->Get(b);
+        if(t == b) { //last element: race against thieves
+            const bool won = top_.compare_exchange_strong(
+                                 t, t + 1,
+                                 std::memory_order_seq_cst,
+                                 std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+    //any thread: returns false if empty or if another thread won the race
+    bool Steal(T& e) {
+        std::int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::int64_t b = bottom_.load(std::memory_order_acquire);
+        if(t >= b) return false;
+        Buffer* a = buffer_.load(std::memory_order_acquire);
+        e = a->Get(t);
+        return top_.compare_exchange_strong(t, t + 1,
+                                            std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
+    }
+    //approximate when called concurrently with Push/Pop/Steal
+    bool Empty() const {
+        return bottom_.load(std::memory_order_relaxed)
+               <= top_.load(std::memory_order_relaxed);
+    }
+private:
+    //top and bottom on separate cache lines: thieves only write to top_;
+    //padding instead of alignas: over-aligned new requires C++17
+    std::atomic< std::int64_t > top_;
+    char pad_[64 - sizeof(std::atomic< std::int64_t >)];
+    std::atomic< std::int64_t > bottom_;
+    std::atomic< Buffer* > buffer_;
+    std::vector< std::unique_ptr< Buffer > > garbage_; //owner only
+};
+
+//------------------------------------------------------------------------------
+//interface and base class for callable objects
+struct ICaller {
+    ICaller() : enqueued(StatsClock::now()) {}
+    virtual bool Empty() const = 0;
+    virtual void Invoke() = 0;
+    virtual ~ICaller() {}
+    StatsClock::time_point enqueued; //creation time, before enqueueing
+};
+
+//callable object stored in queue shared among threads: parameters are
+//bound at object construction time
+template < typename ResultType >
+class Caller : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F&& f, Args...args) :
+        f_(std::bind(std::forward<F>(f),
+                     std::forward<Args>(args)...)),
+        empty_(false) {}
+    Caller() : empty_(true) {}
+    std::future< ResultType > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            ResultType r = ResultType(f_());
+            p_.set_value(r);
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+    bool Empty() const { return empty_; }
+private:
+    std::promise< ResultType > p_;
+    std::function< ResultType () > f_;
+    bool empty_;
+};
+
+//specialization for void return type
+template <>
+class Caller<void> : public ICaller {
+public:
+    template < typename F, typename... Args >
+    Caller(F f, Args...args) : f_(std::bind(f, args...)), empty_(false) {}
+    Caller() : empty_(true) {}
+    std::future< void > GetFuture() {
+        return p_.get_future();
+    }
+    void Invoke() {
+        try {
+            f_();
+            p_.set_value();
+        } catch(...) {
+            p_.set_exception(std::current_exception());
+        }
+    }
+    bool Empty() const { return empty_; }
+private:
+    std::promise< void > p_;
+    std::function< void () > f_;
+    bool empty_;
+};
+
+//------------------------------------------------------------------------------
+//shared queue executor from executor.cpp, used as the benchmark baseline
+class Executor {
+    typedef SyncQueue< ICaller* > Queue;
+    typedef std::vector< std::thread > Threads;
+public:
+    Executor(int numthreads = std::thread::hardware_concurrency())
+        : nthreads_(numthreads) {
+        StartThreads();
+    }
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        if(threads_.empty()) throw std::logic_error("No active threads");
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        Caller< ResultType >* c =
+            new Caller< ResultType >(std::forward< F >(f),
+                                     std::forward< Args >(args)...);
+        std::future< ResultType > ft = c->GetFuture();
+        queue_.Push(c);
+        return ft;
+    }
+    void Stop() { //blocking
+        for(size_t t = 0; t != threads_.size(); ++t)
+            queue_.Push(new Caller<void>);
+        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
+                                                            {t.join();});
+        threads_.clear();
+        queue_.Clear();
+    }
+    ~Executor() { Stop(); }
+private:
+    void StartThreads() {
+        for(int t = 0; t != nthreads_; ++t) {
+            threads_.push_back(std::move(std::thread( [this] {
+                while(true) {
+                    ICaller* c = queue_.Pop();
+                    if(c->Empty()) {
+                        delete c;
+                        break;
+                    }
+                    c->Invoke();
+                    delete c;
+                }
+            })));
+        }
+    }
+private:
+    int nthreads_;
+    Queue queue_;
+    Threads threads_;
+};
+
+//------------------------------------------------------------------------------
+//work-stealing executor: same operator()(F&&, Args...) -> std::future
+//interface as Executor
+class WorkStealingExecutor {
+    typedef WorkStealingDeque< ICaller* > Deque;
+    //padded to avoid false sharing between the deque indices of
+    //different workers
+    struct Worker {
+        Deque deque;
+        std::thread thread;
+        unsigned seed; //victim selection
+        char pad[64];
+    };
+    typedef std::vector< std::unique_ptr< Worker > > Workers;
+public:
+    WorkStealingExecutor(int numthreads = std::thread::hardware_concurrency(),
+                         int spincount = 64)
+        : nthreads_(numthreads), spincount_(spincount) {
+        StartThreads();
+    }
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+    //deferred call to f with args parameters; when called from a task
+    //running inside this executor the task is pushed into the local deque
+    //of the calling worker, in all other cases into the injection queue
+    template < typename F, typename... Args >
+    auto operator()(F&& f, Args... args)
+    -> std::future< typename std::result_of< F (Args...) >::type > {
+        if(workers_.empty()) throw std::logic_error("No active threads");
+        typedef typename std::result_of< F (Args...) >::type ResultType;
+        Caller< ResultType >* c =
+            new Caller< ResultType >(std::forward< F >(f),
+                                     std::forward< Args >(args)...);
+        std::future< ResultType > ft = c->GetFuture();
+        Submit(c);
+        return ft;
+    }
+    //stop and join all threads: the workers exit after all the queued tasks
+    //have been executed
+    void Stop() { //blocking
+        {
+            std::lock_guard< std::mutex > guard(idleMutex_);
+            stop_ = true;
+        }
+        idleCond_.notify_all();
+        std::for_each(workers_.begin(), workers_.end(),
+                      [](std::unique_ptr< Worker >& w) { w->thread.join(); });
+        workers_.clear();
+        stop_ = false;
+    }
+    //start or re-start with numthreads threads
+    void Restart(int numthreads) {
+        if(numthreads < 1) {
+            throw std::range_error("Number of threads < 1");
+        }
+        Stop();
+        nthreads_ = numthreads;
+        StartThreads();
+    }
+    int NumThreads() const { return nthreads_; }
+    //per-worker counters and histograms since the last (re)start
+    ExecutorSnapshot Stats() const { return stats_.Snapshot(); }
+    //record task and idle intervals of all the workers
+    void EnableTrace(bool on) { stats_.EnableTrace(on); }
+    //write recorded intervals in Chrome trace-event JSON format
+    void WriteChromeTrace(std::ostream& os) const {
+        stats_.WriteChromeTrace(os);
+    }
+    ~WorkStealingExecutor() { Stop(); }
+private:
+    void Submit(ICaller* c) {
+        if(currentExecutor_ == this) {
+            workers_[currentWorker_]->deque.Push(c);
+        } else {
+            injection_.Push(c);
+        }
+        //pairs with the fence in Park: either this thread sees the
+        //sleeping worker or the worker sees the new task
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard< std::mutex > guard(idleMutex_);
+            ++wakeups_;
+            idleCond_.notify_one();
+        }
+    }
+    //look for work: local deque first, then injection queue, then
+    //try to steal from other workers starting at a random victim
+    ICaller* FindTask(int id) {
+        ICaller* c = nullptr;
+        Worker& w = *workers_[id];
+        if(w.deque.Pop(c)) return c;
+        if(injection_.TryPop(c)) return c;
+        const int n = int(workers_.size());
+        w.seed = w.seed * 1103515245u + 12345u;
+        const int start = int((w.seed >> 16) % n);
+        for(int i = 0; i != n; ++i) {
+            const int v = (start + i) % n;
+            if(v == id) continue;
+            if(workers_[v]->deque.Steal(c)) {
+                stats_.RecordSteal(id);
+                return c;
+            }
+        }
+        return nullptr;
+    }
+    bool HasWork() const {
+        if(!injection_.Empty()) return true;
+        for(auto& w: workers_) if(!w->deque.Empty()) return true;
+        return false;
+    }
+    //block until a task is submitted or the executor is stopped; returns
+    //false if the executor is stopping and no work is left
+    bool Park() {
+        std::unique_lock< std::mutex > lock(idleMutex_);
+        sleeping_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool work = HasWork();
+        if(!work && !stop_) {
+            idleCond_.wait(lock, [this]{ return wakeups_ > 0 || stop_; });
+            if(wakeups_ > 0) --wakeups_;
+            work = true; //re-scan
+        }
+        sleeping_.fetch_sub(1, std::memory_order_relaxed);
+        return work || !stop_;
+    }
+    void Run(int id) {
+        currentExecutor_ = this;
+        currentWorker_ = id;
+        //start of the current idle period, if any
+        StatsClock::time_point idle;
+        bool idling = false;
+        while(true) {
+            ICaller* c = FindTask(id);
+            if(c == nullptr && !idling) {
+                idle = StatsClock::now();
+                idling = true;
+            }
+            for(int s = 0; c == nullptr && s != spincount_; ++s) {
+                std::this_thread::yield();
+                c = FindTask(id);
+            }
+            if(c != nullptr) {
+                const StatsClock::time_point start = StatsClock::now();
+                if(idling) {
+                    stats_.RecordIdle(id, idle, start);
+                    idling = false;
+                }
+                c->Invoke();
+                stats_.RecordTask(id, c->enqueued, start, StatsClock::now());
+                delete c;
+                continue;
+            }
+            if(!Park()) break;
+        }
+        if(idling) stats_.RecordIdle(id, idle, StatsClock::now());
+        currentExecutor_ = nullptr;
+    }
+    //start threads; all the workers are created before any thread is
+    //started because FindTask iterates over the worker array
+    void StartThreads() {
+        stats_.Reset(nthreads_);
+        for(int t = 0; t != nthreads_; ++t) {
+            workers_.push_back(std::unique_ptr< Worker >(new Worker));
+            workers_.back()->seed = unsigned(t + 1);
+        }
+        for(int t = 0; t != nthreads_; ++t) {
+            workers_[t]->thread = std::thread([this, t]{ Run(t); });
+        }
+    }
+private:
+    int nthreads_; //number of OS threads requested
+    int spincount_; //number of FindTask attempts before parking
+    Workers workers_;
+    SyncQueue< ICaller* > injection_; //tasks submitted from outside
+    std::mutex idleMutex_;
+    std::condition_variable idleCond_;
+    std::atomic< int > sleeping_{0}; //number of parked workers
+    int wakeups_ = 0; //pending wake-up signals, guarded by idleMutex_
+    bool stop_ = false; //guarded by idleMutex_
+    ExecutorStats stats_;
+    //worker running the current thread, if any
+    static thread_local WorkStealingExecutor* currentExecutor_;
+    static thread_local int currentWorker_;
+};
+
+thread_local WorkStealingExecutor* WorkStealingExecutor::currentExecutor_
+    = nullptr;
+thread_local int WorkStealingExecutor::currentWorker_ = -1;
+
+//------------------------------------------------------------------------------
+//benchmark
+
+//tiny task: a few hundred nanoseconds of work at most
+int work(int iterations) {
+    volatile int r = 0;
+    for(int i = 0; i != iterations; ++i) r = r + i;
+    return r;
+}
+
+double time_diff_ms(
+    const std::chrono::time_point< std::chrono::steady_clock >& s,
+    const std::chrono::time_point< std::chrono::steady_clock >& e) {
+    return std::chrono::duration< double, std::milli >(e - s).count();
+}
+
+//1. submit numtasks tasks from the main thread and wait on all the futures
+template < typename ExecT >
+double external_submission(ExecT& exec, int numtasks, int iterations) {
+    std::vector< std::future< int > > futures;
+    futures.reserve(numtasks);
+    const auto s = std::chrono::steady_clock::now();
+    for(int t = 0; t != numtasks; ++t) futures.push_back(exec(work, iterations));
+    for(auto& f: futures) f.get();
+    const auto e = std::chrono::steady_clock::now();
+    return time_diff_ms(s, e);
+}
+
+//2. fan-out: each task submits its children from inside the executor until
+//   numtasks tasks have been executed; with the WorkStealingExecutor all
+//   the submissions go into the local deques
+template < typename ExecT >
+void spawn(ExecT& exec, std::atomic< int >& remaining, int depth,
+           int iterations) {
+    work(iterations);
+    if(depth > 0) {
+        exec(spawn< ExecT >, std::ref(exec), std::ref(remaining), depth - 1,
+             iterations);
+        exec(spawn< ExecT >, std::ref(exec), std::ref(remaining), depth - 1,
+             iterations);
+    }
+    remaining.fetch_sub(1);
+}
+
+template < typename ExecT >
+double nested_submission(ExecT& exec, int depth, int iterations) {
+    std::atomic< int > remaining((1 << (depth + 1)) - 1);
+    const auto s = std::chrono::steady_clock::now();
+    exec(spawn< ExecT >, std::ref(exec), std::ref(remaining), depth,
+         iterations);
+    while(remaining.load() > 0) std::this_thread::yield();
+    const auto e = std::chrono::steady_clock::now();
+    return time_diff_ms(s, e);
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    try {
+        if(argc > 1 && std::string(argv[1]) == "-h") {
+            std::cout << argv[0] << " [number of tasks] "
+                                 << "[number of threads] "
+                                 << "[task iterations]\n"
+                                 << "default is (1000000,"
+                                 << std::thread::hardware_concurrency()
+                                 << ",100)\n";
+            return 0;
+        }
+        //test WorkStealingExecutor
+        std::cout << "\nTesting WorkStealingExecutor...";
+        {
+            WorkStealingExecutor exec(2);
+            auto f1 = exec([](int a, int b) { return a + b; }, 1, 2);
+            //nested submission and wait from inside a task
+            auto f2 = exec([&exec]() {
+                return exec([]{ return 40; }).get() + 2;
+            });
+            if(f1.get() != 3 || f2.get() != 42) {
+                std::cerr << "FAILED\n";
+                return EXIT_FAILURE;
+            }
+        }
+        std::cout << "OK\n\n";
+        const int numtasks = argc > 1 ? atoi(argv[1]) : 1000000;
+        const int numthreads = argc > 2 ? atoi(argv[2])
+                               : std::thread::hardware_concurrency();
+        const int iterations = argc > 3 ? atoi(argv[3]) : 100;
+        int depth = 0;
+        while((2 << (depth + 1)) - 1 <= numtasks) ++depth;
+        const int nestedtasks = (1 << (depth + 1)) - 1;
+        std::cout << "Run-time configuration:\n"
+                  << "  " << numtasks   << " tasks\n"
+                  << "  " << numthreads << " threads\n"
+                  << "  " << iterations << " iterations per task\n"
+                  << std::endl;
+        double sq_ext = 0, ws_ext = 0, sq_nested = 0, ws_nested = 0;
+        ExecutorSnapshot ws_stats;
+        {
+            Executor exec(numthreads);
+            sq_ext = external_submission(exec, numtasks, iterations);
+            sq_nested = nested_submission(exec, depth, iterations);
+        }
+        {
+            WorkStealingExecutor exec(numthreads);
+            ws_ext = external_submission(exec, numtasks, iterations);
+            ws_nested = nested_submission(exec, depth, iterations);
+            ws_stats = exec.Stats();
+        }
+        auto report = [](const char* name, int n, double ms) {
+            std::cout << "  " << name << ": " << ms << " ms - "
+                      << int(n / (ms / 1000)) << " tasks/s\n";
+        };
+        std::cout << "External submission (" << numtasks << " tasks)\n";
+        report("shared queue  ", numtasks, sq_ext);
+        report("work stealing ", numtasks, ws_ext);
+        std::cout << "Nested submission (" << nestedtasks << " tasks)\n";
+        report("shared queue  ", nestedtasks, sq_nested);
+        report("work stealing ", nestedtasks, ws_nested);
+        std::cout << "\nWork stealing executor statistics:\n";
+        ws_stats.Print(std::cout);
+        std::cout << std::endl;
+        return 0;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -5,6 +5,27 @@
 //do specify -pthread when compiling if not you'll get a run-time error
 //g++ executor.cpp -std=c++11 -pthread 
 //
+//-DUSE_RING_QUEUE replaces the mutex protected SyncQueue with the bounded
+//lock-free RingQueue in RingQueue.h
+//
+//Stop modes:
+// - drain (Stop and destructor default): all the queued tasks are executed
+//   before the threads exit
+// - cancel (opt-in): tasks not yet started are removed from the queue and
+//   their futures fail with a TaskCancelled exception; running tasks are
+//   signalled through the executor's CancellationToken
+// - keep (Start/Restart default): threads exit after the current task,
+//   queued tasks are left in the queue, ahead of the tasks submitted while
+//   stopping, for the new threads
+//Stop closes the executor: submissions fail until the next Start; Restart
+//keeps it open, tasks submitted while restarting wait in the queue for the
+//new threads
+//
+//Each worker records the number of executed tasks, idle and busy time and
+//the enqueue to start latency and run time histograms (ExecutorStats.h);
+//Stats() returns a snapshot, EnableTrace/WriteChromeTrace export a
+//chrome://tracing timeline
+//
 // Run with -h for info on usage options
 
 #include <iostream>
@@ -12,14 +33,22 @@
 #include <thread>
 #include <chrono>
 #include <future>
+#include <functional>
 #include <type_traits>
 #include <utility>
 #include <deque>
 #include <vector>
 #include <stdexcept>
 #include <algorithm>
-#include <map>
+#include <fstream>
+#include <atomic>
+#include <iterator>
+#include <memory>
 #include <cstdlib> //EXIT_*
+#ifdef USE_RING_QUEUE
+#include "RingQueue.h"
+#endif
+#include "ExecutorStats.h"
 
 //------------------------------------------------------------------------------
 //synchronized queue (could be an inner class inside Executor):
@@ -36,6 +65,17 @@ public:
         queue_.push_front(e);
         cond_.notify_one(); //notify 
     }
+    //insert a range of elements under a single lock acquisition and wake
+    //up all the waiting threads at once; first is advanced past each
+    //inserted element: if Push throws [first, last) are not inserted
+    template < typename It >
+    void Push(It& first, It last) {
+        std::lock_guard< std::mutex > guard(mutex_);
+        const bool many = std::distance(first, last) > 1;
+        for(; first != last; ++first) queue_.push_front(*first);
+        if(many) cond_.notify_all();
+        else cond_.notify_one();
+    }
     T Pop() {
         //cannot use simple scoped lock here because lock passed to
         //wait must be able to acquire and release the mutex 
@@ -47,21 +87,52 @@ public:
         queue_.pop_back();
         return e;
     }
-    friend class Executor; //to allow calls to Clear  
-private:
-    void Clear() { queue_.clear(); }    
+    //non-blocking extraction, returns false if queue empty
+    bool TryPop(T& e) {
+        std::lock_guard< std::mutex > guard(mutex_);
+        if(queue_.empty()) return false;
+        e = queue_.back();
+        queue_.pop_back();
+        return true;
+    }
 private:
     std::deque< T > queue_;
     std::mutex mutex_;
     std::condition_variable cond_;
 };
 
+//------------------------------------------------------------------------------
+//exception stored into the futures of cancelled tasks
+class TaskCancelled : public std::runtime_error {
+public:
+    TaskCancelled() : std::runtime_error("Task cancelled") {}
+};
+
+//cooperative cancellation: copies share the same flag; long running tasks
+//poll Cancelled() or call ThrowIfCancelled() to exit early
+class CancellationToken {
+public:
+    CancellationToken() : cancelled_(new std::atomic< bool >(false)) {}
+    void Cancel() { cancelled_->store(true); }
+    bool Cancelled() const { return cancelled_->load(); }
+    void ThrowIfCancelled() const {
+        if(Cancelled()) throw TaskCancelled();
+    }
+private:
+    std::shared_ptr< std::atomic< bool > > cancelled_;
+};
+
 //------------------------------------------------------------------------------
 //interface and base class for callable objects 
 struct ICaller {    
+    ICaller() : enqueued(StatsClock::now()) {}
     virtual bool Empty() const = 0;    
-    virtual void Invoke() = 0;    
+    virtual void Invoke() = 0;
+    //called instead of Invoke when the task is removed from the queue
+    //without being executed: stores e into the future
+    virtual void Cancel(std::exception_ptr e) = 0;
     virtual ~ICaller() {}
+    StatsClock::time_point enqueued; //creation time, before enqueueing
 };
 
 //callable object stored in queue shared among threads: parameters are
@@ -86,6 +157,7 @@ public:
             p_.set_exception(std::current_exception());
         }
     }
+    void Cancel(std::exception_ptr e) { p_.set_exception(e); }
     bool Empty() const { return empty_; }
 private:
     std::promise< ResultType > p_;
@@ -111,6 +183,7 @@ public:
             p_.set_exception(std::current_exception());
         }
     }
+    void Cancel(std::exception_ptr e) { p_.set_exception(e); }
     bool Empty() const { return empty_; }
 private:
     std::promise< void > p_;
@@ -118,14 +191,65 @@ private:
     bool empty_;
 }; 
 
+//------------------------------------------------------------------------------
+//completion state shared by all the tasks of a batch: the last task to
+//complete sets the value (or the first exception thrown by any task) of
+//the promise and deletes the state
+struct BatchState {
+    BatchState(size_t n) : remaining(n) {}
+    void Complete(std::exception_ptr e) {
+        if(e) {
+            std::lock_guard< std::mutex > guard(mutex);
+            if(!error) error = e;
+        }
+        if(remaining.fetch_sub(1) != 1) return;
+        if(error) done.set_exception(error);
+        else done.set_value();
+        delete this;
+    }
+    std::atomic< size_t > remaining;
+    std::promise< void > done;
+    std::mutex mutex;
+    std::exception_ptr error;
+};
+
+//callable object executing a chunk [begin, end) of a batch
+template < typename BodyT, typename IndexT >
+class RangeCaller : public ICaller {
+public:
+    RangeCaller(const BodyT& body, IndexT begin, IndexT end,
+                BatchState* state)
+        : body_(body), begin_(begin), end_(end), state_(state) {}
+    void Invoke() {
+        try {
+            body_(begin_, end_);
+            state_->Complete(std::exception_ptr());
+        } catch(...) {
+            state_->Complete(std::current_exception());
+        }
+    }
+    void Cancel(std::exception_ptr e) { state_->Complete(e); }
+    bool Empty() const { return false; }
+private:
+    BodyT body_;
+    IndexT begin_;
+    IndexT end_;
+    BatchState* state_;
+};
+
 //------------------------------------------------------------------------------
 //task executor: asynchronously execute callable objects. Specify the max number
 //of threads to use at Executor construction time; threads are started in
 //the constructor and joined in the destructor
 class Executor {
+#ifdef USE_RING_QUEUE
+    typedef RingQueue< ICaller* > Queue;
+#else
     typedef SyncQueue< ICaller* > Queue;
+#endif
     typedef std::vector< std::thread > Threads;
 public:
+    enum class StopMode {DRAIN, CANCEL, KEEP};
     Executor(int numthreads = std::thread::hardware_concurrency()) 
         : nthreads_(numthreads) {
         StartThreads();    
@@ -137,17 +261,58 @@ public:
     template < typename F, typename... Args > 
     auto operator()(F&& f, Args... args)
     -> std::future< typename std::result_of< F (Args...) >::type > {    
-        if(threads_.empty()) throw std::logic_error("No active threads");
+        Submission submission(*this);
         typedef typename std::result_of< F (Args...) >::type ResultType; 
-        Caller< ResultType >* c = 
+        //owned by the queue once inserted: Push may throw with RingQueue
+        std::unique_ptr< Caller< ResultType > > c(
             new Caller< ResultType >(std::forward< F >(f),
-                                     std::forward< Args >(args)...);
+                                     std::forward< Args >(args)...));
         std::future< ResultType > ft = c->GetFuture();
-        queue_.Push(c);
+        queue_.Push(c.get());
+        c.release();
         return ft;
     }
-    //stop and join all threads; queue is cleared by default call with 
-    //false to avoid clearing queue
+    //batch submission: one task per element of [first, last) calling f(*i);
+    //all the tasks are inserted into the queue under a single lock and a
+    //single future is returned which becomes ready when all the tasks have
+    //completed, the first exception thrown by a task is stored in the future
+    template < typename F, typename It >
+    std::future< void > SubmitBatch(F f, It first, It last) {
+        auto body = [f](It b, It e) mutable { for(; b != e; ++b) f(*b); };
+        std::vector< std::pair< It, It > > chunks;
+        for(; first != last; ++first)
+            chunks.push_back(std::make_pair(first, std::next(first)));
+        return SubmitChunks(body, chunks);
+    }
+    //parallel loop: f(i) is called for each i in [begin, end); the range
+    //is split into chunks of 'grain' iterations, each chunk is executed
+    //by a single task; returns one future for the whole range as SubmitBatch
+    //the index type is the common type of begin and end, grain is not
+    //deduced: ParallelFor(0, v.size(), 64, f) iterates over size_t
+    template < typename BeginT, typename EndT, typename F >
+    std::future< void > ParallelFor(
+        BeginT begin, EndT end,
+        typename std::common_type< BeginT, EndT >::type grain, F f) {
+        typedef typename std::common_type< BeginT, EndT >::type IndexT;
+        if(grain < 1) throw std::range_error("Grain size < 1");
+        auto body = [f](IndexT b, IndexT e) mutable {
+            for(; b != e; ++b) f(b);
+        };
+        const IndexT last = end;
+        std::vector< std::pair< IndexT, IndexT > > chunks;
+        for(IndexT b = begin; b < last; b += std::min(grain, last - b))
+            chunks.push_back(std::make_pair(b, std::min(last, b + grain)));
+        return SubmitChunks(body, chunks);
+    }
+    //token cancelled when the executor is stopped in cancel mode; tasks
+    //that need to be interrupted should capture a copy and poll it
+    CancellationToken Token() const {
+        std::lock_guard< std::mutex > guard(mutex_);
+        return cancel_;
+    }
+    //stop and join all threads; by default all the queued tasks are executed
+    //before stopping, StopMode::CANCEL cancels the pending tasks; new
+    //submissions fail until the next Start
     //to "stop" threads an empty  Caller instance per-thread is put into the
     //queue; threads interpret an empty Caller as as stop signal and exit from
     //the execution loop as soon as one is popped from the queue
@@ -156,52 +321,198 @@ public:
     //to killing a process with Ctrl-C, since however threads are not
     //processes the resources allocated/acquired during the thread lifetime
     //are not automatically released
-    void Stop(bool clearQueue = true) { //blocking
-        for(int t = 0; t != threads_.size(); ++t) queue_.Push(new Caller<void>); 
-        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
-                                                            {t.join();});
-        threads_.clear();
-        queue_.Clear();
+    void Stop(StopMode mode = StopMode::DRAIN) { //blocking
+        std::lock_guard< std::mutex > guard(mutex_);
+        //wait for the submissions in progress: nothing is queued after
+        //the threads exit
+        accepting_ = false;
+        while(submitting_ != 0) std::this_thread::yield();
+        std::vector< ICaller* > pending;
+        StopThreads(mode, pending);
+        //left in the queue by a previous Stop in keep mode, if no threads
+        TakePending(pending);
+        if(mode != StopMode::KEEP) {
+            Cancel(pending.begin(), pending.end(),
+                   std::make_exception_ptr(TaskCancelled()));
+            return;
+        }
+        //back into the queue for the next Start: it was emptied and nothing
+        //else can be inserted, a bounded queue does not block
+        auto first = pending.begin();
+        try {
+            queue_.Push(first, pending.end());
+        } catch(...) {
+            Cancel(first, pending.end(), std::current_exception());
+            throw;
+        }
     }
-    //start or re-start with numthreads threads, queue is cleared by default
-    //call with ..., false to avoid clearing queue
-    void Start(int numthreads, bool clearQueue = true) { //non-blocking
+    //start or re-start with numthreads threads; can be called while other
+    //threads are submitting tasks: they are queued for the new threads.
+    //By default the queued tasks are kept and executed by the new threads,
+    //ahead of the tasks submitted while restarting: can be used to resize
+    //the pool under load; StopMode::DRAIN lets the current threads execute
+    //them, StopMode::CANCEL cancels them
+    void Start(int numthreads,
+               StopMode mode = StopMode::KEEP) { //non-blocking
         if(numthreads < 1) {
             throw std::range_error("Number of threads < 1");
         }
-        Stop(clearQueue);
+        std::lock_guard< std::mutex > guard(mutex_);
+        std::vector< ICaller* > pending;
+        StopThreads(mode, pending);
+        if(mode == StopMode::CANCEL) {
+            Cancel(pending.begin(), pending.end(),
+                   std::make_exception_ptr(TaskCancelled()));
+            pending.clear();
+        } else if(mode == StopMode::KEEP) {
+            //tasks submitted while stopping go after the pending ones
+            TakePending(pending);
+        }
+        if(cancel_.Cancelled()) cancel_ = CancellationToken();
         nthreads_ = numthreads;
         StartThreads();
+        //re-queued once there are consumers: a bounded queue blocks
+        //until the new threads make room
+        auto first = pending.begin();
+        try {
+            queue_.Push(first, pending.end());
+        } catch(...) {
+            Cancel(first, pending.end(), std::current_exception());
+            throw;
+        }
     }
     //same as Start; in case the Executor is created with zero threads
     //it makes sense to call start; if it's created with a number of threads
     //greater than zero call Restart in client code
-    void Restart(int numthreads, bool clearQueue = true) {
-        Start(numthreads, clearQueue); 
+    void Restart(int numthreads, StopMode mode = StopMode::KEEP) {
+        Start(numthreads, mode);
     }
-    //join all threads
+    //per-worker counters and histograms since the last (re)start
+    ExecutorSnapshot Stats() const { return stats_.Snapshot(); }
+    //record task and idle intervals of all the workers
+    void EnableTrace(bool on) { stats_.EnableTrace(on); }
+    //write recorded intervals in Chrome trace-event JSON format
+    void WriteChromeTrace(std::ostream& os) const {
+        stats_.WriteChromeTrace(os);
+    }
+    //execute all the queued tasks and join all threads
     ~Executor() { Stop(); }
 private:
-    //start threads and put them into thread vector
+    //registers a submission in progress, throws if the executor is stopped
+    struct Submission {
+        explicit Submission(Executor& e) : executor(e) {
+            ++executor.submitting_;
+            if(!executor.accepting_) {
+                --executor.submitting_;
+                throw std::logic_error("No active threads");
+            }
+        }
+        ~Submission() { --executor.submitting_; }
+        Executor& executor;
+    };
+    //join the threads; in cancel and keep mode the tasks not yet started
+    //are removed from the queue and appended to pending so that the stop
+    //messages are the next elements popped from the queue; in drain mode
+    //the threads exit after executing them
+    void StopThreads(StopMode mode, std::vector< ICaller* >& pending) {
+        if(mode == StopMode::CANCEL) cancel_.Cancel();
+        if(mode != StopMode::DRAIN) TakePending(pending);
+        for(size_t t = 0; t != threads_.size(); ++t) {
+            std::unique_ptr< ICaller > stop(new Caller< void >);
+            queue_.Push(stop.get());
+            stop.release();
+        }
+        std::for_each(threads_.begin(), threads_.end(), [](std::thread& t)
+                                                            {t.join();});
+        threads_.clear();
+    }
+    //move all the queued tasks into pending
+    void TakePending(std::vector< ICaller* >& pending) {
+        ICaller* c = nullptr;
+        while(queue_.TryPop(c)) pending.push_back(c);
+    }
+    //store e into the futures of the tasks in [first, last) and delete them
+    template < typename It >
+    static void Cancel(It first, It last, std::exception_ptr e) {
+        for(; first != last; ++first) {
+            (*first)->Cancel(e);
+            delete *first;
+        }
+    }
+    //create one RangeCaller per chunk and push all of them into the queue
+    //at once
+    template < typename BodyT, typename IndexT >
+    std::future< void > SubmitChunks(
+        const BodyT& body,
+        const std::vector< std::pair< IndexT, IndexT > >& chunks) {
+        Submission submission(*this);
+        std::unique_ptr< BatchState > state(new BatchState(chunks.size()));
+        std::future< void > ft = state->done.get_future();
+        if(chunks.empty()) {
+            state->done.set_value();
+            return ft;
+        }
+        //owned here until inserted into the queue
+        std::vector< std::unique_ptr< ICaller > > owned;
+        std::vector< ICaller* > callers;
+        owned.reserve(chunks.size());
+        callers.reserve(chunks.size());
+        for(auto& c: chunks) {
+            owned.push_back(std::unique_ptr< ICaller >(
+                new RangeCaller< BodyT, IndexT >(body, c.first, c.second,
+                                                 state.get())));
+            callers.push_back(owned.back().get());
+        }
+        //from now on deleted by the last task to complete
+        state.release();
+        auto first = callers.begin();
+        try {
+            queue_.Push(first, callers.end());
+        } catch(...) {
+            //the tasks not inserted complete the batch with the exception
+            const size_t pushed = first - callers.begin();
+            for(size_t i = 0; i != pushed; ++i) owned[i].release();
+            const std::exception_ptr e = std::current_exception();
+            for(size_t i = pushed; i != owned.size(); ++i) owned[i]->Cancel(e);
+            throw;
+        }
+        for(auto& c: owned) c.release();
+        return ft;
+    }
+    //start threads and put them into thread vector, accept submissions if
+    //at least one thread is started
     void StartThreads() {
+        stats_.Reset(nthreads_);
         for(int t = 0; t != nthreads_; ++t) {
-            threads_.push_back(std::move(std::thread( [this] {
+            threads_.push_back(std::move(std::thread( [this, t] {
                 while(true) {
+                    const StatsClock::time_point idle = StatsClock::now();
                     ICaller* c = queue_.Pop();
+                    const StatsClock::time_point start = StatsClock::now();
+                    stats_.RecordIdle(t, idle, start);
                     if(c->Empty()) { //interpret an empty Caller as a
                                      //'terminate' message
+                        delete c;
                         break;
                     }
                     c->Invoke(); 
+                    stats_.RecordTask(t, c->enqueued, start,
+                                      StatsClock::now());
                     delete c;
                 }
             })));    
         }
+        accepting_ = !threads_.empty();
     }        
 private:
     int nthreads_; //number of OS threads requested
     Queue queue_;  //command queue
     Threads threads_; //std::thread array; size == nthreads_ 
+    CancellationToken cancel_;
+    mutable std::mutex mutex_; //serializes Stop and Start
+    std::atomic< bool > accepting_{false}; //false when stopped
+    std::atomic< int > submitting_{0}; //submissions in progress
+    ExecutorStats stats_;
 };
 
 //------------------------------------------------------------------------------
@@ -211,7 +522,7 @@ int sum(int start, int end, int step) {
     return start;
 }
 
-//entry point: launch tasks and print how many times each thread executes a task
+//entry point: launch tasks and print the per-worker statistics
 //check sample launch configurations and results past the end of the main
 //function
 int main(int argc, char** argv) {
@@ -219,8 +530,9 @@ int main(int argc, char** argv) {
         if(argc > 1 && std::string(argv[1]) == "-h") {
             std::cout << argv[0] << "[task sleep time (ms)] "
                                  << "[number of tasks] "
-                                 << "[number of threads]\n"
-                                 << "default is (0,20,4)\n";
+                                 << "[number of threads] "
+                                 << "[trace file]\n"
+                                 << "default is (0,20,4,no trace)\n";
             return 0;                      
         }
         //test Executor
@@ -236,6 +548,108 @@ int main(int argc, char** argv) {
             std::cerr << "FAILED\n";
             return EXIT_FAILURE;
         }
+        std::cout << "OK\n";
+        //test batch submission
+        std::cout << "Testing batch submission...";
+        std::atomic< int > total(0);
+        std::vector< int > values(1000, 1);
+        auto b1 = exec.SubmitBatch([&total](int v) { total += v; },
+                                   values.begin(), values.end());
+        auto b2 = exec.ParallelFor(0, 1000, 64, [&total](int) { ++total; });
+        auto b3 = exec.ParallelFor(0, 10, 1, [](int i) {
+            if(i == 5) throw std::runtime_error("batch error");
+        });
+        auto b4 = exec.ParallelFor(0, values.size(), 64,
+                                   [&](size_t i) { total += values[i]; });
+        b1.get();
+        b2.get();
+        b4.get();
+        bool thrown = false;
+        try {
+            b3.get();
+        } catch(const std::runtime_error&) {
+            thrown = true;
+        }
+        if(total != 3000 || !thrown) {
+            std::cerr << "FAILED\n";
+            return EXIT_FAILURE;
+        }
+        std::cout << "OK\n";
+        //test stop modes: drain executes all the queued tasks, cancel
+        //fails the pending futures and signals the running ones, keep
+        //preserves the queue across a restart
+        std::cout << "Testing stop modes...";
+        std::atomic< int > executed(0);
+        auto increment = [&executed] { ++executed; };
+        exec.Restart(1);
+        for(int i = 0; i != 100; ++i) exec(increment);
+        exec.Stop();
+        const bool drained = executed == 100;
+        exec.Restart(1);
+        CancellationToken token = exec.Token();
+        std::promise< void > started;
+        auto running = exec([token, &started] {
+            started.set_value();
+            while(true) {
+                token.ThrowIfCancelled();
+                std::this_thread::yield();
+            }
+        });
+        started.get_future().wait();
+        std::vector< std::future< void > > pending;
+        for(int i = 0; i != 10; ++i) pending.push_back(exec(increment));
+        exec.Stop(Executor::StopMode::CANCEL);
+        int cancelled = 0;
+        pending.push_back(std::move(running));
+        for(auto& f: pending) {
+            try {
+                f.get();
+            } catch(const TaskCancelled&) {
+                ++cancelled;
+            }
+        }
+        executed = 0;
+        exec.Restart(1);
+        std::promise< void > resume;
+        std::shared_future< void > resumed = resume.get_future().share();
+        exec([resumed] { resumed.wait(); });
+        for(int i = 0; i != 100; ++i) exec(increment);
+        std::thread resizer([&exec] { exec.Restart(4); });
+        resume.set_value();
+        resizer.join();
+        exec.Stop();
+        if(!drained || cancelled != 11 || executed != 100
+           || exec.Token().Cancelled()) {
+            std::cerr << "FAILED\n";
+            return EXIT_FAILURE;
+        }
+        std::cout << "OK\n";
+        //test resizing under load: tasks submitted by another thread while
+        //restarting are accepted and executed
+        std::cout << "Testing restart under load...";
+        executed = 0;
+        exec.Restart(2);
+        std::atomic< bool > submitted(false);
+        bool rejected = false;
+        std::vector< std::future< void > > futures;
+        std::thread submitter([&] {
+            try {
+                for(int i = 0; i != 20000; ++i)
+                    futures.push_back(exec(increment));
+            } catch(const std::logic_error&) {
+                rejected = true;
+            }
+            submitted = true;
+        });
+        for(int i = 0; !submitted; ++i)
+            exec.Restart(1 + i % 3, i % 2 ? Executor::StopMode::DRAIN
+                                          : Executor::StopMode::KEEP);
+        submitter.join();
+        for(auto& f: futures) f.get();
+        if(rejected || executed != 20000) {
+            std::cerr << "FAILED\n";
+            return EXIT_FAILURE;
+        }
         std::cout << "OK\n\n";
         //OK run tasks
         const int sleeptime_ms = argc > 1 ? atoi(argv[1]) : 0;
@@ -248,20 +662,17 @@ int main(int argc, char** argv) {
                   << "  " << sleeptime_ms << " ms task sleep time\n"
                   << std::endl;
         std::mutex iomutex;
-        std::map< std::thread::id, int > counter; 
         exec.Restart(numthreads);
+        if(argc > 4) exec.EnableTrace(true);
         for(int t = 0; t != numtasks; ++t) {
-            exec([&iomutex, &counter, &sleeptime_ms](int i) {
+            exec([&iomutex, &sleeptime_ms](int i) {
                 {
-                    std::lock_guard<std::mutex> lk(iomutex); //also serializes
-                                                             //access to 
-                                                             //counter
+                    std::lock_guard<std::mutex> lk(iomutex);
                     std::cout << "Hello from task: " << i << "\t("
                               << std::hex 
                               << std::this_thread::get_id() << ')'
                               << std::dec
                               << std::endl;
-                    counter[std::this_thread::get_id()]++;
                 }
                 std::this_thread::sleep_for(
                     std::chrono::milliseconds(sleeptime_ms));          
@@ -269,14 +680,12 @@ int main(int argc, char** argv) {
         }
         exec.Stop();
         std::cout << std::endl;
-        typedef std::map< std::thread::id, int >::value_type CounterEntry;
-        std::for_each(counter.begin(), counter.end(), 
-                        [](const CounterEntry& e) {
-                            std::cout << "Thread " 
-                                      << std::hex << e.first << std::dec
-                                      << " executed " << e.second 
-                                      << " times\n";        
-                        });
+        exec.Stats().Print(std::cout);
+        if(argc > 4) {
+            std::ofstream trace(argv[4]);
+            exec.WriteChromeTrace(trace);
+            std::cout << "\nTrace written to " << argv[4] << '\n';
+        }
         std::cout << "\nRun with -h for info on usage options\n" << std::endl;
         return 0;
     } catch(const std::exception& e) {
@@ -288,7 +697,11 @@ int main(int argc, char** argv) {
 
 //SAMPLE OUTPUT: no arguments
 // Testing Executor...OK
+// Testing batch submission...OK
+// Testing stop modes...OK
+// Testing restart under load...OK
 //
+// Running tasks...
 // Run-time configuration:
 //   20 tasks
 //   4 threads
@@ -315,16 +728,25 @@ int main(int argc, char** argv) {
 // Hello from task: 18 (7fd151b9f700)
 // Hello from task: 19 (7fd1533a2700)
 //
-// Thread 7fd151b9f700 executed 4 times
-// Thread 7fd1523a0700 executed 5 times
-// Thread 7fd152ba1700 executed 5 times
-// Thread 7fd1533a2700 executed 6 times
+// Worker  0: 20 tasks, 0 steals, busy 0.050941 ms, idle 0.001697 ms
+//     latency (us) mean/p50/p99 43.0962/65.536/65.536, run time (us) mean/p99 2.54705/16.384
+// Worker  1: 0 tasks, 0 steals, busy 0 ms, idle 0.000117 ms
+//     latency (us) mean/p50/p99 0/0/0, run time (us) mean/p99 0/0
+// Worker  2: 0 tasks, 0 steals, busy 0 ms, idle 0.000122 ms
+//     latency (us) mean/p50/p99 0/0/0, run time (us) mean/p99 0/0
+// Worker  3: 0 tasks, 0 steals, busy 0 ms, idle 0.00013 ms
+//     latency (us) mean/p50/p99 0/0/0, run time (us) mean/p99 0/0
+// Total: 20 tasks, 0 steals, busy 0.050941 ms, idle 0.002066 ms
+//     latency (us) mean/p50/p99 43.0962/65.536/65.536, run time (us) mean/p99 2.54705/16.384
 //
 //Run with -h for info on usage options
 
 //SAMPLE OUTPUT: ./a.out 30 17 10
 // Testing Executor...OK
+// Testing batch submission...OK
+// Testing stop modes...OK
 //
+// Running tasks...
 // Run-time configuration:
 //   17 tasks
 //   10 threads
@@ -348,16 +770,28 @@ int main(int argc, char** argv) {
 // Hello from task: 15 (7fcd6cace700)
 // Hello from task: 16 (7fcd67fff700)
 //
-// Thread 7fcd677fe700 executed 2 times
-// Thread 7fcd67fff700 executed 2 times
-// Thread 7fcd6cace700 executed 2 times
-// Thread 7fcd6d2cf700 executed 1 times
-// Thread 7fcd6dad0700 executed 1 times
-// Thread 7fcd6e2d1700 executed 2 times
-// Thread 7fcd6ead2700 executed 2 times
-// Thread 7fcd6f2d3700 executed 1 times
-// Thread 7fcd6fad4700 executed 2 times
-// Thread 7fcd702d5700 executed 2 times
+// Worker  0: 1 tasks, 0 steals, busy 30.7064 ms, idle 0.081184 ms
+//     latency (us) mean/p50/p99 15.371/16.384/16.384, run time (us) mean/p99 30706.4/33554.4
+// Worker  1: 1 tasks, 0 steals, busy 30.6418 ms, idle 0.117266 ms
+//     latency (us) mean/p50/p99 10.255/16.384/16.384, run time (us) mean/p99 30641.8/33554.4
+// Worker  2: 1 tasks, 0 steals, busy 30.5224 ms, idle 0.128416 ms
+//     latency (us) mean/p50/p99 6.961/8.192/8.192, run time (us) mean/p99 30522.4/33554.4
+// Worker  3: 2 tasks, 0 steals, busy 60.5579 ms, idle 0.136503 ms
+//     latency (us) mean/p50/p99 15218.4/33554.4/33554.4, run time (us) mean/p99 30279/33554.4
+// Worker  4: 2 tasks, 0 steals, busy 60.5172 ms, idle 0.14217 ms
+//     latency (us) mean/p50/p99 15207/33554.4/33554.4, run time (us) mean/p99 30258.6/33554.4
+// Worker  5: 2 tasks, 0 steals, busy 60.4823 ms, idle 0.147782 ms
+//     latency (us) mean/p50/p99 15193.3/33554.4/33554.4, run time (us) mean/p99 30241.1/33554.4
+// Worker  6: 2 tasks, 0 steals, busy 60.4741 ms, idle 0.153042 ms
+//     latency (us) mean/p50/p99 15156.4/33554.4/33554.4, run time (us) mean/p99 30237/33554.4
+// Worker  7: 2 tasks, 0 steals, busy 60.3259 ms, idle 0.157932 ms
+//     latency (us) mean/p50/p99 15105.5/33554.4/33554.4, run time (us) mean/p99 30162.9/33554.4
+// Worker  8: 2 tasks, 0 steals, busy 60.4245 ms, idle 0.163231 ms
+//     latency (us) mean/p50/p99 15070.2/33554.4/33554.4, run time (us) mean/p99 30212.3/33554.4
+// Worker  9: 2 tasks, 0 steals, busy 60.5392 ms, idle 0.137342 ms
+//     latency (us) mean/p50/p99 15178.2/33554.4/33554.4, run time (us) mean/p99 30269.6/33554.4
+// Total: 17 tasks, 0 steals, busy 515.192 ms, idle 1.36487 ms
+//     latency (us) mean/p50/p99 12487.7/16.384/33554.4, run time (us) mean/p99 30305.4/33554.4
 //
 // Run with -h for info on usage options
 
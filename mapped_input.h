@@ -0,0 +1,242 @@
+//Author: Ugo Varetto
+//dot product of two binary files of float or double values (native byte
+//order, no header) larger than the available memory.
+//
+//mapped_file_t maps a file read-only with MADV_SEQUENTIAL; dot_mapped splits
+//the pages into one contiguous range per thread of reduce_pool_t, each
+//thread streams its range in windows: the next window is requested with
+//MADV_WILLNEED while the current one is processed, processed windows are
+//released with MADV_DONTNEED so that the resident set stays bounded by a few
+//windows per thread.
+//
+//dot_direct reads the files with O_DIRECT (no page cache) into two pairs of
+//aligned buffers: a background read fills one pair while dot() runs on the
+//other one. On file systems that do not support O_DIRECT (e.g. tmpfs) the
+//files are read through the page cache.
+//
+//Linux/POSIX only.
+#pragma once
+#include "blas_kernels.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+inline std::runtime_error system_error_msg(const std::string& what,
+                                           const std::string& path) {
+    return std::runtime_error(what + " " + path + ": "
+                              + std::strerror(errno));
+}
+
+//------------------------------------------------------------------------------
+//file descriptor closed on destruction
+class file_t {
+public:
+    explicit file_t(int fd) : fd_(fd) {}
+    file_t(const file_t&) = delete;
+    file_t& operator=(const file_t&) = delete;
+    ~file_t() { if(fd_ >= 0) ::close(fd_); }
+    int fd() const { return fd_; }
+    //size in bytes
+    std::size_t size() const {
+        struct stat s;
+        if(::fstat(fd_, &s) != 0)
+            throw std::runtime_error(std::string("Cannot stat file: ")
+                                     + std::strerror(errno));
+        return std::size_t(s.st_size);
+    }
+private:
+    int fd_;
+};
+
+//------------------------------------------------------------------------------
+//read-only memory mapping of a whole file
+class mapped_file_t {
+public:
+    explicit mapped_file_t(const std::string& path,
+                           int advice = MADV_SEQUENTIAL) {
+        const file_t f(::open(path.c_str(), O_RDONLY));
+        if(f.fd() < 0) throw system_error_msg("Cannot open", path);
+        size_ = f.size();
+        if(size_ == 0) return;
+        //the mapping stays valid after the descriptor is closed
+        void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, f.fd(), 0);
+        if(p == MAP_FAILED) throw system_error_msg("Cannot map", path);
+        data_ = static_cast< const char* >(p);
+        ::madvise(const_cast< char* >(data_), size_, advice);
+    }
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+    ~mapped_file_t() {
+        if(data_) ::munmap(const_cast< char* >(data_), size_);
+    }
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    //advice for the pages overlapping [offset, offset + length)
+    void advise(std::size_t offset, std::size_t length, int advice) const {
+        const std::size_t page = page_size();
+        const std::size_t b = offset / page * page;
+        const std::size_t e = std::min(offset + length, size_);
+        if(b < e) ::madvise(const_cast< char* >(data_) + b, e - b, advice);
+    }
+    static std::size_t page_size() {
+        static const std::size_t p = std::size_t(sysconf(_SC_PAGESIZE));
+        return p;
+    }
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+//number of T elements in each file, which must have the same size
+template < typename T >
+std::size_t common_size(std::size_t xbytes, std::size_t ybytes) {
+    if(xbytes != ybytes || xbytes % sizeof(T) != 0)
+        throw std::range_error("Input files of different size or not a "
+                               "multiple of the element size");
+    return xbytes / sizeof(T);
+}
+
+//windows of 16 MiB per file
+const std::size_t MAPPED_WINDOW = std::size_t(16) << 20;
+
+//x.y over the mapped files, page ranges split among nt threads
+template < typename T >
+T dot_mapped(const mapped_file_t& x, const mapped_file_t& y, int nt,
+             std::size_t window = MAPPED_WINDOW) {
+    const std::size_t n = common_size< T >(x.size(), y.size());
+    const std::size_t page = mapped_file_t::page_size();
+    const std::size_t per_page = page / sizeof(T);
+    const std::size_t per_window = std::max(window / page, std::size_t(1))
+                                   * per_page;
+    const T* X = reinterpret_cast< const T* >(x.data());
+    const T* Y = reinterpret_cast< const T* >(y.data());
+    const dot_kernel_t< T > kernel = dot_kernel< T >();
+    const std::size_t pages = (n + per_page - 1) / per_page;
+    return parallel_reduce_chunks(*reduce_pool(nt), pages, T(0),
+        [=, &x, &y](std::size_t b, std::size_t e) {
+            const std::size_t end = std::min(e * per_page, n);
+            T d = T(0);
+            for(std::size_t w = b * per_page; w < end; w += per_window) {
+                const std::size_t we = std::min(end, w + per_window);
+                const std::size_t next = std::min(end - we, per_window);
+                if(next != 0) {
+                    x.advise(we * sizeof(T), next * sizeof(T),
+                             MADV_WILLNEED);
+                    y.advise(we * sizeof(T), next * sizeof(T),
+                             MADV_WILLNEED);
+                }
+                d += kernel(we - w, X + w, Y + w);
+                x.advise(w * sizeof(T), (we - w) * sizeof(T), MADV_DONTNEED);
+                y.advise(w * sizeof(T), (we - w) * sizeof(T), MADV_DONTNEED);
+            }
+            return d;
+        }, std::plus< T >());
+}
+
+template < typename T >
+T dot_mapped(const std::string& xpath, const std::string& ypath, int nt,
+             std::size_t window = MAPPED_WINDOW) {
+    const mapped_file_t x(xpath), y(ypath);
+    return dot_mapped< T >(x, y, nt, window);
+}
+
+//------------------------------------------------------------------------------
+//O_DIRECT requires buffers, offsets and sizes aligned to the logical block
+//size of the device, 4 KiB covers all the common cases
+const std::size_t DIRECT_ALIGNMENT = 4096;
+
+struct free_deleter_t {
+    void operator()(void* p) const { std::free(p); }
+};
+
+typedef std::unique_ptr< char, free_deleter_t > aligned_buffer_ptr_t;
+
+inline aligned_buffer_ptr_t aligned_buffer(std::size_t bytes) {
+    void* p = nullptr;
+    if(posix_memalign(&p, DIRECT_ALIGNMENT, bytes) != 0)
+        throw std::bad_alloc();
+    return aligned_buffer_ptr_t(static_cast< char* >(p));
+}
+
+//opened with O_DIRECT if supported by the file system
+inline int open_direct(const std::string& path, bool& direct) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+    direct = fd >= 0;
+    if(fd < 0 && errno == EINVAL) fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw system_error_msg("Cannot open", path);
+    return fd;
+}
+
+//bytes read at offset, less than size only at the end of the file; size is
+//a multiple of DIRECT_ALIGNMENT
+inline std::size_t read_block(int fd, char* buffer, std::size_t size,
+                              std::size_t offset, const std::string& path) {
+    std::size_t done = 0;
+    while(done < size) {
+        const ssize_t r = ::pread(fd, buffer + done, size - done,
+                                  off_t(offset + done));
+        if(r < 0 && errno == EINTR) continue;
+        if(r < 0) throw system_error_msg("Cannot read", path);
+        if(r == 0) break;
+        done += std::size_t(r);
+    }
+    return done;
+}
+
+//blocks of 8 MiB per file
+const std::size_t DIRECT_BLOCK = std::size_t(8) << 20;
+
+//x.y reading both files in blocks, double buffered; dot() on nt threads;
+//direct is set to false if the files were read through the page cache
+template < typename T >
+T dot_direct(const std::string& xpath, const std::string& ypath, int nt,
+             bool& direct, std::size_t block = DIRECT_BLOCK) {
+    bool xdirect = false, ydirect = false;
+    const file_t x(open_direct(xpath, xdirect));
+    const file_t y(open_direct(ypath, ydirect));
+    direct = xdirect && ydirect;
+    const std::size_t n = common_size< T >(x.size(), y.size());
+    const std::size_t bytes = n * sizeof(T);
+    //multiple of both the alignment and the element size
+    block = std::max(block / DIRECT_ALIGNMENT, std::size_t(1))
+            * DIRECT_ALIGNMENT;
+    aligned_buffer_ptr_t buffers[2][2] = {
+        {aligned_buffer(block), aligned_buffer(block)},
+        {aligned_buffer(block), aligned_buffer(block)}
+    };
+    auto fill = [&](int b, std::size_t offset) {
+        const std::size_t rx = read_block(x.fd(), buffers[b][0].get(), block,
+                                          offset, xpath);
+        const std::size_t ry = read_block(y.fd(), buffers[b][1].get(), block,
+                                          offset, ypath);
+        const std::size_t expected = std::min(block, bytes - offset);
+        if(rx != expected || ry != expected)
+            throw std::runtime_error("Input files truncated while reading");
+        return expected / sizeof(T);
+    };
+    T d = T(0);
+    if(bytes == 0) return d;
+    std::future< std::size_t > pending =
+        std::async(std::launch::async, fill, 0, std::size_t(0));
+    int current = 0;
+    for(std::size_t offset = 0; offset < bytes; offset += block) {
+        const std::size_t count = pending.get();
+        if(offset + block < bytes)
+            pending = std::async(std::launch::async, fill, 1 - current,
+                                 offset + block);
+        d += dot(int(count),
+                 reinterpret_cast< const T* >(buffers[current][0].get()),
+                 reinterpret_cast< const T* >(buffers[current][1].get()),
+                 nt);
+        current = 1 - current;
+    }
+    return d;
+}
@@ -5,6 +5,9 @@
 //
 // do specify -pthread when compiling if not you'll get a run-time error
 // g++ task-based-executor-concurrent-generic.cpp -std=c++11 -pthread
+//
+// -DUSE_RING_QUEUE replaces the mutex protected SyncQueue used by the Executor
+// with the bounded lock-free RingQueue in ../RingQueue.h
 
 #include <algorithm>
 #include <chrono>
@@ -22,6 +25,9 @@
 #include <type_traits>
 #include <utility>
 #include <vector>
+#ifdef USE_RING_QUEUE
+#include "../RingQueue.h"
+#endif
 
 //------------------------------------------------------------------------------
 // synchronized queue (could be an inner class inside Executor):
@@ -128,7 +134,11 @@ class Caller<void> : public ICaller {
 // number of threads to use at Executor construction time; threads are started
 // in the constructor and joined in the destructor
 class Executor {
+#ifdef USE_RING_QUEUE
+    typedef RingQueue<std::unique_ptr<ICaller> > Queue;
+#else
     typedef SyncQueue<std::unique_ptr<ICaller> > Queue;
+#endif
     typedef std::vector<std::thread> Threads;
 
    public: